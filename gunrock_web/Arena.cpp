@@ -0,0 +1,54 @@
+#include <stdint.h>
+
+#include "Arena.h"
+
+using namespace std;
+
+Arena::Arena(size_t blockSize) {
+  this->m_blockSize = blockSize;
+  this->m_next = NULL;
+  this->m_end = NULL;
+  newBlock(blockSize);
+}
+
+Arena::~Arena() {
+  for (size_t idx = 0; idx < m_blocks.size(); idx++) {
+    delete [] m_blocks[idx];
+  }
+}
+
+void Arena::reset() {
+  for (size_t idx = 1; idx < m_blocks.size(); idx++) {
+    delete [] m_blocks[idx];
+  }
+  m_blocks.resize(1);
+  m_next = m_blocks[0];
+  m_end = m_blocks[0] + m_blockSize;
+}
+
+void Arena::newBlock(size_t minSize) {
+  size_t size = max(minSize, m_blockSize);
+  char *block = new char[size];
+  m_blocks.push_back(block);
+  m_next = block;
+  m_end = block + size;
+}
+
+void *Arena::do_allocate(size_t bytes, size_t alignment) {
+  uintptr_t aligned = ((uintptr_t) m_next + alignment - 1) & ~(uintptr_t) (alignment - 1);
+  if (aligned + bytes > (uintptr_t) m_end) {
+    // big allocations get a block of their own
+    newBlock(bytes + alignment);
+    aligned = ((uintptr_t) m_next + alignment - 1) & ~(uintptr_t) (alignment - 1);
+  }
+  m_next = (char *) (aligned + bytes);
+  return (void *) aligned;
+}
+
+void Arena::do_deallocate(void * /*p*/, size_t /*bytes*/, size_t /*alignment*/) {
+  // everything is freed at once by reset
+}
+
+bool Arena::do_is_equal(const memory_resource &other) const noexcept {
+  return this == &other;
+}
@@ -0,0 +1,326 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <iostream>
+
+#include "AsyncLog.h"
+
+using namespace std;
+
+// how much each thread can have logged before the writer catches up
+#define RING_SIZE (64 * 1024)
+// the most threads that can have a ring of their own at once, any more
+// share one ring under a lock
+#define MAX_THREADS (256)
+#define SHARED_RING (MAX_THREADS)
+// how much the writer collects before writing it out
+#define BATCH_SIZE (64 * 1024)
+
+// Lines sit in a ring behind one of these. They are padded to 8 bytes so
+// headers never straddle the end of the ring.
+struct LineHeader {
+  uint64_t seq;
+  uint32_t len;
+  uint32_t skip;
+};
+
+/*
+ * A ring with one producer, the thread it belongs to, and one consumer,
+ * the writer. head and tail only ever grow, and their difference is how
+ * much of data is in use.
+ */
+struct LogRing {
+  atomic<uint64_t> head;
+  atomic<uint64_t> tail;
+  char data[RING_SIZE];
+};
+
+static int logFd = -1;
+// NULL until a thread takes the ring, the last one is the shared ring
+static atomic<LogRing *> rings[MAX_THREADS + 1];
+// how many of the rings before the shared one have been made
+static atomic<int> numRings(0);
+// rings whose threads have exited, for the next threads that log
+static int freeRings[MAX_THREADS];
+static int numFree = 0;
+static pthread_mutex_t ringsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t sharedRingLock = PTHREAD_MUTEX_INITIALIZER;
+// held while a thread takes its id, along with the number of its first line
+static pthread_mutex_t firstLineLock = PTHREAD_MUTEX_INITIALIZER;
+static int nextTid = 0;
+// the number the next line logged gets
+static atomic<uint64_t> nextSeq(0);
+// every line before this one is in the file
+static atomic<uint64_t> writtenSeq(0);
+static atomic<bool> writerSleeping(false);
+static sem_t writerWakeup;
+
+/*
+ * A thread's hold on its ring. When the thread exits the ring goes back
+ * for another thread to take over, lines it hasn't written yet and all:
+ * the new owner's lines are numbered after them, so the ring stays in
+ * order.
+ */
+struct RingLease {
+  int slot;
+
+  RingLease() {
+    slot = -1;
+  }
+
+  ~RingLease() {
+    if (slot >= 0 && slot != SHARED_RING) {
+      pthread_mutex_lock(&ringsLock);
+      freeRings[numFree++] = slot;
+      pthread_mutex_unlock(&ringsLock);
+    }
+  }
+};
+
+static thread_local RingLease myLease;
+static thread_local int myTid = -1;
+
+static void *writerMain(void *arg);
+static void wakeWriter();
+
+static size_t lineSpace(size_t len) {
+  return sizeof(LineHeader) + ((len + 7) & ~(size_t) 7);
+}
+
+static void flushAtExit() {
+  AsyncLog::flush();
+}
+
+void AsyncLog::open(string fileName) {
+  logFd = ::open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (logFd < 0) {
+    cerr << "Could not open log file: " << fileName << endl;
+    exit(1);
+  }
+
+  sem_init(&writerWakeup, 0, 0);
+  // the writer isn't a dthread since it would log its own start
+  pthread_t writer;
+  if (pthread_create(&writer, NULL, writerMain, NULL) != 0) {
+    cerr << "Could not start the log writer" << endl;
+    exit(1);
+  }
+  pthread_detach(writer);
+  atexit(flushAtExit);
+}
+
+static LogRing *newRing() {
+  LogRing *ring = new LogRing();
+  ring->head.store(0);
+  ring->tail.store(0);
+  return ring;
+}
+
+// Finds this thread a ring the first time it logs: one a thread that
+// exited gave back, a new one, or the shared one if there are already
+// MAX_THREADS.
+static int takeRing() {
+  pthread_mutex_lock(&ringsLock);
+  int slot;
+  if (numFree > 0) {
+    slot = freeRings[--numFree];
+  } else if (numRings.load() < MAX_THREADS) {
+    slot = numRings.load();
+    rings[slot].store(newRing(), memory_order_release);
+    numRings.store(slot + 1, memory_order_release);
+  } else {
+    slot = SHARED_RING;
+    if (rings[slot].load() == NULL) {
+      rings[slot].store(newRing(), memory_order_release);
+    }
+  }
+  pthread_mutex_unlock(&ringsLock);
+  return slot;
+}
+
+/**
+ * Logs "function thread: tid payload". Only waits if this thread has
+ * logged a whole ring's worth that the writer hasn't got to yet.
+ */
+void AsyncLog::log(string_view function, string_view payload) {
+  if (myLease.slot < 0) {
+    myLease.slot = takeRing();
+  }
+  if (logFd < 0) {
+    return;
+  }
+
+  // a thread's first line makes room for the longest thread id, since it
+  // doesn't have one until its line is numbered
+  char tid[32];
+  int tidLen = myTid < 0 ? sizeof(" thread: -2147483648 ") - 1 : snprintf(tid, sizeof(tid), " thread: %d ", myTid);
+  size_t len = function.size() + tidLen + payload.size() + 1;
+  size_t space = lineSpace(len);
+  if (space > RING_SIZE / 2) {
+    // way too long for a log line
+    return;
+  }
+
+  bool shared = myLease.slot == SHARED_RING;
+  if (shared) {
+    pthread_mutex_lock(&sharedRingLock);
+  }
+  LogRing *ring = rings[myLease.slot].load(memory_order_relaxed);
+  uint64_t head = ring->head.load(memory_order_relaxed);
+  size_t offset = head % RING_SIZE;
+  size_t skip = RING_SIZE - offset < space ? RING_SIZE - offset : 0;
+  while (head + skip + space - ring->tail.load(memory_order_acquire) > RING_SIZE) {
+    wakeWriter();
+    sched_yield();
+  }
+
+  if (skip > 0) {
+    // the line doesn't fit before the end of the ring, so it starts over
+    // at the beginning and the writer skips what's left, which it knows
+    // to do without a marker if there isn't room for one
+    if (skip >= sizeof(LineHeader)) {
+      ((LineHeader *) (ring->data + offset))->skip = 1;
+    }
+    offset = 0;
+  }
+  LineHeader *header = (LineHeader *) (ring->data + offset);
+  bool first = myTid < 0;
+  if (first) {
+    // the id and the number are taken together so ids first show up in
+    // the file in order
+    pthread_mutex_lock(&firstLineLock);
+    myTid = nextTid++;
+    header->seq = nextSeq.fetch_add(1);
+    pthread_mutex_unlock(&firstLineLock);
+    tidLen = snprintf(tid, sizeof(tid), " thread: %d ", myTid);
+    len = function.size() + tidLen + payload.size() + 1;
+    space = lineSpace(len);
+  }
+  char *line = ring->data + offset + sizeof(LineHeader);
+  memcpy(line, function.data(), function.size());
+  memcpy(line + function.size(), tid, tidLen);
+  memcpy(line + function.size() + tidLen, payload.data(), payload.size());
+  line[len - 1] = '\n';
+  header->len = len;
+  header->skip = 0;
+
+  // the number is taken last so the writer never waits on us for long
+  if (!first) {
+    header->seq = nextSeq.fetch_add(1);
+  }
+  ring->head.store(head + skip + space, memory_order_release);
+  if (shared) {
+    pthread_mutex_unlock(&sharedRingLock);
+  }
+  if (writerSleeping.load()) {
+    wakeWriter();
+  }
+}
+
+static void wakeWriter() {
+  if (writerSleeping.exchange(false)) {
+    sem_post(&writerWakeup);
+  }
+}
+
+// Waits until everything logged so far is in the file.
+void AsyncLog::flush() {
+  if (logFd < 0) {
+    return;
+  }
+  uint64_t target = nextSeq.load();
+  while (writtenSeq.load() < target) {
+    wakeWriter();
+    sched_yield();
+  }
+}
+
+static void writeBatch(char *batch, size_t *used) {
+  size_t done = 0;
+  while (done < *used) {
+    ssize_t ret = write(logFd, batch + done, *used - done);
+    if (ret <= 0) {
+      cerr << "log file write error, ret = " << ret << endl;
+      exit(1);
+    }
+    done += ret;
+  }
+  *used = 0;
+}
+
+// Returns the next line in ring, skipping over the end of the ring if
+// the line after it wrapped around, or NULL if the ring is empty.
+static LineHeader *peekLine(LogRing *ring) {
+  uint64_t tail = ring->tail.load(memory_order_relaxed);
+  if (tail == ring->head.load(memory_order_acquire)) {
+    return NULL;
+  }
+  size_t offset = tail % RING_SIZE;
+  if (RING_SIZE - offset < sizeof(LineHeader) ||
+      ((LineHeader *) (ring->data + offset))->skip) {
+    ring->tail.store(tail + RING_SIZE - offset, memory_order_release);
+    return peekLine(ring);
+  }
+  return (LineHeader *) (ring->data + offset);
+}
+
+/*
+ * Merges the rings back into the order lines were numbered in and writes
+ * them out. A thread's own lines are always in order in its ring, so the
+ * next line is at the front of one of them.
+ */
+static void *writerMain(void * /*arg*/) {
+  static char batch[BATCH_SIZE];
+  size_t used = 0;
+  uint64_t next = 0;
+
+  while (true) {
+    bool found = false;
+    int count = numRings.load(memory_order_acquire);
+    for (int idx = 0; idx <= count; idx++) {
+      LogRing *ring = rings[idx == count ? SHARED_RING : idx].load(memory_order_acquire);
+      if (ring == NULL) {
+        continue;
+      }
+      LineHeader *header;
+      while ((header = peekLine(ring)) != NULL && header->seq == next) {
+        if (used + header->len > BATCH_SIZE) {
+          writeBatch(batch, &used);
+          writtenSeq.store(next);
+        }
+        memcpy(batch + used, (char *) header + sizeof(LineHeader), header->len);
+        used += header->len;
+        ring->tail.fetch_add(lineSpace(header->len), memory_order_release);
+        next++;
+        found = true;
+      }
+    }
+    if (found) {
+      continue;
+    }
+
+    if (used > 0) {
+      writeBatch(batch, &used);
+      writtenSeq.store(next);
+    }
+    if (next != nextSeq.load()) {
+      // a thread has taken the next number but hasn't finished its line
+      sched_yield();
+      continue;
+    }
+
+    writerSleeping.store(true);
+    if (next == nextSeq.load()) {
+      sem_wait(&writerWakeup);
+    }
+    writerSleeping.store(false);
+  }
+  return NULL;
+}
@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <iostream>
+
+#include "BackendPool.h"
+#include "HttpClient.h"
+#include "Metrics.h"
+#include "StringUtils.h"
+#include "dthread.h"
+
+using namespace std;
+
+// the most idle connections we keep open to one node
+#define MAX_IDLE_CONNECTIONS (8)
+// how often we check on every node
+#define HEALTH_CHECK_SECONDS (1)
+// how long we wait on a node to connect, or for each read or write,
+// before giving up on it
+#define BACKEND_TIMEOUT_MS (5000)
+
+BackendPool::BackendPool() : m_connections(MAX_IDLE_CONNECTIONS, BACKEND_TIMEOUT_MS) {
+  m_checkingHealth = false;
+  pthread_mutex_init(&m_lock, NULL);
+}
+
+Backend *BackendPool::add(string name) {
+  vector<string> hostPort = StringUtils::split(name, ':');
+  if (hostPort.size() != 2 || atoi(hostPort[1].c_str()) <= 0) {
+    return NULL;
+  }
+
+  dthread_mutex_lock(&m_lock);
+  for (size_t idx = 0; idx < m_backends.size(); idx++) {
+    if (m_backends[idx]->name == name) {
+      dthread_mutex_unlock(&m_lock);
+      return m_backends[idx];
+    }
+  }
+  Backend *backend = new Backend();
+  backend->name = name;
+  backend->host = hostPort[0];
+  backend->port = atoi(hostPort[1].c_str());
+  backend->outstanding = 0;
+  backend->healthy = true;
+  m_backends.push_back(backend);
+  Metrics::addGauge(BACKENDS_HEALTHY, 1);
+  bool checkingHealth = m_checkingHealth;
+  dthread_mutex_unlock(&m_lock);
+  if (checkingHealth) {
+    this->startHealthCheck(backend);
+  }
+  return backend;
+}
+
+Backend *BackendPool::choose(const vector<Backend *> &candidates) {
+  Backend *best = NULL;
+  for (size_t idx = 0; idx < candidates.size(); idx++) {
+    Backend *backend = candidates[idx];
+    if (backend->healthy && (best == NULL || backend->outstanding < best->outstanding)) {
+      best = backend;
+    }
+  }
+  if (best == NULL && !candidates.empty()) {
+    best = candidates[0];
+  }
+  return best;
+}
+
+HTTPClientResponse *BackendPool::send(Backend *backend, string method, string url,
+                                      const map<string, string> &headers, string body) {
+  Metrics::count(BACKEND_REQUESTS);
+  while (true) {
+    bool reused = false;
+    bool sent = false;
+    MySocket *connection = NULL;
+    HTTPClientResponse *response = NULL;
+    backend->outstanding++;
+    try {
+      connection = m_connections.acquire(backend->host, backend->port, &reused);
+      if (!reused) {
+        Metrics::count(BACKEND_CONNECTIONS_OPENED);
+      }
+      HttpClient client(connection, backend->name);
+      map<string, string>::const_iterator iter;
+      for (iter = headers.begin(); iter != headers.end(); iter++) {
+        client.set_header(iter->first, iter->second);
+      }
+      client.write_request(url, method, body);
+      sent = true;
+      response = client.read_response();
+    } catch (...) {
+      // response is still NULL
+    }
+    backend->outstanding--;
+
+    if (response != NULL && response->status() != 0) {
+      if (response->keepAlive()) {
+        m_connections.release(backend->host, backend->port, connection);
+      } else {
+        delete connection;
+      }
+      this->setHealthy(backend, true);
+      return response;
+    }
+
+    // a node that took too long will take too long again
+    bool timedOut = connection != NULL && connection->timedOut();
+    bool unseen = !sent || (response != NULL && !response->received());
+    delete response;
+    delete connection;
+    if (!reused || timedOut || !unseen || !HttpClient::idempotent(method)) {
+      Metrics::count(BACKEND_FAILURES);
+      this->setHealthy(backend, false);
+      throw SocketError("no response from " + backend->name);
+    }
+  }
+}
+
+vector<HTTPClientResponse *> BackendPool::sendAll(const vector<Backend *> &backends, string method, string url) {
+  size_t count = backends.size();
+  vector<MySocket *> connections(count, (MySocket *) NULL);
+  vector<HttpClient *> clients(count, (HttpClient *) NULL);
+  vector<HTTPClientResponse *> responses(count, (HTTPClientResponse *) NULL);
+  for (size_t idx = 0; idx < count; idx++) {
+    Backend *backend = backends[idx];
+    Metrics::count(BACKEND_REQUESTS);
+    backend->outstanding++;
+    try {
+      bool reused = false;
+      connections[idx] = m_connections.acquire(backend->host, backend->port, &reused);
+      if (!reused) {
+        Metrics::count(BACKEND_CONNECTIONS_OPENED);
+      }
+      clients[idx] = new HttpClient(connections[idx], backend->name);
+      clients[idx]->write_request(url, method, "");
+    } catch (...) {
+      delete clients[idx];
+      clients[idx] = NULL;
+    }
+  }
+
+  map<string, string> headers;
+  for (size_t idx = 0; idx < count; idx++) {
+    Backend *backend = backends[idx];
+    HTTPClientResponse *response = NULL;
+    if (clients[idx] != NULL) {
+      response = clients[idx]->read_response();
+      delete clients[idx];
+    }
+    backend->outstanding--;
+
+    if (response != NULL && response->status() != 0) {
+      if (response->keepAlive()) {
+        m_connections.release(backend->host, backend->port, connections[idx]);
+      } else {
+        delete connections[idx];
+      }
+      this->setHealthy(backend, true);
+      responses[idx] = response;
+      continue;
+    }
+
+    bool timedOut = connections[idx] != NULL && connections[idx]->timedOut();
+    bool received = response != NULL && response->received();
+    delete response;
+    delete connections[idx];
+    if (timedOut || received) {
+      Metrics::count(BACKEND_FAILURES);
+      this->setHealthy(backend, false);
+      continue;
+    }
+    // most likely an idle connection the node had closed, which send()
+    // knows to try again on a new one
+    try {
+      responses[idx] = this->send(backend, method, url, headers, "");
+    } catch (...) {
+      // already marked unhealthy
+    }
+  }
+  return responses;
+}
+
+void BackendPool::setHealthy(Backend *backend, bool healthy) {
+  dthread_mutex_lock(&m_lock);
+  bool changed = backend->healthy != healthy;
+  if (changed) {
+    cerr << "storage node " << backend->name << (healthy ? " is back" : " is unhealthy") << endl;
+    backend->healthy = healthy;
+    Metrics::addGauge(BACKENDS_HEALTHY, healthy ? 1 : -1);
+  }
+  dthread_mutex_unlock(&m_lock);
+
+  if (changed && !healthy) {
+    // whatever broke probably took these with it
+    m_connections.clear(backend->host, backend->port);
+  }
+}
+
+void BackendPool::startHealthChecks() {
+  dthread_mutex_lock(&m_lock);
+  m_checkingHealth = true;
+  vector<Backend *> backends = m_backends;
+  dthread_mutex_unlock(&m_lock);
+
+  for (size_t idx = 0; idx < backends.size(); idx++) {
+    this->startHealthCheck(backends[idx]);
+  }
+}
+
+void BackendPool::startHealthCheck(Backend *backend) {
+  HealthCheck *check = new HealthCheck();
+  check->pool = this;
+  check->backend = backend;
+  pthread_t thread;
+  dthread_create(&thread, NULL, healthLoop, check);
+  dthread_detach(thread);
+}
+
+// Any answer at all means the node is up, send() marks it healthy or not.
+void *BackendPool::healthLoop(void *arg) {
+  HealthCheck *check = (HealthCheck *) arg;
+  map<string, string> headers;
+  while (true) {
+    sleep(HEALTH_CHECK_SECONDS);
+    try {
+      delete check->pool->send(check->backend, "HEAD", "/ds3/", headers, "");
+    } catch (...) {
+      // already marked unhealthy
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,135 @@
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "BodyStream.h"
+
+using namespace std;
+
+StringBodyStream::StringBodyStream(string data) {
+  this->data = data;
+  this->offset = 0;
+}
+
+int StringBodyStream::size() {
+  return data.size();
+}
+
+int StringBodyStream::read(void *buffer, int len) {
+  int copySize = min((size_t) len, data.size() - offset);
+  memcpy(buffer, data.data() + offset, copySize);
+  offset += copySize;
+  return copySize;
+}
+
+FileDescriptorBodyStream::FileDescriptorBodyStream(int fd, off_t offset, int length) {
+  this->fd = fd;
+  this->offset = offset;
+  this->remaining = length;
+  this->length = length;
+}
+
+int FileDescriptorBodyStream::size() {
+  return length;
+}
+
+int FileDescriptorBodyStream::read(void *buffer, int len) {
+  if (remaining <= 0) {
+    return 0;
+  }
+  // pread leaves the file position alone so other streams can share fd
+  int ret = pread(fd, buffer, min(len, remaining), offset);
+  if (ret <= 0) {
+    return 0;
+  }
+  offset += ret;
+  remaining -= ret;
+  return ret;
+}
+
+void FileDescriptorBodyStream::sendTo(MySocket *client) {
+  client->sendFile(fd, offset, remaining);
+  offset += remaining;
+  remaining = 0;
+}
+
+MultiBodyStream::MultiBodyStream() {
+  this->current = 0;
+}
+
+MultiBodyStream::~MultiBodyStream() {
+  for (size_t idx = 0; idx < streams.size(); idx++) {
+    delete streams[idx];
+  }
+}
+
+void MultiBodyStream::add(BodyStream *stream) {
+  streams.push_back(stream);
+}
+
+int MultiBodyStream::size() {
+  int total = 0;
+  for (size_t idx = 0; idx < streams.size(); idx++) {
+    int streamSize = streams[idx]->size();
+    if (streamSize < 0) {
+      return -1;
+    }
+    total += streamSize;
+  }
+  return total;
+}
+
+int MultiBodyStream::read(void *buffer, int len) {
+  while (current < streams.size()) {
+    int ret = streams[current]->read(buffer, len);
+    if (ret > 0) {
+      return ret;
+    }
+    current++;
+  }
+  return 0;
+}
+
+DeflateBodyStream::DeflateBodyStream(BodyStream *source, bool gzip) {
+  this->source = source;
+  this->sourceDone = false;
+  this->finished = false;
+  memset(&zstream, 0, sizeof(zstream));
+  // adding 16 to the window bits asks zlib for a gzip header and trailer
+  int windowBits = gzip ? 15 + 16 : 15;
+  if (deflateInit2(&zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, windowBits,
+                   8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    finished = true;
+  }
+}
+
+DeflateBodyStream::~DeflateBodyStream() {
+  deflateEnd(&zstream);
+  delete source;
+}
+
+int DeflateBodyStream::size() {
+  return -1;
+}
+
+int DeflateBodyStream::read(void *buffer, int len) {
+  zstream.next_out = (Bytef *) buffer;
+  zstream.avail_out = len;
+  while (zstream.avail_out > 0 && !finished) {
+    if (zstream.avail_in == 0 && !sourceDone) {
+      int ret = source->read(input, sizeof(input));
+      if (ret <= 0) {
+        sourceDone = true;
+      } else {
+        zstream.next_in = input;
+        zstream.avail_in = ret;
+      }
+    }
+    int ret = deflate(&zstream, sourceDone ? Z_FINISH : Z_NO_FLUSH);
+    if (ret == Z_STREAM_END || ret == Z_STREAM_ERROR) {
+      finished = true;
+    }
+  }
+  return len - zstream.avail_out;
+}
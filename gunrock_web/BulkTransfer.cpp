@@ -0,0 +1,383 @@
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "BulkTransfer.h"
+#include "HttpClient.h"
+#include "HttpUtils.h"
+#include "dthread.h"
+
+using namespace std;
+
+// how long we wait before the first retry, doubling for each one after
+#define FIRST_BACKOFF_USEC (100 * 1000)
+#define MAX_BACKOFF_USEC (5 * 1000 * 1000)
+
+// Whether a request that got status might work if we send it again.
+static bool retryable(int status) {
+  return status == 502 || status == 503 || status == 504;
+}
+
+static uint64_t nowUsec() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+// "a/b" with exactly one slash between them, whatever a ends with.
+static string joinPath(string parent, string child) {
+  if (parent.empty() || parent.back() == '/') {
+    return parent + child;
+  }
+  return parent + "/" + child;
+}
+
+// The request path for remote, which may or may not start with /ds3/.
+static string ds3Path(string remote) {
+  if (remote.compare(0, 5, "/ds3/") == 0) {
+    remote = remote.substr(5);
+  }
+  while (!remote.empty() && remote[0] == '/') {
+    remote = remote.substr(1);
+  }
+  return "/ds3/" + remote;
+}
+
+// Makes dir and any of its parents that don't exist yet.
+static bool makeDirs(const string &dir) {
+  for (size_t slash = dir.find('/', 1); ; slash = dir.find('/', slash + 1)) {
+    string prefix = dir.substr(0, slash);
+    if (!prefix.empty() && mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) {
+      return false;
+    }
+    if (slash == string::npos) {
+      return true;
+    }
+  }
+}
+
+// Adds a job for every regular file under localDir.
+static void findFiles(string localDir, string remoteDir, deque<pair<string, string> > *files) {
+  DIR *dir = opendir(localDir.c_str());
+  if (dir == NULL) {
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    string name = entry->d_name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+    string local = joinPath(localDir, name);
+    struct stat info;
+    if (stat(local.c_str(), &info) != 0) {
+      continue;
+    }
+    if (S_ISDIR(info.st_mode)) {
+      findFiles(local, joinPath(remoteDir, name), files);
+    } else if (S_ISREG(info.st_mode)) {
+      files->push_back(make_pair(local, joinPath(remoteDir, name)));
+    }
+  }
+  closedir(dir);
+}
+
+BulkTransfer::BulkTransfer(string host, int port, int connections, int retries) : m_pool(connections) {
+  m_host = host;
+  m_port = port;
+  m_connections = connections;
+  m_retries = retries;
+  m_progress = NULL;
+  m_upload = false;
+  m_active = 0;
+  m_done = false;
+  m_startUsec = 0;
+  m_files = 0;
+  m_bytes = 0;
+  m_retried = 0;
+  m_failures = 0;
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_changed, NULL);
+}
+
+void BulkTransfer::setProgress(ostream *out) {
+  m_progress = out;
+}
+
+BulkTransferStats BulkTransfer::upload(string localDir, string remoteDir) {
+  deque<pair<string, string> > files;
+  struct stat info;
+  if (stat(localDir.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+    files.push_back(make_pair(localDir, ds3Path(remoteDir)));
+  } else {
+    findFiles(localDir, ds3Path(remoteDir), &files);
+  }
+
+  deque<Job> jobs;
+  for (size_t idx = 0; idx < files.size(); idx++) {
+    Job job;
+    job.local = files[idx].first;
+    job.remote = files[idx].second;
+    jobs.push_back(job);
+  }
+  return this->run(true, jobs);
+}
+
+BulkTransferStats BulkTransfer::download(string remoteDir, string localDir) {
+  Job job;
+  job.remote = ds3Path(remoteDir);
+  job.local = localDir;
+  deque<Job> jobs;
+  jobs.push_back(job);
+  return this->run(false, jobs);
+}
+
+vector<string> BulkTransfer::failed() {
+  dthread_mutex_lock(&m_lock);
+  vector<string> failed = m_failed;
+  dthread_mutex_unlock(&m_lock);
+  return failed;
+}
+
+// Runs jobs, and any they add, on m_connections threads at once.
+BulkTransferStats BulkTransfer::run(bool upload, deque<Job> jobs) {
+  dthread_mutex_lock(&m_lock);
+  m_upload = upload;
+  m_jobs = jobs;
+  m_active = 0;
+  m_done = false;
+  m_failed.clear();
+  dthread_mutex_unlock(&m_lock);
+  m_startUsec = nowUsec();
+  m_files = 0;
+  m_bytes = 0;
+  m_retried = 0;
+  m_failures = 0;
+
+  vector<pthread_t> workers(m_connections);
+  for (int idx = 0; idx < m_connections; idx++) {
+    dthread_create(&workers[idx], NULL, workLoop, this);
+  }
+  pthread_t progress;
+  if (m_progress != NULL) {
+    dthread_create(&progress, NULL, progressLoop, this);
+  }
+
+  for (int idx = 0; idx < m_connections; idx++) {
+    pthread_join(workers[idx], NULL);
+  }
+  dthread_mutex_lock(&m_lock);
+  m_done = true;
+  dthread_cond_broadcast(&m_changed);
+  dthread_mutex_unlock(&m_lock);
+  if (m_progress != NULL) {
+    pthread_join(progress, NULL);
+  }
+  return this->stats();
+}
+
+void *BulkTransfer::workLoop(void *arg) {
+  BulkTransfer *transfer = (BulkTransfer *) arg;
+  Job job;
+  while (transfer->nextJob(&job)) {
+    transfer->transfer(job);
+    transfer->finishJob();
+  }
+  return NULL;
+}
+
+void *BulkTransfer::progressLoop(void *arg) {
+  BulkTransfer *transfer = (BulkTransfer *) arg;
+  dthread_mutex_lock(&transfer->m_lock);
+  while (!transfer->m_done) {
+    // m_changed also wakes us whenever a job finishes
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec++;
+    while (!transfer->m_done &&
+           pthread_cond_timedwait(&transfer->m_changed, &transfer->m_lock, &deadline) != ETIMEDOUT) {
+    }
+    if (transfer->m_done) {
+      break;
+    }
+
+    BulkTransferStats stats = transfer->stats();
+    *transfer->m_progress << stats.files << " files, " << fixed << setprecision(1)
+                          << stats.bytes / 1e6 << " MB, " << stats.bytes / 1e6 / max(stats.seconds, 1e-3)
+                          << " MB/s, " << stats.retries << " retries, " << stats.failures << " failed" << endl;
+  }
+  dthread_mutex_unlock(&transfer->m_lock);
+  return NULL;
+}
+
+// Waits for a job, returning false once there are none left and none
+// being worked on that could add more.
+bool BulkTransfer::nextJob(Job *job) {
+  dthread_mutex_lock(&m_lock);
+  while (m_jobs.empty() && m_active > 0) {
+    dthread_cond_wait(&m_changed, &m_lock);
+  }
+  bool found = !m_jobs.empty();
+  if (found) {
+    *job = m_jobs.front();
+    m_jobs.pop_front();
+    m_active++;
+  }
+  dthread_mutex_unlock(&m_lock);
+  return found;
+}
+
+void BulkTransfer::finishJob() {
+  dthread_mutex_lock(&m_lock);
+  m_active--;
+  dthread_cond_broadcast(&m_changed);
+  dthread_mutex_unlock(&m_lock);
+}
+
+void BulkTransfer::addJob(const Job &job) {
+  dthread_mutex_lock(&m_lock);
+  m_jobs.push_back(job);
+  dthread_cond_broadcast(&m_changed);
+  dthread_mutex_unlock(&m_lock);
+}
+
+void BulkTransfer::transfer(const Job &job) {
+  bool succeeded = m_upload ? this->uploadFile(job) : this->downloadPath(job);
+  if (!succeeded) {
+    m_failures++;
+    dthread_mutex_lock(&m_lock);
+    m_failed.push_back(job.remote);
+    dthread_mutex_unlock(&m_lock);
+  }
+}
+
+bool BulkTransfer::uploadFile(const Job &job) {
+  ifstream file(job.local.c_str(), ios::binary);
+  if (!file) {
+    return false;
+  }
+  stringstream contents;
+  contents << file.rdbuf();
+  string body = contents.str();
+
+  HTTPClientResponse *response = this->send("PUT", job.remote, body);
+  bool success = response != NULL && response->success();
+  delete response;
+  if (success) {
+    m_files++;
+    m_bytes += body.size();
+  }
+  return success;
+}
+
+// Saves a file, or makes a directory and adds a job for each entry.
+bool BulkTransfer::downloadPath(const Job &job) {
+  HTTPClientResponse *response = this->send("GET", job.remote, "");
+  if (response == NULL || !response->success()) {
+    delete response;
+    return false;
+  }
+
+  if (response->header("X-Ds3-Type") == "directory") {
+    vector<string> entries = HttpUtils::split(response->body(), '\n');
+    delete response;
+    if (!makeDirs(job.local)) {
+      return false;
+    }
+    // entries are joined onto the local path, so one that isn't a plain
+    // name could write outside it; the listing fails if it has any
+    bool valid = true;
+    for (size_t idx = 0; idx < entries.size(); idx++) {
+      string name = entries[idx];
+      if (name.size() > 0 && name.back() == '/') {
+        name.pop_back();
+      }
+      if (name.empty() || name == "." || name == ".." || name.find('/') != string::npos) {
+        valid = false;
+        continue;
+      }
+      Job child;
+      child.remote = joinPath(job.remote, name);
+      child.local = joinPath(job.local, name);
+      this->addJob(child);
+    }
+    return valid;
+  }
+
+  string body = response->body();
+  delete response;
+  ofstream file(job.local.c_str(), ios::binary | ios::trunc);
+  if (!file.write(body.data(), body.size())) {
+    return false;
+  }
+  m_files++;
+  m_bytes += body.size();
+  return true;
+}
+
+/**
+ * Sends one request on a pooled connection, trying again as the class
+ * comment says. Returns the last response, or NULL if no try got one.
+ * An idle connection the server closed doesn't count as a try, since
+ * the request never got to it.
+ */
+HTTPClientResponse *BulkTransfer::send(string method, string path, const string &body) {
+  int tries = 0;
+  while (true) {
+    bool reused = false;
+    MySocket *connection = NULL;
+    HTTPClientResponse *response = NULL;
+    try {
+      connection = m_pool.acquire(m_host, m_port, &reused);
+      HttpClient client(connection, m_host + ":" + to_string(m_port));
+      client.write_request(path, method, body);
+      response = client.read_response();
+    } catch (...) {
+      // response is still NULL
+    }
+
+    if (response != NULL && response->status() != 0) {
+      if (response->keepAlive()) {
+        m_pool.release(m_host, m_port, connection);
+      } else {
+        delete connection;
+      }
+      if (!retryable(response->status()) || tries >= m_retries) {
+        return response;
+      }
+    } else {
+      delete connection;
+      if (reused) {
+        delete response;
+        continue;
+      }
+      if (tries >= m_retries) {
+        delete response;
+        return NULL;
+      }
+    }
+    delete response;
+
+    m_retried++;
+    usleep(min((uint64_t) FIRST_BACKOFF_USEC << min(tries, 16), (uint64_t) MAX_BACKOFF_USEC));
+    tries++;
+  }
+}
+
+BulkTransferStats BulkTransfer::stats() {
+  BulkTransferStats stats;
+  stats.files = m_files;
+  stats.bytes = m_bytes;
+  stats.retries = m_retried;
+  stats.failures = m_failures;
+  stats.seconds = (nowUsec() - m_startUsec) / 1e6;
+  return stats;
+}
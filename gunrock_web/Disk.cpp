@@ -10,6 +10,7 @@
 #include <sys/mman.h>
 
 #include "Disk.h"
+#include "Metrics.h"
 #include "dthread.h"
 
 using namespace std;
@@ -73,6 +74,7 @@ void Disk::readBlock(int blockNumber, void *buffer) {
     cerr << "Could not read file" << endl;
     exit(1);
   }
+  Metrics::count(DISK_BLOCKS_READ);
 
   close(fd);
 }
@@ -112,17 +114,25 @@ void Disk::writeBlock(int blockNumber, void *buffer) {
   }
   fsync(fd);
   close(fd);
+  Metrics::count(DISK_BLOCKS_WRITTEN);
+  Metrics::count(DISK_SYNCS);
 }
 
 void Disk::beginTransaction() {
-  if (isInTransaction) {
-    cerr << "You can't start a new transaction: one already exists" << endl;
-    exit(1);
-  }
+  savepoints.push_back(undoLog.size());
   isInTransaction = true;
 }
 
 void Disk::commit() {
+  if (savepoints.empty()) {
+    return;
+  }
+  savepoints.pop_back();
+  if (!savepoints.empty()) {
+    // the outer transaction can still roll these writes back
+    return;
+  }
+
   isInTransaction = false;
   deque<struct UndoRecord>::iterator iter;
   for (iter = undoLog.begin(); iter != undoLog.end(); iter++) {
@@ -132,11 +142,20 @@ void Disk::commit() {
 }
 
 void Disk::rollback() {
+  if (savepoints.empty()) {
+    return;
+  }
+  size_t savepoint = savepoints.back();
+  savepoints.pop_back();
+
+  // undo records are pushed on the front so the newest ones come first,
+  // and we don't want the writes that undo them logged again
   isInTransaction = false;
-  deque<struct UndoRecord>::iterator iter;
-  for (iter = undoLog.begin(); iter != undoLog.end(); iter++) {
-    this->writeBlock(iter->blockNumber, iter->blockData);
-    delete [] iter->blockData;
+  while (undoLog.size() > savepoint) {
+    struct UndoRecord undoRecord = undoLog.front();
+    undoLog.pop_front();
+    this->writeBlock(undoRecord.blockNumber, undoRecord.blockData);
+    delete [] undoRecord.blockData;
   }
-  undoLog.clear();
+  isInTransaction = !savepoints.empty();
 }
@@ -2,78 +2,499 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <time.h>
 #include <sstream>
 #include <iostream>
 #include <map>
 #include <string>
 #include <algorithm>
 #include <cstring>
+#include <vector>
 
 #include "DistributedFileSystemService.h"
 #include "ClientError.h"
+#include "HashRing.h"
 #include "ufs.h"
 #include "WwwFormEncodedDict.h"
+#include "HttpUtils.h"
+#include "Metrics.h"
+#include "dthread.h"
 
 using namespace std;
 
+// the most ranges we serve from one Range header before sending it all
+#define MAX_RANGES (16)
+#define RANGE_BOUNDARY "ds3_byteranges_3d6b6a4c"
+// bodies smaller than this aren't worth compressing
+#define MIN_COMPRESS_SIZE (256)
+// the most operations and bytes of them we take in one batch
+#define MAX_BATCH_OPERATIONS (1024)
+#define MAX_BATCH_BYTES (16 * 1024 * 1024)
+
+// Holds a file system lock, shared or exclusive, until it goes out of scope.
+class FileSystemLock {
+ public:
+  FileSystemLock(pthread_rwlock_t *lock, bool exclusive) {
+    this->lock = lock;
+    if (exclusive) {
+      dthread_rwlock_wrlock(lock);
+    } else {
+      dthread_rwlock_rdlock(lock);
+    }
+  }
+
+  ~FileSystemLock() {
+    dthread_rwlock_unlock(lock);
+  }
+
+ private:
+  pthread_rwlock_t *lock;
+};
+
+// Streams length bytes of a regular file starting at offset to the
+// client, reading one disk block at a time so the whole file never has
+// to be in memory and only the blocks covering the range are read. It
+// only holds the file system lock while it reads a block, never while
+// the client takes its time with one, so a slow reader can't hold up
+// writes. If the file changed since the stream was made its blocks may
+// belong to something else now, so we give up and drop the connection
+// instead of sending a mix of the two.
+class FileBodyStream : public BodyStream {
+ public:
+  FileBodyStream(LocalFileSystem *fileSystem, pthread_rwlock_t *lock, const string *etagEpoch, int inum,
+                 inode_t inode, int offset, int length) {
+    this->fileSystem = fileSystem;
+    this->lock = lock;
+    this->etagEpoch = etagEpoch;
+    this->epoch = *etagEpoch;
+    this->inum = inum;
+    this->generation = fileSystem->generation(inum);
+    this->inode = inode;
+    this->offset = offset;
+    this->end = offset + length;
+    this->cachedBlock = -1;
+  }
+
+  virtual int size() {
+    return end - offset;
+  }
+
+  virtual int read(void *buffer, int len) {
+    if (offset >= end) {
+      return 0;
+    }
+    int blockIndex = offset / UFS_BLOCK_SIZE;
+    if (blockIndex != cachedBlock) {
+      FileSystemLock readLock(lock, false);
+      if (fileSystem->generation(inum) != generation || *etagEpoch != epoch) {
+        throw ClientError::conflict();
+      }
+      fileSystem->disk->readBlock(inode.direct[blockIndex], block);
+      cachedBlock = blockIndex;
+    }
+    int blockOffset = offset % UFS_BLOCK_SIZE;
+    int copySize = min(len, min(UFS_BLOCK_SIZE - blockOffset, end - offset));
+    memcpy(buffer, block + blockOffset, copySize);
+    offset += copySize;
+    return copySize;
+  }
+
+ private:
+  LocalFileSystem *fileSystem;
+  pthread_rwlock_t *lock;
+  // applying a backup's missing blocks changes files without moving
+  // their generations, but it always starts a new ETag epoch
+  const string *etagEpoch;
+  string epoch;
+  int inum;
+  unsigned int generation;
+  inode_t inode;
+  int offset;
+  int end;
+  int cachedBlock;
+  unsigned char block[UFS_BLOCK_SIZE];
+};
+
+static string contentRange(int first, int last, int size) {
+  stringstream ss;
+  ss << "bytes " << first << "-" << last << "/" << size;
+  return ss.str();
+}
+
 DistributedFileSystemService::DistributedFileSystemService(string diskFile) : HttpService("/ds3/") {
   this->fileSystem = new LocalFileSystem(new Disk(diskFile, UFS_BLOCK_SIZE));
+  this->versions = new ObjectVersions(diskFile + ".versions");
+
+  // nobody takes the read lock while already holding it, so writers can
+  // go first and a steady stream of GETs can't starve them
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&this->fileSystemLock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+
+  // inode generations start over when we restart, so tag our ETags with
+  // this run to keep them from matching ones handed out by an earlier run
+  stringstream ss;
+  ss << hex << (unsigned int) (time(NULL) ^ (getpid() << 16));
+  this->etagEpoch = ss.str();
+  this->replicator = NULL;
+  this->readOnly = false;
 }
 
-void DistributedFileSystemService::get(HTTPRequest *request, HTTPResponse *response) {
-	char buffer[MAX_FILE_SIZE];
-  string path = request->getPath().substr(this->pathPrefix().length());
-	int inum = 0;
-	while (path.size()) {
-		std::string path2;
-		size_t t = path.find('/');
-		if (std::string::npos != t) {
-			path2 = path.substr((t + 1));
-			path.erase(t);
-		}
-		inum = fileSystem->lookup(inum, path);
-		if (inum < 0){
-      break;
-    }
-		path = path2;
-	}
+// Resolves the request path and stats it, setting the headers that
+// describe the object. Returns its inode number, or -1 if the request
+// was conditional and the object hasn't changed.
+int DistributedFileSystemService::statPath(HTTPRequest *request, HTTPResponse *response, inode_t *inode) {
+  string path(request->getPath().substr(this->pathPrefix().length()));
+  int inum = lookupPath(path);
 
+  // a quorum gateway compares versions, including those of deletes, to
+  // find the newest replica
+  bool deleted;
+  ObjectVersion version = versions->get(path, &deleted);
+  if (!version.empty() && deleted == (inum < 0)) {
+    response->setHeader("X-Ds3-Version", version.str());
+  }
   if (inum < 0){
     throw ClientError::notFound();
   }
 
-  inode_t inode;
-  if (fileSystem->stat(inum, &inode)!=0){
+  if (fileSystem->stat(inum, inode)!=0){
     throw ClientError::notFound();
   }
+
+  string etag = makeETag(inum);
+  response->setHeader("ETag", etag);
+  response->setHeader("X-Ds3-Type", inode->type == UFS_DIRECTORY ? "directory" : "file");
+  if (!checkPreconditions(request, etag, true)) {
+    response->setStatus(304);
+    return -1;
+  }
+  return inum;
+}
+
+// HEAD only looks at the inode, so it never reads a file's data blocks.
+void DistributedFileSystemService::head(HTTPRequest *request, HTTPResponse *response) {
+  FileSystemLock readLock(&fileSystemLock, false);
+  inode_t inode;
+  if (statPath(request, response, &inode) < 0) {
+    return;
+  }
+
   if (inode.type == UFS_DIRECTORY) {
-      std::stringstream ss;
-      int br = fileSystem->read(inum, buffer, sizeof(buffer));
-      for (int offset = 0; offset < br; offset += sizeof(dir_ent_t)) {
-        const dir_ent_t* entry = (const dir_ent_t*)(buffer + offset);
-        if ((entry->inum != -1) && strcmp(entry->name, ".") && strcmp(entry->name, "..")) {
-          if (fileSystem->stat(entry->inum, &inode)){
-            continue;
-          }
-          else if (UFS_DIRECTORY == inode.type){
-            ss << entry->name << "/" << endl;
-          }
-          else{
-            ss << entry->name << endl;
-          }
-        }
-      }
-      response->setBody(ss.str());
+    // the size of a listing depends on the entries, which we'd have to read
+    response->withoutBody(-1);
+  } else {
+    response->setHeader("Accept-Ranges", "bytes");
+    response->withoutBody(inode.size);
+  }
+}
+
+void DistributedFileSystemService::get(HTTPRequest *request, HTTPResponse *response) {
+  FileSystemLock readLock(&fileSystemLock, false);
+  inode_t inode;
+  int inum = statPath(request, response, &inode);
+  if (inum < 0) {
+    return;
+  }
+
+  if (inode.type == UFS_DIRECTORY) {
+      response->setBody(listDirectory(inum, inode));
   } else {
-      int br = fileSystem->read(inum, buffer, inode.size);
-      response->setBody(string(buffer, br));
+      sendFile(request, response, inum, inode);
   }
+  compressBody(request, response);
+}
+
+// A directory's entries, one per line, with a '/' after subdirectories.
+string DistributedFileSystemService::listDirectory(int inum, const inode_t &inode) {
+  std::stringstream ss;
+  char *buffer = new char[inode.size];
+  int br = fileSystem->read(inum, buffer, inode.size);
+  inode_t entryInode;
+  for (int offset = 0; offset < br; offset += sizeof(dir_ent_t)) {
+    const dir_ent_t* entry = (const dir_ent_t*)(buffer + offset);
+    if ((entry->inum != -1) && strcmp(entry->name, ".") && strcmp(entry->name, "..")) {
+      if (fileSystem->stat(entry->inum, &entryInode)){
+        continue;
+      }
+      else if (UFS_DIRECTORY == entryInode.type){
+        ss << entry->name << "/" << endl;
+      }
+      else{
+        ss << entry->name << endl;
+      }
+    }
+  }
+  delete [] buffer;
+  return ss.str();
+}
+
+// Compresses whole bodies for clients that accept it. Partial content is
+// sent as is since its ranges refer to the uncompressed bytes.
+void DistributedFileSystemService::compressBody(HTTPRequest *request, HTTPResponse *response) {
+  if (response->getStatus() != 200 || response->bodySize() < MIN_COMPRESS_SIZE) {
+    return;
+  }
+  response->setHeader("Vary", "Accept-Encoding");
+
+  string_view acceptEncoding;
+  if (!request->findHeader("Accept-Encoding", &acceptEncoding)) {
+    return;
+  }
+  string encoding = HttpUtils::negotiateEncoding(string(acceptEncoding));
+  if (encoding.size() > 0) {
+    response->encodeBody(encoding);
+  }
+}
+
+// A stream of length bytes of the file inum starting at offset. Call it
+// with the file system locked so inode is still what's on disk.
+BodyStream *DistributedFileSystemService::streamFile(int inum, const inode_t &inode, int offset, int length) {
+  return new FileBodyStream(fileSystem, &fileSystemLock, &etagEpoch, inum, inode, offset, length);
+}
+
+// Sends a regular file, or just the parts of it asked for in a Range
+// header as a 206 Partial Content response.
+void DistributedFileSystemService::sendFile(HTTPRequest *request, HTTPResponse *response, int inum, inode_t inode) {
+  response->setHeader("Accept-Ranges", "bytes");
+
+  string_view rangeHeader;
+  request->findHeader("Range", &rangeHeader);
+
+  vector<pair<int, int> > ranges;
+  if (rangeHeader.size() == 0 ||
+      !HttpUtils::parseRange(string(rangeHeader), inode.size, ranges) ||
+      ranges.size() > MAX_RANGES) {
+    response->setBodyStream(streamFile(inum, inode, 0, inode.size));
+    return;
+  }
+
+  if (ranges.size() == 0) {
+    stringstream ss;
+    ss << "bytes */" << inode.size;
+    response->setHeader("Content-Range", ss.str());
+    throw ClientError::rangeNotSatisfiable();
+  }
+
+  response->setStatus(206);
+  if (ranges.size() == 1) {
+    int first = ranges[0].first;
+    int last = ranges[0].second;
+    response->setHeader("Content-Range", contentRange(first, last, inode.size));
+    response->setBodyStream(streamFile(inum, inode, first, last - first + 1));
+    return;
+  }
+
+  MultiBodyStream *body = new MultiBodyStream();
+  for (unsigned int idx = 0; idx < ranges.size(); idx++) {
+    int first = ranges[idx].first;
+    int last = ranges[idx].second;
+    body->add(new StringBodyStream("\r\n--" RANGE_BOUNDARY "\r\nContent-Range: " +
+                                   contentRange(first, last, inode.size) + "\r\n\r\n"));
+    body->add(streamFile(inum, inode, first, last - first + 1));
+  }
+  body->add(new StringBodyStream("\r\n--" RANGE_BOUNDARY "--\r\n"));
+  response->setContentType("multipart/byteranges; boundary=" RANGE_BOUNDARY);
+  response->setBodyStream(body);
 }
 
 void DistributedFileSystemService::put(HTTPRequest *request, HTTPResponse *response) {
+  if (readOnly) {
+    // backups only take writes from their primary
+    throw ClientError::forbidden();
+  }
+  string path(request->getPath().substr(this->pathPrefix().length()));
+
+  // don't bother reading a body that can never fit in a file
+  if (request->getContentLength() > MAX_FILE_SIZE) {
+    throw ClientError::insufficientStorage();
+  }
+  // the backups get the body with the record of the write
+  string body;
+  int staged = stageBody(request, replicator != NULL ? &body : NULL);
+
+  ObjectVersion version;
+  bool versioned = requestVersion(request, &version);
+  uint64_t seq = 0;
+  string etag;
+  {
+    FileSystemLock writeLock(&fileSystemLock, true);
+    int inum;
+    try {
+      if (versioned && !supersedes(path, version, response)) {
+        fileSystem->release(staged);
+        return;
+      }
+      int existing = lookupPath(path);
+      checkPreconditions(request, existing < 0 ? "" : makeETag(existing), false);
+
+      // make the file and move the body into it in one transaction so
+      // that a failure doesn't leave new directories behind
+      fileSystem->disk->beginTransaction();
+      try {
+        inum = createFile(path, NULL);
+        if (fileSystem->replace(inum, staged) < 0) {
+          throw ClientError::badRequest();
+        }
+      } catch (...) {
+        fileSystem->disk->rollback();
+        throw;
+      }
+      fileSystem->disk->commit();
+    } catch (...) {
+      fileSystem->release(staged);
+      throw;
+    }
+
+    if (versioned) {
+      versions->set(path, version, false);
+      response->setHeader("X-Ds3-Version", version.str());
+    }
+    if (replicator != NULL) {
+      seq = replicator->append(ReplicationRecord::PUT, path, body);
+    }
+    etag = makeETag(inum);
+  }
+  if (replicator != NULL) {
+    replicator->waitForBackups(seq);
+  }
+
+	response->setStatus(200);
+  response->setHeader("ETag", etag);
+	response->setBody("File created or updated successfully.");
+}
+
+// Reads the whole contents of a regular file.
+string DistributedFileSystemService::readContents(int inum) {
+  inode_t inode;
+  if (fileSystem->stat(inum, &inode) != 0 || inode.size == 0) {
+    return "";
+  }
+  string contents(inode.size, '\0');
+  int bytesRead = fileSystem->read(inum, &contents[0], inode.size);
+  contents.resize(max(bytesRead, 0));
+  return contents;
+}
+
+/**
+ * Applies a write our primary committed. Records can arrive more than
+ * once if an acknowledgement was lost, so putting the same contents
+ * again or deleting something that's already gone both succeed.
+ */
+void DistributedFileSystemService::apply(const ReplicationRecord &record) {
+  FileSystemLock writeLock(&fileSystemLock, true);
+  fileSystem->disk->beginTransaction();
+  try {
+    if (record.op == ReplicationRecord::PUT) {
+      writeContents(createFile(record.path, NULL), record.data);
+    } else {
+      removePath(record.path, NULL);
+    }
+  } catch (ClientError &ce) {
+    fileSystem->disk->rollback();
+    if (record.op == ReplicationRecord::DELETE && ce.status_code == 404) {
+      return;
+    }
+    throw;
+  }
+  fileSystem->disk->commit();
+}
+
+string DistributedFileSystemService::checksums() {
+  FileSystemLock readLock(&fileSystemLock, false);
+  Disk *disk = fileSystem->disk;
+  string block(UFS_BLOCK_SIZE, '\0');
+  stringstream ss;
+  ss << hex;
+  for (int blockNumber = 0; blockNumber < disk->numberOfBlocks(); blockNumber++) {
+    disk->readBlock(blockNumber, &block[0]);
+    ss << HashRing::hash(block) << "\n";
+  }
+  return ss.str();
+}
+
+// The read lock keeps writes out while we read, so the blocks are all
+// from the same moment and that moment is right after write seq.
+bool DistributedFileSystemService::diffBlocks(const string &checksums, string *blocks, uint64_t *seq, int *count) {
+  FileSystemLock readLock(&fileSystemLock, false);
+  Disk *disk = fileSystem->disk;
+  vector<string> theirs = HttpUtils::split(checksums, '\n');
+  if ((int) theirs.size() != disk->numberOfBlocks()) {
+    return false;
+  }
+
+  *seq = replicator != NULL ? replicator->lastSeq() : 0;
+  *count = 0;
+  string block(UFS_BLOCK_SIZE, '\0');
+  for (int blockNumber = 0; blockNumber < disk->numberOfBlocks(); blockNumber++) {
+    disk->readBlock(blockNumber, &block[0]);
+    if (strtoull(theirs[blockNumber].c_str(), NULL, 16) == HashRing::hash(block)) {
+      continue;
+    }
+    ReplicationRecord record;
+    record.seq = *seq;
+    record.op = ReplicationRecord::BLOCK;
+    record.path = to_string(blockNumber);
+    record.data = block;
+    record.encode(blocks);
+    (*count)++;
+  }
+  return true;
+}
+
+size_t DistributedFileSystemService::maxDiffBytes() {
+  string header;
+  ReplicationRecord record;
+  record.seq = UINT64_MAX;
+  record.op = ReplicationRecord::BLOCK;
+  record.path = to_string(INT_MAX);
+  record.encode(&header);
+  return (size_t) fileSystem->disk->numberOfBlocks() * (header.size() + UFS_BLOCK_SIZE);
+}
+
+void DistributedFileSystemService::applyBlocks(string_view blocks) {
+  FileSystemLock writeLock(&fileSystemLock, true);
+  Disk *disk = fileSystem->disk;
+  disk->beginTransaction();
+  try {
+    ReplicationRecord record;
+    while (blocks.size() > 0) {
+      size_t used = ReplicationRecord::decode(blocks, &record);
+      int blockNumber = atoi(record.path.c_str());
+      if (used == 0 || record.op != ReplicationRecord::BLOCK || record.data.size() != UFS_BLOCK_SIZE ||
+          blockNumber < 0 || blockNumber >= disk->numberOfBlocks()) {
+        throw ClientError::badRequest();
+      }
+      blocks.remove_prefix(used);
+      disk->writeBlock(blockNumber, &record.data[0]);
+    }
+  } catch (...) {
+    disk->rollback();
+    throw;
+  }
+  disk->commit();
+
+  // files changed under inodes whose generations didn't move, so start
+  // over with ETags that can't match any we handed out before
+  stringstream ss;
+  ss << hex << (unsigned int) (time(NULL) ^ (getpid() << 16) ^ rand());
+  this->etagEpoch = ss.str();
+}
+
+void DistributedFileSystemService::setReplicator(Replicator *replicator) {
+  this->replicator = replicator;
+}
+
+void DistributedFileSystemService::setReadOnly(bool readOnly) {
+  this->readOnly = readOnly;
+}
 
-  string path = request->getPath().substr(this->pathPrefix().length());
-  string content = request->getBody();
+// Walks a path relative to the root of the file system and returns the
+// inode number it names, or a negative error if it doesn't exist.
+int DistributedFileSystemService::lookupPath(string path) {
 	int inum = 0;
 	while (path.size()) {
 		std::string path2;
@@ -82,54 +503,272 @@ void DistributedFileSystemService::put(HTTPRequest *request, HTTPResponse *respo
 			path2 = path.substr((t + 1));
 			path.erase(t);
 		}
-		else {
-			break;
-		}
-		int ret = fileSystem->lookup(inum, path);
-		if (-ENOTFOUND == ret) {
-			inum = fileSystem->create(inum, UFS_DIRECTORY, path);
-			if (inum < 0){
-        throw ClientError::badRequest();
-      }
-		}
-		else if (ret < 0) {
-			throw ClientError::badRequest();
-		}
-		else {
-			inum = ret;
-		}
+		inum = fileSystem->lookup(inum, path);
+		if (inum < 0){
+      break;
+    }
 		path = path2;
 	}
+  return inum;
+}
 
-	if (path.empty()){
+// Like lookupPath, but looks up the directories path is in through
+// directories, which remembers them for the next path in them.
+int DistributedFileSystemService::lookupPath(const string &path, DirectoryCache *directories) {
+  string name;
+  int parent = resolveParent(path, false, directories, &name);
+  if (parent < 0 || name.empty()) {
+    return parent;
+  }
+  return fileSystem->lookup(parent, name);
+}
+
+/**
+ * Finds the directory the last component of path is in and sets name to
+ * that component. Missing directories are made on the way if create is
+ * set, and otherwise we return -ENOTFOUND. directories, if it isn't
+ * NULL, remembers every directory we walk through, so the operations of
+ * a batch walk each directory they share only once.
+ */
+int DistributedFileSystemService::resolveParent(const string &path, bool create, DirectoryCache *directories, string *name) {
+  size_t slash = path.rfind('/');
+  if (slash == string::npos) {
+    *name = path;
+    return 0;
+  }
+  *name = path.substr(slash + 1);
+  string directory = path.substr(0, slash);
+  if (directories != NULL) {
+    DirectoryCache::iterator found = directories->find(directory);
+    if (found != directories->end()) {
+      return found->second;
+    }
+  }
+
+  string directoryName;
+  int parent = resolveParent(directory, create, directories, &directoryName);
+  if (parent < 0) {
+    return parent;
+  }
+  if (directoryName.empty()) {
+    throw ClientError::badRequest();
+  }
+  int inum = fileSystem->lookup(parent, directoryName);
+  if (inum == -ENOTFOUND && create) {
+    inum = fileSystem->create(parent, UFS_DIRECTORY, directoryName);
+    if (inum < 0) {
+      throw ClientError::badRequest();
+    }
+  } else if (inum == -ENOTFOUND) {
+    return inum;
+  } else if (inum < 0) {
     throw ClientError::badRequest();
   }
 
-	int parentInodeNumber = inum;
-	inum = fileSystem->lookup(parentInodeNumber, path);
-	if (inum == -ENOTFOUND) {
-		inum = fileSystem->create(parentInodeNumber, UFS_REGULAR_FILE, path);
-		if (inum < 0){
+  if (directories != NULL) {
+    (*directories)[directory] = inum;
+  }
+  return inum;
+}
+
+// ETags name one version of an inode: its modification counter, which
+// changes on every write, scoped to this run of the server.
+string DistributedFileSystemService::makeETag(int inum) {
+  stringstream ss;
+  ss << "\"" << etagEpoch << "-" << inum << "-" << fileSystem->generation(inum) << "\"";
+  return ss.str();
+}
+
+/**
+ * Evaluates If-Match and If-None-Match against the current ETag of the
+ * target, or "" if it doesn't exist. Throws a 412 when a precondition
+ * fails, except that a matching If-None-Match on a read returns false so
+ * the caller can answer 304 Not Modified.
+ */
+bool DistributedFileSystemService::checkPreconditions(HTTPRequest *request, string etag, bool isRead) {
+  string_view header;
+  if (request->findHeader("If-Match", &header) &&
+      !HttpUtils::etagMatches(string(header), etag, false)) {
+    throw ClientError::preconditionFailed();
+  }
+
+  if (!request->findHeader("If-None-Match", &header)) {
+    return true;
+  }
+  if (HttpUtils::etagMatches(string(header), etag, true)) {
+    if (isRead) {
+      return false;
+    }
+    throw ClientError::preconditionFailed();
+  }
+  return true;
+}
+
+// Reads the version a quorum gateway gave a write, returning false if
+// the write didn't come from one.
+bool DistributedFileSystemService::requestVersion(HTTPRequest *request, ObjectVersion *version) {
+  string_view header;
+  if (!request->findHeader("X-Ds3-Version", &header)) {
+    return false;
+  }
+  if (!ObjectVersion::parse(header, version)) {
+    throw ClientError::badRequest();
+  }
+  return true;
+}
+
+/**
+ * Whether a write with version is newer than the last one to path. If
+ * it isn't, it arrived late or is a repeat and the write we have stays,
+ * which the gateway counts as a success all the same.
+ */
+bool DistributedFileSystemService::supersedes(string path, const ObjectVersion &version, HTTPResponse *response) {
+  bool deleted;
+  ObjectVersion current = versions->get(path, &deleted);
+  if (current < version) {
+    return true;
+  }
+  response->setStatus(200);
+  response->setHeader("X-Ds3-Version", current.str());
+  response->setBody("A newer version is already stored.");
+  return false;
+}
+
+// Makes the regular file at path, and any directories it's in that
+// don't exist yet, or finds it if it's already there.
+int DistributedFileSystemService::createFile(string path, DirectoryCache *directories) {
+  string name;
+  int parent = resolveParent(path, true, directories, &name);
+  if (name.empty()) {
+    throw ClientError::badRequest();
+  }
+
+  int inum = fileSystem->lookup(parent, name);
+  if (inum == -ENOTFOUND) {
+    inum = fileSystem->create(parent, UFS_REGULAR_FILE, name);
+    if (inum < 0) {
       throw ClientError::insufficientStorage();
     }
-	}
-	else if (inum < 0) {
-		throw ClientError::badRequest();
-	}
+  } else if (inum < 0) {
+    throw ClientError::badRequest();
+  }
+  return inum;
+}
 
-	if (fileSystem->write(inum, content.c_str(), content.size()) < 0){
+/**
+ * Streams the request body into a new file that isn't in any directory
+ * yet, one block at a time as it arrives, so a PUT never holds more than
+ * a block of it in memory. The lock is only held while a block is
+ * written, never while waiting on the client, so a slow upload only holds
+ * up itself. Returns the file, which the caller links in with replace or
+ * frees with release, and leaves a copy of the body in copy unless it's
+ * NULL.
+ */
+int DistributedFileSystemService::stageBody(HTTPRequest *request, string *copy) {
+  int staged;
+  {
+    FileSystemLock writeLock(&fileSystemLock, true);
+    staged = fileSystem->createUnlinked();
+  }
+  if (staged < 0) {
     throw ClientError::insufficientStorage();
   }
 
-	response->setStatus(200);
-	response->setBody("File created or updated successfully.");
+  char block[UFS_BLOCK_SIZE];
+  int size = 0;
+  bool done = false;
+  try {
+    while (!done) {
+      // fill the whole block first so each one is written once
+      int filled = 0;
+      while (filled < UFS_BLOCK_SIZE) {
+        int bytesRead = request->readBody(block + filled, UFS_BLOCK_SIZE - filled);
+        if (bytesRead == 0) {
+          done = true;
+          break;
+        }
+        filled += bytesRead;
+      }
+      if (filled == 0) {
+        break;
+      }
+      if (filled > MAX_FILE_SIZE - size) {
+        throw ClientError::insufficientStorage();
+      }
+
+      FileSystemLock writeLock(&fileSystemLock, true);
+      if (fileSystem->write(staged, block, filled, size) < 0) {
+        throw ClientError::insufficientStorage();
+      }
+      size += filled;
+      if (copy != NULL) {
+        copy->append(block, filled);
+      }
+    }
+  } catch (...) {
+    FileSystemLock writeLock(&fileSystemLock, true);
+    fileSystem->release(staged);
+    throw;
+  }
+  return staged;
+}
+
+// Replaces the contents of a regular file with data.
+void DistributedFileSystemService::writeContents(int inum, const string &data) {
+  if (data.size() > 0 && fileSystem->write(inum, data.data(), data.size(), 0) < 0) {
+    throw ClientError::insufficientStorage();
+  }
+  if (fileSystem->truncate(inum, data.size()) < 0) {
+    throw ClientError::badRequest();
+  }
 }
 
 void DistributedFileSystemService::del(HTTPRequest *request, HTTPResponse *response) {
-  string path = request->getPath().substr(this->pathPrefix().length());
+  if (readOnly) {
+    throw ClientError::forbidden();
+  }
+  string path(request->getPath().substr(this->pathPrefix().length()));
 	if (path.length() && ('/' == path.back())){
     path.pop_back();
   }
+
+  ObjectVersion version;
+  bool versioned = requestVersion(request, &version);
+  uint64_t seq = 0;
+  {
+    FileSystemLock writeLock(&fileSystemLock, true);
+    if (!versioned) {
+      removePath(path, request);
+    } else {
+      if (!supersedes(path, version, response)) {
+        return;
+      }
+      try {
+        removePath(path, request);
+      } catch (ClientError &ce) {
+        // we may have missed the write, but the delete still wins over it
+        if (ce.status_code != 404) {
+          throw;
+        }
+      }
+      versions->set(path, version, true);
+      response->setHeader("X-Ds3-Version", version.str());
+    }
+    if (replicator != NULL) {
+      seq = replicator->append(ReplicationRecord::DELETE, path, "");
+    }
+  }
+  if (replicator != NULL) {
+    replicator->waitForBackups(seq);
+  }
+
+	response->setStatus(200);
+	response->setBody("Resource deleted successfully.");
+}
+
+// Removes the file or empty directory at path, checking the request's
+// preconditions against it first if there is a request.
+void DistributedFileSystemService::removePath(string path, HTTPRequest *request) {
 	int inum = 0;
 	while (path.size()) {
 		std::string path2;
@@ -157,6 +796,9 @@ void DistributedFileSystemService::del(HTTPRequest *request, HTTPResponse *respo
 	int dinum = fileSystem->lookup(inum, path);
 	if (dinum < 0){
     throw ClientError::notFound();
+  }
+  if (request != NULL) {
+    checkPreconditions(request, makeETag(dinum), false);
   }
 	int ret = fileSystem->unlink(inum, path);
 	if (-EDIRNOTEMPTY == ret){
@@ -168,7 +810,187 @@ void DistributedFileSystemService::del(HTTPRequest *request, HTTPResponse *respo
 	else if (ret < 0){
     throw ClientError::insufficientStorage();
   }
+}
 
-	response->setStatus(200);
-	response->setBody("Resource deleted successfully.");
+size_t BatchOperation::decode(string_view in, BatchOperation *operation) {
+  size_t newline = in.find('\n');
+  if (newline == string_view::npos) {
+    return 0;
+  }
+
+  char op;
+  size_t pathLength, dataLength;
+  string header(in.substr(0, newline));
+  if (sscanf(header.c_str(), "%c %zu %zu", &op, &pathLength, &dataLength) != 3 ||
+      (op != GET && op != PUT && op != DELETE) || in.size() - newline - 1 < pathLength + dataLength) {
+    return 0;
+  }
+
+  operation->op = op;
+  operation->path = in.substr(newline + 1, pathLength);
+  operation->data = in.substr(newline + 1 + pathLength, dataLength);
+  return newline + 1 + pathLength + dataLength;
+}
+
+// The frame of one batch result, up to where its data starts.
+static string resultHeader(int status, const string &path, size_t dataLength) {
+  char header[64];
+  snprintf(header, sizeof(header), "%d %zu %zu\n", status, path.size(), dataLength);
+  return header + path;
+}
+
+static void addResult(MultiBodyStream *results, int status, const string &path, const string &data) {
+  results->add(new StringBodyStream(resultHeader(status, path, data.size()) + data));
+}
+
+/**
+ * Runs a batch of GETs, PUTs and DELETEs, so that clients moving lots of
+ * small objects pay for one request, one trip through the file system
+ * lock and one walk of each directory they share instead of one each.
+ * Results come back in the order the operations were sent.
+ *
+ * A batch with writes in it runs as one transaction: either every write
+ * commits or, if one fails, none of them do and we answer with that
+ * write's error and its index in an X-Ds3-Batch-Failed header. A GET
+ * that fails only fails its own result.
+ */
+void DistributedFileSystemService::post(HTTPRequest *request, HTTPResponse *response) {
+  if (request->getPath() != this->pathPrefix()) {
+    throw ClientError::methodNotAllowed();
+  }
+  // getBody stops at the cap for chunked bodies too
+  string body;
+  if (request->getContentLength() > MAX_BATCH_BYTES || !request->getBody(&body, MAX_BATCH_BYTES)) {
+    throw ClientError::payloadTooLarge();
+  }
+  string_view in(body);
+  vector<BatchOperation> operations;
+  bool writes = false;
+  while (in.size() > 0) {
+    BatchOperation operation;
+    size_t used = BatchOperation::decode(in, &operation);
+    if (used == 0 || operations.size() == MAX_BATCH_OPERATIONS) {
+      throw ClientError::badRequest();
+    }
+    in.remove_prefix(used);
+    if (operation.op != BatchOperation::PUT && operation.path.size() > 0 && operation.path.back() == '/') {
+      operation.path.pop_back();
+    }
+    writes = writes || operation.op != BatchOperation::GET;
+    operations.push_back(operation);
+  }
+  if (writes && readOnly) {
+    throw ClientError::forbidden();
+  }
+  Metrics::count(BATCH_OPERATIONS, operations.size());
+
+  MultiBodyStream *results = new MultiBodyStream();
+  try {
+    if (writes) {
+      runWrites(operations, results, response);
+    } else {
+      runReads(operations, results);
+    }
+  } catch (...) {
+    delete results;
+    throw;
+  }
+  response->setContentType("application/octet-stream");
+  response->setBodyStream(results);
+}
+
+// With nothing to write, files are streamed to the client from disk just
+// like a GET's, each stream taking the read lock again for every block.
+void DistributedFileSystemService::runReads(vector<BatchOperation> &operations, MultiBodyStream *results) {
+  FileSystemLock readLock(&fileSystemLock, false);
+  DirectoryCache directories;
+  for (size_t idx = 0; idx < operations.size(); idx++) {
+    readEntry(operations[idx].path, &directories, results, true);
+  }
+}
+
+/**
+ * Runs a batch with writes in it under the write lock, so its reads have
+ * to be copied out before we let go of it. The writes are shipped to
+ * backups once they've all committed, and in synchronous mode we wait
+ * for the backups just once for all of them.
+ */
+void DistributedFileSystemService::runWrites(vector<BatchOperation> &operations, MultiBodyStream *results,
+                                             HTTPResponse *response) {
+  uint64_t seq = 0;
+  {
+    FileSystemLock writeLock(&fileSystemLock, true);
+    DirectoryCache directories;
+    size_t idx = 0;
+    fileSystem->disk->beginTransaction();
+    try {
+      for (; idx < operations.size(); idx++) {
+        BatchOperation &operation = operations[idx];
+        if (operation.op == BatchOperation::GET) {
+          readEntry(operation.path, &directories, results, false);
+          continue;
+        }
+
+        if (operation.op == BatchOperation::PUT) {
+          if (operation.data.size() > MAX_FILE_SIZE) {
+            throw ClientError::insufficientStorage();
+          }
+          int inum = createFile(operation.path, &directories);
+          writeContents(inum, operation.data);
+          addResult(results, 200, operation.path, makeETag(inum));
+        } else {
+          removePath(operation.path, NULL);
+          // the inode number of a directory we removed can be reused
+          directories.erase(operation.path);
+          addResult(results, 200, operation.path, "");
+        }
+      }
+    } catch (ClientError &ce) {
+      fileSystem->disk->rollback();
+      response->setHeader("X-Ds3-Batch-Failed", to_string(idx));
+      throw;
+    } catch (...) {
+      fileSystem->disk->rollback();
+      throw;
+    }
+    fileSystem->disk->commit();
+
+    if (replicator != NULL) {
+      for (idx = 0; idx < operations.size(); idx++) {
+        if (operations[idx].op == BatchOperation::PUT) {
+          seq = replicator->append(ReplicationRecord::PUT, operations[idx].path, operations[idx].data);
+        } else if (operations[idx].op == BatchOperation::DELETE) {
+          seq = replicator->append(ReplicationRecord::DELETE, operations[idx].path, "");
+        }
+      }
+    }
+  }
+  if (replicator != NULL) {
+    replicator->waitForBackups(seq);
+  }
+}
+
+// Adds the result of reading path: a file's contents, a directory's
+// listing, or the error we got. Files are streamed if stream is set, and
+// read into memory otherwise.
+void DistributedFileSystemService::readEntry(const string &path, DirectoryCache *directories, MultiBodyStream *results,
+                                             bool stream) {
+  try {
+    int inum = lookupPath(path, directories);
+    inode_t inode;
+    if (inum < 0 || fileSystem->stat(inum, &inode) != 0) {
+      throw ClientError::notFound();
+    }
+
+    if (inode.type == UFS_DIRECTORY) {
+      addResult(results, 200, path, listDirectory(inum, inode));
+    } else if (stream) {
+      results->add(new StringBodyStream(resultHeader(200, path, inode.size)));
+      results->add(streamFile(inum, inode, 0, inode.size));
+    } else {
+      addResult(results, 200, path, readContents(inum));
+    }
+  } catch (ClientError &ce) {
+    addResult(results, ce.status_code, path, "");
+  }
 }
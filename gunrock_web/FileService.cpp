@@ -2,16 +2,64 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include <iostream>
+#include <list>
 #include <map>
 #include <string>
+#include <unordered_map>
 
 #include "FileService.h"
 #include "ClientError.h"
+#include "HttpUtils.h"
+#include "Metrics.h"
+#include "dthread.h"
 
 using namespace std;
 
+// how many static files we keep in the cache at once
+#define MAX_CACHED_FILES (128)
+// files up to this size are kept in memory, larger ones are sent from disk
+#define MAX_IN_MEMORY_SIZE (1024 * 1024)
+// the most file contents we keep in memory across the whole cache
+#define MAX_CACHED_BYTES (32 * 1024 * 1024)
+// files smaller than this aren't worth compressing
+#define MIN_COMPRESS_SIZE (256)
+
+// Sends a cached file with sendfile and keeps it open until it's sent.
+class StaticFileBodyStream : public FileDescriptorBodyStream {
+ public:
+  StaticFileBodyStream(shared_ptr<StaticFile> file) :
+    FileDescriptorBodyStream(file->fd, 0, file->size), file(file) {}
+
+ private:
+  shared_ptr<StaticFile> file;
+};
+
+StaticFile::StaticFile() {
+  fd = -1;
+  compressible = false;
+  cached = false;
+}
+
+StaticFile::~StaticFile() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+// How much of the cache's memory budget this file's contents take up.
+size_t StaticFile::memoryUsed() {
+  size_t used = contents ? contents->size() : 0;
+  map<string, StaticVariant>::iterator iter;
+  for (iter = variants.begin(); iter != variants.end(); iter++) {
+    used += iter->second.contents ? iter->second.contents->size() : 0;
+  }
+  return used;
+}
+
 FileService::FileService(std::string basedir) : HttpService("/") {
   while (endswith(basedir, "/")) {
     basedir = basedir.substr(0, basedir.length() - 1);
@@ -22,6 +70,8 @@ FileService::FileService(std::string basedir) : HttpService("/") {
     exit(1);
   }
   this->m_basedir = basedir;
+  this->m_cachedBytes = 0;
+  pthread_mutex_init(&this->m_lock, NULL);
 }
 
 bool FileService::endswith(string str, string suffix) {
@@ -30,40 +80,213 @@ bool FileService::endswith(string str, string suffix) {
 }
 
 void FileService::get(HTTPRequest *request, HTTPResponse *response) {
-  string path = this->m_basedir + request->getPath();
-  string fileContents = this->readFile(path);
-  if (fileContents.size() == 0) {
+  if (request->getPath().find("..") != string::npos) {
+    throw ClientError::notFound();
+  }
+
+  string path = this->m_basedir + string(request->getPath());
+  shared_ptr<StaticFile> file = this->lookupFile(path);
+  if (!file) {
     throw ClientError::notFound();
+  }
+
+  if (file->contentType.size() > 0) {
+    response->setContentType(file->contentType);
+  }
+  response->setPreparedHeaders(file->headers);
+
+  string_view header;
+  if (request->findHeader("If-None-Match", &header) &&
+      HttpUtils::etagMatches(string(header), file->etag, true)) {
+    response->setStatus(304);
+    return;
+  }
+
+  string encoding;
+  if (file->compressible && request->findHeader("Accept-Encoding", &header)) {
+    encoding = HttpUtils::negotiateEncoding(string(header));
+  }
+  StaticVariant variant;
+  if (encoding.size() > 0) {
+    variant = this->compressedVariant(file, encoding);
+  }
+  if (variant.contents) {
+    response->setPreparedHeaders(variant.headers);
+    response->setSharedBody(variant.contents);
+  } else if (file->contents) {
+    response->setSharedBody(file->contents);
   } else {
-    if (this->endswith(path, ".css")) {
-      response->setContentType("text/css");
-    } else if (this->endswith(path, ".js")) {
-      response->setContentType("text/javascript");
+    response->setBodyStream(new StaticFileBodyStream(file));
+  }
+}
+
+/**
+ * Returns the cached copy of path, reloading it if the file has changed
+ * since we cached it. Returns an empty pointer if path isn't a regular
+ * file we can read.
+ */
+shared_ptr<StaticFile> FileService::lookupFile(string path) {
+  struct stat st;
+  bool exists = stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+
+  dthread_mutex_lock(&m_lock);
+  shared_ptr<StaticFile> file = this->lookupCachedFile(path, exists, st);
+  dthread_mutex_unlock(&m_lock);
+  return file;
+}
+
+// The part of lookupFile that runs with the cache locked.
+shared_ptr<StaticFile> FileService::lookupCachedFile(string path, bool exists, const struct stat &st) {
+  unordered_map<string, CachedFile>::iterator iter = m_files.find(path);
+  if (iter != m_files.end()) {
+    shared_ptr<StaticFile> file = iter->second.file;
+    if (exists && file->inode == st.st_ino && file->mtime == st.st_mtime && file->size == st.st_size) {
+      m_lru.splice(m_lru.begin(), m_lru, iter->second.lru);
+      Metrics::count(STATIC_CACHE_HITS);
+      return file;
     }
-    response->setBody(fileContents);
+    this->eraseFile(iter);
+  }
+  if (!exists) {
+    return shared_ptr<StaticFile>();
+  }
+
+  Metrics::count(STATIC_CACHE_MISSES);
+  shared_ptr<StaticFile> file = this->loadFile(path, st);
+  if (!file) {
+    return file;
   }
+
+  m_lru.push_front(path);
+  CachedFile &entry = m_files[path];
+  entry.file = file;
+  entry.lru = m_lru.begin();
+  file->cached = true;
+  m_cachedBytes += file->memoryUsed();
+  this->evictFiles();
+  return file;
+}
+
+// Takes a file out of the cache with m_lock held. Files still being sent
+// stay alive until their responses are done.
+void FileService::eraseFile(unordered_map<string, CachedFile>::iterator iter) {
+  shared_ptr<StaticFile> file = iter->second.file;
+  m_cachedBytes -= file->memoryUsed();
+  file->cached = false;
+  m_lru.erase(iter->second.lru);
+  m_files.erase(iter);
 }
 
-string FileService::readFile(string path) {
+// Drops the least recently used files until the cache is within its
+// limits again, with m_lock held.
+void FileService::evictFiles() {
+  while (!m_lru.empty() && (m_lru.size() > MAX_CACHED_FILES || m_cachedBytes > MAX_CACHED_BYTES)) {
+    this->eraseFile(m_files.find(m_lru.back()));
+  }
+}
+
+/**
+ * Opens path and works out the headers we'll serve it with, reading the
+ * contents into memory if it's small enough.
+ */
+shared_ptr<StaticFile> FileService::loadFile(string path, const struct stat &st) {
   int fd = open(path.c_str(), O_RDONLY);
   if (fd < 0) {
-    return "";
+    return shared_ptr<StaticFile>();
+  }
+
+  shared_ptr<StaticFile> file(new StaticFile());
+  file->fd = fd;
+  file->size = st.st_size;
+  file->inode = st.st_ino;
+  file->mtime = st.st_mtime;
+  if (this->endswith(path, ".css")) {
+    file->contentType = "text/css";
+  } else if (this->endswith(path, ".js")) {
+    file->contentType = "text/javascript";
+  }
+
+  if (st.st_size <= MAX_IN_MEMORY_SIZE) {
+    string *contents = new string(st.st_size, '\0');
+    file->contents.reset(contents);
+    off_t offset = 0;
+    while (offset < st.st_size) {
+      ssize_t ret = pread(fd, &(*contents)[offset], st.st_size - offset, offset);
+      if (ret <= 0) {
+        // the file changed under us, so don't cache it
+        return shared_ptr<StaticFile>();
+      }
+      offset += ret;
+    }
+    close(fd);
+    file->fd = -1;
   }
 
-  string result;
-  int ret;
-  char buffer[4096];
-  while ((ret = read(fd, buffer, sizeof(buffer))) > 0) {
-    result.append(buffer, ret);
+  char etag[64];
+  snprintf(etag, sizeof(etag), "\"%lx-%lx-%lx\"", (unsigned long) st.st_ino,
+           (unsigned long) st.st_size, (unsigned long) st.st_mtime);
+  file->etag = etag;
+
+  char modified[64];
+  struct tm tm;
+  strftime(modified, sizeof(modified), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&st.st_mtime, &tm));
+
+  // we only compress text we hold in memory, large files keep sendfile
+  file->compressible = file->contents && st.st_size >= MIN_COMPRESS_SIZE &&
+    (file->contentType.size() == 0 || file->contentType.compare(0, 5, "text/") == 0);
+
+  string *headers = new string();
+  headers->append("ETag: ").append(file->etag).append("\r\n");
+  headers->append("Last-Modified: ").append(modified).append("\r\n");
+  if (file->compressible) {
+    headers->append("Vary: Accept-Encoding\r\n");
+  }
+  file->headers.reset(headers);
+  return file;
+}
+
+/**
+ * Returns file compressed with encoding, compressing it the first time
+ * a client asks for that encoding so later requests reuse the result.
+ */
+StaticVariant FileService::compressedVariant(shared_ptr<StaticFile> file, string encoding) {
+  dthread_mutex_lock(&m_lock);
+  StaticVariant variant = this->makeVariant(file, encoding);
+  dthread_mutex_unlock(&m_lock);
+  return variant;
+}
+
+// The part of compressedVariant that runs with the cache locked.
+const StaticVariant &FileService::makeVariant(shared_ptr<StaticFile> file, string encoding) {
+  map<string, StaticVariant>::iterator iter = file->variants.find(encoding);
+  if (iter != file->variants.end()) {
+    return iter->second;
+  }
+
+  StaticVariant &variant = file->variants[encoding];
+  string compressed = HttpUtils::compress(*file->contents, encoding);
+  if (compressed.size() == 0 || compressed.size() >= file->contents->size()) {
+    return variant;
+  }
+  variant.contents.reset(new string(compressed));
+  // a file that has left the cache no longer counts toward its budget
+  if (file->cached) {
+    m_cachedBytes += compressed.size();
   }
 
-  close(fd);
-  
-  return result;
+  // the compressed bytes are a different representation, so they get a
+  // weak ETag that still matches the file's for If-None-Match
+  string *headers = new string();
+  headers->append("ETag: W/").append(file->etag).append("\r\n");
+  headers->append(file->headers->substr(file->headers->find("Last-Modified:")));
+  headers->append("Content-Encoding: ").append(encoding).append("\r\n");
+  variant.headers.reset(headers);
+  this->evictFiles();
+  return variant;
 }
 
 void FileService::head(HTTPRequest *request, HTTPResponse *response) {
   // HEAD is the same as get but with no body
   this->get(request, response);
-  response->setBody("");
+  response->withoutBody(response->bodySize());
 }
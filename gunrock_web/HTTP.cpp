@@ -4,7 +4,9 @@
 #include <string>
 
 #include <assert.h>
+#include <ctype.h>
 #include <stdio.h>
+#include <strings.h>
 
 using namespace std;
 
@@ -80,6 +82,12 @@ int HTTP::headers_complete_cb(http_parser *parser)
     HTTP *http = (HTTP *) parser->data;
     http->addHeaderField();
     http->m_headerDone = true;
+    http->m_contentLength = parser->content_length;
+    if(http->m_httpType == HTTP_REQUEST) {
+        // the method is known now, services can run before the body is read
+        http->m_method = parser->method;
+        http->m_keepAlive = http_should_keep_alive(parser);
+    }
 
     if(http->m_httpType == HTTP_RESPONSE) {
         char buf[64];
@@ -127,11 +135,17 @@ int HTTP::body_cb(http_parser *parser, const char *at, size_t length)
 int HTTP::message_complete_cb(http_parser *parser)
 {
     HTTP *http = (HTTP *) parser->data;
-    assert((http->getState() == HTTP::VALUE) || 
+    // an HTTP/1.0 request can end right after its request line
+    assert((http->getState() == HTTP::HEADER) ||
+           (http->getState() == HTTP::VALUE) ||
            (http->getState() == HTTP::BODY));
     http->setState(HTTP::DONE);
     http->messageComplete(parser->method);
-    return 0;
+
+    // stop here so whatever follows is left for the next message on the
+    // connection, the parser stops one short of the byte it's on
+    http->m_extraParsedBytes = 1;
+    return 1;
 }
 
 /****************************************************************************/
@@ -141,7 +155,9 @@ int HTTP::message_complete_cb(http_parser *parser)
 /*************************** Public Functions *******************************/
 
 
-HTTP::HTTP(http_parser_type httpType)
+HTTP::HTTP(http_parser_type httpType, std::pmr::memory_resource *memory) :
+    m_url(memory), m_path(memory), m_query(memory), m_headerBuffer(memory),
+    m_headers(memory), m_headerIndex(memory), m_body(memory)
 {
     m_state = INIT;
     http_parser_init(&m_parser, httpType);
@@ -162,25 +178,16 @@ HTTP::HTTP(http_parser_type httpType)
 
     m_parser.data = this;
 
-    m_field = NULL;
-    m_value = NULL;
+    m_pendingHeader = false;
+    m_indexedHeaders = 0;
+    m_headerBuffer.reserve(1024);
     m_extraParsedBytes = 0;
+    m_contentLength = -1;
+    m_keepAlive = false;
 }
 
 HTTP::~HTTP()
 {
-    if(m_field != NULL) {
-        delete m_field;
-    }
-
-    if(m_value != NULL) {
-        delete m_value;
-    }
-
-    for(unsigned int idx = 0; idx < m_headers.size(); idx++) {
-        delete m_headers[idx].first;
-        delete m_headers[idx].second;
-    }
 }
 
 int HTTP::addData(const unsigned char *data, int len)
@@ -196,28 +203,83 @@ int HTTP::addData(const unsigned char *data, int len)
 
 string HTTP::getBody()
 {
-    return m_body;
+    return string(m_body);
 }
 
-string HTTP::getUrl()
+// Hands the body bytes parsed so far to the caller, leaving our buffer
+// empty so that a body can be consumed as it arrives.
+void HTTP::takeBody(std::pmr::string &body)
 {
-    return m_url;
+    body.clear();
+    body.swap(m_body);
 }
 
-string HTTP::getPath()
+string HTTP::getUrl()
 {
-    return m_path;
+    return string(m_url);
 }
 
 string HTTP::getHost()
 {
-    string host = (m_method == HTTP_CONNECT) ? m_url : m_host;
+    string host = (m_method == HTTP_CONNECT) ? string(m_url) : m_host;
     if(host.find(':') == string::npos) {
         host += ":80";
     }
     return host;
 }
 
+string_view HTTP::headerName(size_t idx)
+{
+    const HeaderEntry &entry = m_headers[idx];
+    return string_view(m_headerBuffer).substr(entry.nameOffset, entry.nameLength);
+}
+
+string_view HTTP::headerValue(size_t idx)
+{
+    const HeaderEntry &entry = m_headers[idx];
+    return string_view(m_headerBuffer).substr(entry.valueOffset, entry.valueLength);
+}
+
+static size_t hashHeaderName(string_view name)
+{
+    // FNV-1a over the lower case name
+    size_t hash = 2166136261u;
+    for(size_t idx = 0; idx < name.size(); idx++) {
+        hash = (hash ^ (unsigned char) tolower(name[idx])) * 16777619u;
+    }
+    return hash;
+}
+
+static bool headerNamesEqual(string_view a, string_view b)
+{
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+/*
+ * Looks up a header by name, ignoring case. If there are several with
+ * the same name we find the first one. value points into our buffer and
+ * stays valid until we are deleted.
+ */
+bool HTTP::findHeader(string_view name, string_view *value)
+{
+    if(m_indexedHeaders != m_headers.size()) {
+        indexHeaders();
+    }
+    // a message without headers never gets an index to mask into
+    if(m_headerIndex.empty()) {
+        return false;
+    }
+
+    size_t mask = m_headerIndex.size() - 1;
+    for(size_t slot = hashHeaderName(name) & mask; m_headerIndex[slot] >= 0; slot = (slot + 1) & mask) {
+        if(headerNamesEqual(headerName(m_headerIndex[slot]), name)) {
+            *value = headerValue(m_headerIndex[slot]);
+            return true;
+        }
+    }
+    return false;
+}
+
 bool HTTP::isHeaderDone()
 {
     return m_headerDone;
@@ -239,8 +301,8 @@ string HTTP::getReplyHeader()
 
     bool foundConn = false;
     for(unsigned int idx = 0; idx < m_headers.size(); idx++) {
-        string field = *(m_headers[idx].first);
-        string value = *(m_headers[idx].second);
+        string field(headerName(idx));
+        string value(headerValue(idx));
 
         if(field == "Connection") {
             value = "close";
@@ -270,15 +332,15 @@ string HTTP::getProxyRequest(const char *userAgent)
         if(m_path.size() == 0) {
             urlPathQuery = "/";
         } else {
-            urlPathQuery = m_path;
+            urlPathQuery = string(m_path);
         }
         if(m_query.size() > 0) {
-            urlPathQuery += "?" + m_query;
+            urlPathQuery += "?" + string(m_query);
         }
         if(m_url.find(urlPathQuery) == string::npos) {
             // this is a hack to get around buggy HTML from taobao
             assert(m_query.size() > 0);
-            urlPathQuery = m_path + "??" + m_query;
+            urlPathQuery = string(m_path) + "??" + string(m_query);
             if(m_url.find(urlPathQuery) == string::npos) {
                 cout << "url path mismatch " << m_url << endl << urlPathQuery << endl;
             }
@@ -288,7 +350,7 @@ string HTTP::getProxyRequest(const char *userAgent)
     if(m_method == HTTP_GET) {
         reply = "GET " + urlPathQuery + " HTTP/1.1\r\n";
     } else if(m_method == HTTP_CONNECT) {
-        reply = "CONNECT " + m_url + " HTTP/1.1\r\n";
+        reply = "CONNECT " + string(m_url) + " HTTP/1.1\r\n";
     } else if(m_method == HTTP_POST) {
         reply = "POST " + urlPathQuery + " HTTP/1.1\r\n";
     } else if(m_method == HTTP_HEAD) {
@@ -298,8 +360,8 @@ string HTTP::getProxyRequest(const char *userAgent)
     }
 
     for(unsigned int idx = 0; idx < m_headers.size(); idx++) {
-        string field = *(m_headers[idx].first);
-        string value = *(m_headers[idx].second);
+        string field(headerName(idx));
+        string value(headerValue(idx));
 
         if((userAgent != NULL) && (field == "User-Agent")) {
             value = string(userAgent);
@@ -352,37 +414,64 @@ void HTTP::appendUrl(const char *at, size_t len)
 
 void HTTP::addHeaderField()
 {
-    if(m_field != NULL) {
-        assert(m_value != NULL);
-        if(*m_field == "Host") {
-            m_host = *m_value;
+    if(m_pendingHeader) {
+        string_view field = headerName(m_headers.size() - 1);
+        if(headerNamesEqual(field, "Host")) {
+            m_host = string(headerValue(m_headers.size() - 1));
         }
-        if(*m_field == "Eoh") {
+        if(field == "Eoh") {
             cout << "got the Eoh header" << endl;
         }
-        m_headers.insert(m_headers.end(), pair<string *, string *>(m_field, m_value));
-        m_field = NULL;
-        m_value = NULL;
-    } else {
-        assert(m_value == NULL);
+        m_pendingHeader = false;
     }
 }
 
 void HTTP::newHeaderField(const char *at, size_t len)
 {
     addHeaderField();
-    m_field = new string(at, len);
-    m_value = new string();
+    HeaderEntry entry;
+    entry.nameOffset = m_headerBuffer.size();
+    entry.nameLength = len;
+    entry.valueOffset = m_headerBuffer.size() + len;
+    entry.valueLength = 0;
+    m_headerBuffer.append(at, len);
+    m_headers.push_back(entry);
+    m_pendingHeader = true;
 }
 void HTTP::appendHeaderField(const char *at, size_t len)
 {
-    assert(m_field != NULL);
-    m_field->append(at, len);
+    assert(m_pendingHeader);
+    m_headerBuffer.append(at, len);
+    m_headers.back().nameLength += len;
+    m_headers.back().valueOffset += len;
 }
 
 void HTTP::appendHeaderValue(const char *at, size_t len)
 {
-    m_value->append(at, len);
+    assert(m_pendingHeader);
+    m_headerBuffer.append(at, len);
+    m_headers.back().valueLength += len;
+}
+
+// Rebuilds the hash index with room for every header we have, keeping
+// the table at most half full.
+void HTTP::indexHeaders()
+{
+    size_t slots = 16;
+    while(slots < m_headers.size() * 2) {
+        slots *= 2;
+    }
+    m_headerIndex.assign(slots, -1);
+
+    size_t mask = slots - 1;
+    for(size_t idx = 0; idx < m_headers.size(); idx++) {
+        size_t slot = hashHeaderName(headerName(idx)) & mask;
+        while(m_headerIndex[slot] >= 0) {
+            slot = (slot + 1) & mask;
+        }
+        m_headerIndex[slot] = idx;
+    }
+    m_indexedHeaders = m_headers.size();
 }
 
 void HTTP::messageComplete(unsigned char method)
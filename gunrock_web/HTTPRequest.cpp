@@ -1,10 +1,12 @@
 #include "HTTPRequest.h"
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 
 #include <assert.h>
 #include <errno.h>
+#include <string.h>
 
 #include "HttpUtils.h"
 #include "StringUtils.h"
@@ -13,18 +15,26 @@ using namespace std;
 
 #define CONNECT_REPLY "HTTP/1.1 200 Connection Established\r\n\r\n"
 
-HTTPRequest::HTTPRequest(MySocket *sock, int serverPort)
+/*
+ * Everything the request allocates while it is parsed comes from memory,
+ * which is usually an Arena that is reset once the request is done.
+ */
+HTTPRequest::HTTPRequest(MySocket *sock, int serverPort, std::pmr::memory_resource *memory) :
+    m_bodyChunk(memory), m_pathParams(memory)
 {
     m_sock = sock;
-    m_http = new HTTP();
+    m_memory = memory;
+    m_http = new (memory->allocate(sizeof(HTTP), alignof(HTTP))) HTTP(HTTP_REQUEST, memory);
     m_serverPort = serverPort;
     m_totalBytesRead = 0;
     m_totalBytesWritten = 0;
+    m_bodyOffset = 0;
 }
 
 HTTPRequest::~HTTPRequest()
 {
-    delete m_http;
+    m_http->~HTTP();
+    m_memory->deallocate(m_http, sizeof(HTTP), alignof(HTTP));
 }
 
 void HTTPRequest::printDebugInfo()
@@ -40,61 +50,142 @@ map<string, string> HTTPRequest::getParams() {
 }
 
 WwwFormEncodedDict HTTPRequest::formEncodedBody() {
-  WwwFormEncodedDict dict(m_http->getBody());
+  WwwFormEncodedDict dict(getBody());
   return dict;
 }
 
-string HTTPRequest::getPath() {
+string HTTPRequest::getBody() {
+  // readRequest stops after the headers, so pull in the rest of the body
+  while (!m_http->isDone()) {
+    readMore();
+  }
+  return m_http->getBody();
+}
+
+/**
+ * Reads the whole body into body, but stops and returns false as soon as
+ * it's longer than maxBytes, whether the client sent a Content-Length or
+ * chunks, so a client can't make us hold more than that.
+ */
+bool HTTPRequest::getBody(string *body, size_t maxBytes) {
+  char buffer[4096];
+  int ret;
+  body->clear();
+  while ((ret = readBody(buffer, sizeof(buffer))) > 0) {
+    if (body->size() + ret > maxBytes) {
+      return false;
+    }
+    body->append(buffer, ret);
+  }
+  return true;
+}
+
+/**
+ * Reads up to len bytes of the request body as it comes off the socket
+ * and returns the number of bytes copied into buffer, or 0 at the end of
+ * the body. Chunked bodies are decoded by the parser. Don't mix this with
+ * getBody, which only returns the part of the body that hasn't been read.
+ */
+int HTTPRequest::readBody(void *buffer, int len) {
+  while (m_bodyOffset >= m_bodyChunk.size()) {
+    m_bodyOffset = 0;
+    m_http->takeBody(m_bodyChunk);
+    if (m_bodyChunk.size() > 0) {
+      break;
+    }
+    if (m_http->isDone()) {
+      return 0;
+    }
+    readMore();
+  }
+
+  int copySize = min((size_t) len, m_bodyChunk.size() - m_bodyOffset);
+  memcpy(buffer, m_bodyChunk.data() + m_bodyOffset, copySize);
+  m_bodyOffset += copySize;
+  return copySize;
+}
+
+// Reads and drops whatever the service didn't read of the body so that
+// closing the connection doesn't reset it before the client gets the
+// response.
+void HTTPRequest::discardBody() {
+  while (!m_http->isDone()) {
+    readMore();
+    m_http->takeBody(m_bodyChunk);
+  }
+  m_bodyChunk.clear();
+  m_bodyOffset = 0;
+}
+
+string_view HTTPRequest::getPath() {
   return m_http->getPath();
 }
 
-string HTTPRequest::getHeader(string key) {
-  vector<pair<string *, string *> >::iterator iter;
-  vector<pair<string *, string *> > headers = m_http->getHeaders();
-  for (iter = headers.begin(); iter != headers.end(); iter++) {
-    string header_key = *(iter->first);
-    if (header_key == key) {
-      return *(iter->second);
+// Returns the path segment the router matched to ":name", or "".
+string HTTPRequest::getPathParam(string name) {
+  for (size_t idx = 0; idx < m_pathParams.size(); idx++) {
+    if (m_pathParams[idx].first == name) {
+      return string(m_pathParams[idx].second);
     }
   }
+  return "";
+}
+
+void HTTPRequest::addPathParam(string_view name, string_view value) {
+  m_pathParams.push_back(make_pair(name, value));
+}
 
-  throw "could not find header";
+/**
+ * Looks up a header by name, ignoring case, without copying it. value
+ * stays valid for as long as the request does.
+ */
+bool HTTPRequest::findHeader(string_view name, string_view *value) {
+  return m_http->findHeader(name, value);
+}
+
+// A body with a Transfer-Encoding runs until its last chunk, so its
+// length isn't known until it's all been read.
+bool HTTPRequest::isChunked() {
+  string_view value;
+  return findHeader("Transfer-Encoding", &value);
 }
 
 bool HTTPRequest::hasAuthToken() {
-  try {
-    getHeader("x-auth-token");
-    return true;
-  } catch (...) {
-    return false;
-  }
+  string_view value;
+  return findHeader("x-auth-token", &value);
 }
 
 string HTTPRequest::getAuthToken() {
-  try {
-    return getHeader("x-auth-token");
-  } catch (...) {
-    return "";
-  }
+  string_view value;
+  return findHeader("x-auth-token", &value) ? string(value) : "";
 }
 
 vector<string> HTTPRequest::getPathComponents() {
-  return StringUtils::split(getPath(), '/');
+  return StringUtils::split(string(getPath()), '/');
 }
 
+/**
+ * Reads the request line and headers. The body is left on the socket for
+ * the service to read with readBody or getBody.
+ */
 bool HTTPRequest::readRequest()
 {
     assert(!m_http->isDone());
 
-    string readData;
-    while(!m_http->isDone()) {
-        readData = m_sock->read();
-	onRead(readData.c_str(), readData.size());
+    while(!m_http->isHeaderDone()) {
+        readMore();
     }
 
     return true;
 }
 
+void HTTPRequest::readMore()
+{
+    char buffer[4096];
+    int len = m_sock->read(buffer, sizeof(buffer));
+    onRead(buffer, len);
+}
+
 void HTTPRequest::onRead(const char *buffer, unsigned int len)
 {
     m_totalBytesRead += len;
@@ -115,9 +206,11 @@ void HTTPRequest::onRead(const char *buffer, unsigned int len)
         if(m_http->isDone() && (bytesRead < len)) {
             if(m_http->isConnect() && ((len-bytesRead) == 1) && (buffer[bytesRead] == '\n')) {
                 break;
-            } else {
-                assert(false);
             }
+            // the rest is the start of the next request on this connection
+            m_sock->unread(buffer + bytesRead, len - bytesRead);
+            m_totalBytesRead -= len - bytesRead;
+            break;
         }
     }
 }
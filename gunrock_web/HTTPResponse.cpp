@@ -1,33 +1,116 @@
-#include <sstream>
+#include <stdio.h>
+#include <sys/uio.h>
 
 #include "HTTPResponse.h"
 
 using namespace std;
 
-HTTPResponse::HTTPResponse() {
+HTTPResponse::HTTPResponse(pmr::memory_resource *memory) :
+  headers(memory), contentType(memory) {
   this->streaming = false;
+  this->headOnly = false;
+  this->contentLength = -1;
+  this->bytesSent = 0;
+  this->bodyStream = NULL;
   this->contentType = "text/html; charset=ISO-8859-1";
   this->headers["Server"] = "Gunrock Web";
   this->status = 200;
 }
 
+HTTPResponse::~HTTPResponse() {
+  delete this->bodyStream;
+}
+
 void HTTPResponse::withStreaming() {
   this->streaming = true;
 }
 
-void HTTPResponse::setHeader(string name, string value) {
-  this->headers[name] = value;
+// Used for HEAD: send the headers without a body, advertising the
+// Content-Length that the body would have had, if it's not negative.
+void HTTPResponse::withoutBody(int contentLength) {
+  setBody("");
+  this->headOnly = true;
+  this->contentLength = contentLength;
+}
+
+int HTTPResponse::bodySize() {
+  if (bodyStream != NULL) {
+    return bodyStream->size();
+  }
+  return sharedBody ? sharedBody->size() : body.size();
+}
+
+void HTTPResponse::setHeader(string_view name, string_view value) {
+  pmr::map<pmr::string, pmr::string, less<> >::iterator iter = this->headers.find(name);
+  if (iter != this->headers.end()) {
+    iter->second = value;
+  } else {
+    this->headers.emplace(name, value);
+  }
 }
 
 void HTTPResponse::setBody(string data) {
+  // a string body replaces any body stream set before
+  delete this->bodyStream;
+  this->bodyStream = NULL;
+  this->sharedBody.reset();
   body = data;
 }
 
+// Sends data, which may be shared with other responses, as the body
+// without copying it.
+void HTTPResponse::setSharedBody(shared_ptr<const string> data) {
+  setBody("");
+  this->sharedBody = data;
+}
+
+// Adds header lines that were serialized ahead of time, each one ending
+// in "\r\n", after the headers set with setHeader.
+void HTTPResponse::setPreparedHeaders(shared_ptr<const string> lines) {
+  this->preparedHeaders = lines;
+}
+
+void HTTPResponse::setBodyStream(BodyStream *stream) {
+  delete this->bodyStream;
+  this->bodyStream = stream;
+  this->sharedBody.reset();
+  body = "";
+  if (stream != NULL && stream->size() < 0) {
+    withStreaming();
+  }
+}
+
+/**
+ * Compresses the body with encoding ("gzip" or "deflate") while it is
+ * sent. The ETag becomes weak because the bytes on the wire no longer
+ * match the stored representation.
+ */
+void HTTPResponse::encodeBody(string encoding) {
+  BodyStream *stream = this->bodyStream;
+  this->bodyStream = NULL;
+  if (stream == NULL) {
+    stream = new StringBodyStream(sharedBody ? *sharedBody : body);
+  }
+  setBodyStream(new DeflateBodyStream(stream, encoding == "gzip"));
+
+  setHeader("Content-Encoding", encoding);
+  setHeader("Vary", "Accept-Encoding");
+  pmr::map<pmr::string, pmr::string, less<> >::iterator etag = headers.find("ETag");
+  if (etag != headers.end() && etag->second.compare(0, 2, "W/") != 0) {
+    etag->second = "W/" + etag->second;
+  }
+}
+
+// How many bytes write has sent, headers included.
+long long HTTPResponse::getBytesSent() {
+  return bytesSent;
+}
+
 int HTTPResponse::getStatus() {
   return status;
 }
 
-void HTTPResponse::setContentType(string contentType) {
+void HTTPResponse::setContentType(string_view contentType) {
   this->contentType = contentType;
 }
 
@@ -36,33 +119,128 @@ void HTTPResponse::setStatus(int status) {
 }
 
 string HTTPResponse::statusToString() {
-  if (status == 200) {
-    return "OK";
-  } else {
-    return "Unknown";
+  switch (status) {
+  case 200: return "OK";
+  case 206: return "Partial Content";
+  case 304: return "Not Modified";
+  case 400: return "Bad Request";
+  case 401: return "Unauthorized";
+  case 403: return "Forbidden";
+  case 404: return "Not Found";
+  case 405: return "Method Not Allowed";
+  case 409: return "Conflict";
+  case 412: return "Precondition Failed";
+  case 413: return "Payload Too Large";
+  case 416: return "Range Not Satisfiable";
+  case 500: return "Internal Server Error";
+  case 501: return "Not Implemented";
+  case 502: return "Bad Gateway";
+  case 503: return "Service Unavailable";
+  case 507: return "Insufficient Storage";
+  default: return "Unknown";
   }
 }
 
-string HTTPResponse::response() {
-  stringstream out;
+// Serializes the status line and headers into a buffer that is reused
+// by every response written on this thread.
+const string &HTTPResponse::headerBlock() {
+  static thread_local string out;
+
   setHeader("Content-Type", contentType);
-  if (streaming) {
+  if (status == 304) {
+    // a 304 has no body and its length would describe the full object
+  } else if (headOnly) {
+    if (contentLength >= 0) {
+      setHeader("Content-Length", to_string(contentLength));
+    }
+  } else if (streaming) {
     setHeader("Transfer-Encoding", "chunked");
   } else {
-    stringstream len;
-    len << body.size();
-    setHeader("Content-Length", len.str());
+    setHeader("Content-Length", to_string(bodySize()));
   }
 
-  out << "HTTP/1.1 " << status << " " << statusToString() << "\r\n";
-  map<string, string>::iterator iter;
+  out.clear();
+  out.append("HTTP/1.1 ").append(to_string(status)).append(" ").append(statusToString()).append("\r\n");
+  pmr::map<pmr::string, pmr::string, less<> >::iterator iter;
   for(iter = headers.begin(); iter != headers.end(); iter++) {
-    out << iter->first << ": " << iter->second << "\r\n";
+    out.append(iter->first).append(": ").append(iter->second).append("\r\n");
+  }
+  if (preparedHeaders) {
+    out.append(*preparedHeaders);
+  }
+  out.append("\r\n");
+  return out;
+}
+
+string HTTPResponse::response() {
+  string out = headerBlock();
+  if (!streaming && status != 304) {
+    out += sharedBody ? *sharedBody : body;
+  }
+
+  return out;
+}
+
+static void setIov(struct iovec *iov, const void *buffer, size_t len) {
+  iov->iov_base = (void *) buffer;
+  iov->iov_len = len;
+}
+
+// Writes iov to client, counting what we send.
+void HTTPResponse::sendVector(MySocket *client, struct iovec *iov, int iovcnt) {
+  for (int idx = 0; idx < iovcnt; idx++) {
+    bytesSent += iov[idx].iov_len;
+  }
+  client->writeVector(iov, iovcnt);
+}
+
+/**
+ * Sends the response with writev so the headers and body go out together
+ * without ever being concatenated. Body streams are sent one buffer at a
+ * time, with the headers riding along with the first buffer.
+ */
+void HTTPResponse::write(MySocket *client) {
+  const string &header = headerBlock();
+  struct iovec iov[4];
+  setIov(&iov[0], header.data(), header.size());
+
+  if (bodyStream == NULL || status == 304) {
+    const string &data = sharedBody ? *sharedBody : body;
+    setIov(&iov[1], data.data(), (streaming || status == 304) ? 0 : data.size());
+    sendVector(client, iov, 2);
+    return;
   }
-  out << "\r\n";
-  if (body.size() > 0 && !streaming) {
-    out << body;
+
+  if (!streaming && bodyStream->sendsItself()) {
+    sendVector(client, iov, 1);
+    bodyStream->sendTo(client);
+    bytesSent += bodyStream->size();
+    return;
+  }
+
+  // send the body as it is produced so we only ever hold one buffer of it
+  char buffer[4096];
+  char chunkHeader[32];
+  int ret;
+  while ((ret = bodyStream->read(buffer, sizeof(buffer))) > 0) {
+    if (streaming) {
+      int len = snprintf(chunkHeader, sizeof(chunkHeader), "%x\r\n", ret);
+      setIov(&iov[1], chunkHeader, len);
+      setIov(&iov[2], buffer, ret);
+      setIov(&iov[3], "\r\n", 2);
+      sendVector(client, iov, 4);
+    } else {
+      setIov(&iov[1], buffer, ret);
+      sendVector(client, iov, 2);
+    }
+    // the headers went out with the first buffer
+    setIov(&iov[0], NULL, 0);
   }
 
-  return out.str();
+  if (streaming) {
+    setIov(&iov[1], "0\r\n\r\n", 5);
+    sendVector(client, iov, 2);
+  } else {
+    sendVector(client, iov, 1);
+  }
 }
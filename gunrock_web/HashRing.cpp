@@ -0,0 +1,81 @@
+#include <algorithm>
+
+#include "HashRing.h"
+
+using namespace std;
+
+HashRing::HashRing(int virtualNodes) {
+  m_virtualNodes = virtualNodes;
+}
+
+// FNV-1a with a final mix, since FNV alone leaves keys that differ only
+// in their last few characters (like "node#1" and "node#2") close together.
+uint64_t HashRing::hash(string_view key) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t idx = 0; idx < key.size(); idx++) {
+    hash = (hash ^ (unsigned char) key[idx]) * 1099511628211ull;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+void HashRing::addNode(string node) {
+  if (hasNode(node)) {
+    return;
+  }
+  m_nodes.push_back(node);
+  for (int idx = 0; idx < m_virtualNodes; idx++) {
+    m_points[hash(node + "#" + to_string(idx))] = node;
+  }
+}
+
+void HashRing::removeNode(string node) {
+  vector<string>::iterator iter = find(m_nodes.begin(), m_nodes.end(), node);
+  if (iter == m_nodes.end()) {
+    return;
+  }
+  m_nodes.erase(iter);
+  for (int idx = 0; idx < m_virtualNodes; idx++) {
+    map<uint64_t, string>::iterator point = m_points.find(hash(node + "#" + to_string(idx)));
+    if (point != m_points.end() && point->second == node) {
+      m_points.erase(point);
+    }
+  }
+}
+
+bool HashRing::hasNode(string node) {
+  return find(m_nodes.begin(), m_nodes.end(), node) != m_nodes.end();
+}
+
+vector<string> HashRing::nodes() {
+  return m_nodes;
+}
+
+string HashRing::owner(string_view key) {
+  vector<string> found = owners(key, 1);
+  return found.empty() ? "" : found[0];
+}
+
+vector<string> HashRing::owners(string_view key, int count) {
+  vector<string> found;
+  count = min(count, (int) m_nodes.size());
+  if (count <= 0) {
+    return found;
+  }
+
+  map<uint64_t, string>::iterator iter = m_points.lower_bound(hash(key));
+  while ((int) found.size() < count) {
+    if (iter == m_points.end()) {
+      iter = m_points.begin();
+    }
+    if (find(found.begin(), found.end(), iter->second) == found.end()) {
+      found.push_back(iter->second);
+    }
+    iter++;
+  }
+  return found;
+}
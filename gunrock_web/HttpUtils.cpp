@@ -1,4 +1,10 @@
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include <zlib.h>
 
 #include "HttpUtils.h"
 
@@ -42,6 +48,184 @@ void HttpUtils::writeLastChunk(MySocket *client) {
   writeChunk(client, NULL, 0);
 }
 
+/**
+ * Parses a Range header ("bytes=0-99,200-,-50") against a body of size
+ * bytes into inclusive (first, last) byte positions.
+ *
+ * Returns false if the header isn't a byte range we understand, in which
+ * case the Range header should be ignored. Ranges that start past the
+ * end of the body are dropped, so an empty list means that none of the
+ * requested ranges can be satisfied.
+ */
+bool HttpUtils::parseRange(string header, int size,
+                           vector<pair<int, int> > &ranges) {
+  ranges.clear();
+  const string prefix = "bytes=";
+  if (header.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+
+  vector<string> specs = split(header.substr(prefix.size()), ',');
+  if (specs.size() == 0) {
+    return false;
+  }
+  for (unsigned int idx = 0; idx < specs.size(); idx++) {
+    string spec = specs[idx];
+    spec.erase(0, spec.find_first_not_of(' '));
+    spec.erase(spec.find_last_not_of(' ') + 1);
+
+    size_t dash = spec.find('-');
+    if (dash == string::npos ||
+        spec.find_first_not_of("0123456789-") != string::npos ||
+        spec.find('-', dash + 1) != string::npos) {
+      return false;
+    }
+    string firstStr = spec.substr(0, dash);
+    string lastStr = spec.substr(dash + 1);
+    if (firstStr.size() > 18 || lastStr.size() > 18) {
+      return false;
+    }
+
+    long long first, last;
+    if (firstStr.size() == 0) {
+      // a suffix range, the last N bytes of the body
+      if (lastStr.size() == 0) {
+        return false;
+      }
+      long long suffix = atoll(lastStr.c_str());
+      if (suffix == 0) {
+        continue;
+      }
+      first = max(0LL, size - suffix);
+      last = size - 1;
+    } else {
+      first = atoll(firstStr.c_str());
+      last = size - 1;
+      if (lastStr.size() > 0) {
+        if (atoll(lastStr.c_str()) < first) {
+          return false;
+        }
+        last = min(last, atoll(lastStr.c_str()));
+      }
+    }
+
+    if (first < size) {
+      ranges.push_back(pair<int, int>(first, last));
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Checks an If-Match or If-None-Match header value against the current
+ * ETag of a resource, or "" if the resource doesn't exist. "*" matches
+ * any existing resource. With weak set, W/ prefixes are ignored as
+ * If-None-Match asks for, otherwise weak tags never match.
+ */
+bool HttpUtils::etagMatches(string header, string etag, bool weak) {
+  if (etag.size() == 0) {
+    return false;
+  }
+
+  vector<string> tags = split(header, ',');
+  for (unsigned int idx = 0; idx < tags.size(); idx++) {
+    string tag = tags[idx];
+    tag.erase(0, tag.find_first_not_of(' '));
+    tag.erase(tag.find_last_not_of(' ') + 1);
+    if (tag == "*") {
+      return true;
+    }
+    if (tag.compare(0, 2, "W/") == 0) {
+      if (!weak) {
+        continue;
+      }
+      tag = tag.substr(2);
+    }
+    if (tag == etag) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Picks the content coding we'll use for a response from the client's
+ * Accept-Encoding header: "gzip" or "deflate", whichever the client
+ * prefers, or "" to send the body as is. A coding with q=0 is one the
+ * client refuses, and "*" only stands for codings it didn't name.
+ */
+string HttpUtils::negotiateEncoding(string acceptEncoding) {
+  // -1 until the client names the coding
+  double gzipQuality = -1;
+  double deflateQuality = -1;
+  double anyQuality = -1;
+  vector<string> codings = split(acceptEncoding, ',');
+  for (unsigned int idx = 0; idx < codings.size(); idx++) {
+    vector<string> params = split(codings[idx], ';');
+    if (params.size() == 0) {
+      continue;
+    }
+    string coding = params[0];
+    coding.erase(0, coding.find_first_not_of(' '));
+    coding.erase(coding.find_last_not_of(' ') + 1);
+    transform(coding.begin(), coding.end(), coding.begin(), ::tolower);
+
+    double quality = 1;
+    for (unsigned int param = 1; param < params.size(); param++) {
+      size_t pos = params[param].find("q=");
+      if (pos != string::npos) {
+        quality = atof(params[param].c_str() + pos + 2);
+      }
+    }
+
+    if (coding == "gzip" || coding == "x-gzip") {
+      gzipQuality = quality;
+    } else if (coding == "deflate") {
+      deflateQuality = quality;
+    } else if (coding == "*") {
+      anyQuality = quality;
+    }
+  }
+
+  if (gzipQuality < 0) {
+    gzipQuality = anyQuality;
+  }
+  if (deflateQuality < 0) {
+    deflateQuality = anyQuality;
+  }
+  // on a tie gzip wins since more clients handle it correctly
+  if (gzipQuality > 0 && gzipQuality >= deflateQuality) {
+    return "gzip";
+  }
+  if (deflateQuality > 0) {
+    return "deflate";
+  }
+  return "";
+}
+
+// Compresses data with "gzip" or "deflate" as tightly as zlib can, for
+// bodies we compress once and send many times. Returns "" on failure.
+string HttpUtils::compress(const string &data, string encoding) {
+  z_stream zstream;
+  memset(&zstream, 0, sizeof(zstream));
+  int windowBits = encoding == "gzip" ? 15 + 16 : 15;
+  if (deflateInit2(&zstream, Z_BEST_COMPRESSION, Z_DEFLATED, windowBits,
+                   9, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return "";
+  }
+
+  // gzip adds a header and trailer that deflateBound doesn't count
+  string out(deflateBound(&zstream, data.size()) + 32, '\0');
+  zstream.next_in = (Bytef *) data.data();
+  zstream.avail_in = data.size();
+  zstream.next_out = (Bytef *) &out[0];
+  zstream.avail_out = out.size();
+  int ret = deflate(&zstream, Z_FINISH);
+  out.resize(zstream.total_out);
+  deflateEnd(&zstream);
+  return ret == Z_STREAM_END ? out : "";
+}
 
 // split lifted from stackoverflow
 // http://stackoverflow.com/questions/236129/split-a-string-in-c
@@ -5,6 +5,7 @@
 #include <cstring>
 
 #include "LocalFileSystem.h"
+#include "Metrics.h"
 #include "ufs.h"
 
 using namespace std;
@@ -14,6 +15,23 @@ LocalFileSystem::LocalFileSystem(Disk *disk) {
   this->disk = disk;
 }
 
+unsigned int LocalFileSystem::generation(int inodeNumber) {
+  if (inodeNumber < 0 || inodeNumber >= (int) generations.size()) {
+    return 0;
+  }
+  return generations[inodeNumber];
+}
+
+void LocalFileSystem::modified(int inodeNumber) {
+  if (inodeNumber < 0) {
+    return;
+  }
+  if (inodeNumber >= (int) generations.size()) {
+    generations.resize(inodeNumber + 1, 0);
+  }
+  generations[inodeNumber]++;
+}
+
 void LocalFileSystem::readSuperBlock(super_t *super) {
   if (super == nullptr) {
         cerr << "Invalid argument for reading super block." << endl;
@@ -88,6 +106,7 @@ bool checkInodeIsExist(super_t *super,int parentInodeNumber,unsigned char * inod
 
 
 int LocalFileSystem::lookup(int parentInodeNumber, std::string name) {
+    Metrics::count(LFS_LOOKUPS);
     inode_t pinum;
     if (stat(parentInodeNumber, &pinum)) {
         return -EINVALIDINODE;
@@ -156,6 +175,7 @@ int LocalFileSystem::stat(int inodeNumber, inode_t *inode) {
 }
 
 int LocalFileSystem::read(int inodeNumber, void *buffer, int size) {
+  Metrics::count(LFS_READS);
   if (!buffer || (size <= 0)) {
 		return -EINVALIDSIZE;
 	}
@@ -197,6 +217,7 @@ int LocalFileSystem::read(int inodeNumber, void *buffer, int size) {
 }
 
 int LocalFileSystem::create(int parentInodeNumber, int type, std::string name) {
+	Metrics::count(LFS_CREATES);
 	union {
 		unsigned char byteBuf[UFS_BLOCK_SIZE];
 		inode_t inodeBuf[(UFS_BLOCK_SIZE / sizeof(inode_t))];
@@ -411,6 +432,8 @@ int LocalFileSystem::create(int parentInodeNumber, int type, std::string name) {
 	disk->writeBlock((super.inode_region_addr + indexOfBlock), byteBuf);
 
 	disk->commit();
+	modified(parentInodeNumber);
+	modified(inumNew);
   return inumNew;
 }
 
@@ -663,6 +686,7 @@ int getAndSetFreeDataBlockIndex(super_t *super, unsigned char *data_bit_map){
 }
 
 int LocalFileSystem::write(int inum2, const void *byteBuf2, int size) {
+	Metrics::count(LFS_WRITES);
 	union {
 		unsigned char byteBuf[UFS_BLOCK_SIZE];
 		inode_t inodeBuf[(UFS_BLOCK_SIZE / sizeof(inode_t))];
@@ -768,11 +792,273 @@ int LocalFileSystem::write(int inum2, const void *byteBuf2, int size) {
 	}
 
 	disk->commit();
+	modified(inum2);
   return size;
 }
 
 
+// Allocates the lowest numbered free data block and returns its disk
+// block number, or -1 if there are no free data blocks left.
+static int allocateDataBlock(Disk *disk, super_t *super) {
+	unsigned char byteBuf[UFS_BLOCK_SIZE];
+	int indexOfData = 0;
+	for (int i = 0; i < super->data_bitmap_len; i++) {
+		disk->readBlock((super->data_bitmap_addr + i), byteBuf);
+		for (int j = 0; j < UFS_BLOCK_SIZE; j++) {
+			for (int k = 0; k < 8; k++, indexOfData++) {
+				if (super->num_data <= indexOfData) {
+					return -1;
+				}
+				unsigned int const msk = (1 << k);
+				if (!(byteBuf[j] & msk)) {
+					byteBuf[j] |= msk;
+					disk->writeBlock((super->data_bitmap_addr + i), byteBuf);
+					return (super->data_region_addr + indexOfData);
+				}
+			}
+		}
+	}
+	return -1;
+}
+
+static void freeDataBlock(Disk *disk, super_t *super, int blockNumber) {
+	unsigned char byteBuf[UFS_BLOCK_SIZE];
+	int const indexOfBlock = ((blockNumber - super->data_region_addr) / (UFS_BLOCK_SIZE * 8));
+	int const offsetOfBlock = ((blockNumber - super->data_region_addr) % (UFS_BLOCK_SIZE * 8));
+	disk->readBlock((super->data_bitmap_addr + indexOfBlock), byteBuf);
+	byteBuf[(offsetOfBlock / 8)] &= ~(1 << (offsetOfBlock & 7));
+	disk->writeBlock((super->data_bitmap_addr + indexOfBlock), byteBuf);
+}
+
+static void writeInode(Disk *disk, super_t *super, int inodeNumber, inode_t *inode) {
+	inode_t inodeBuf[(UFS_BLOCK_SIZE / sizeof(inode_t))];
+	int const indexOfBlock = (inodeNumber / (UFS_BLOCK_SIZE / sizeof(inode_t)));
+	disk->readBlock((super->inode_region_addr + indexOfBlock), inodeBuf);
+	memcpy(&inodeBuf[(inodeNumber % (UFS_BLOCK_SIZE / sizeof(inode_t)))], inode, sizeof(inode_t));
+	disk->writeBlock((super->inode_region_addr + indexOfBlock), inodeBuf);
+}
+
+// Allocates the lowest numbered free inode and returns its number, or
+// -1 if there are no free inodes left.
+static int allocateInode(Disk *disk, super_t *super) {
+	unsigned char byteBuf[UFS_BLOCK_SIZE];
+	int inodeNumber = 0;
+	for (int i = 0; i < super->inode_bitmap_len; i++) {
+		disk->readBlock((super->inode_bitmap_addr + i), byteBuf);
+		for (int j = 0; j < UFS_BLOCK_SIZE; j++) {
+			for (int k = 0; k < 8; k++, inodeNumber++) {
+				if (super->num_inodes <= inodeNumber) {
+					return -1;
+				}
+				unsigned int const msk = (1 << k);
+				if (!(byteBuf[j] & msk)) {
+					byteBuf[j] |= msk;
+					disk->writeBlock((super->inode_bitmap_addr + i), byteBuf);
+					return inodeNumber;
+				}
+			}
+		}
+	}
+	return -1;
+}
+
+static void freeInode(Disk *disk, super_t *super, int inodeNumber) {
+	unsigned char byteBuf[UFS_BLOCK_SIZE];
+	int const indexOfBitmap = (inodeNumber / (UFS_BLOCK_SIZE * 8));
+	int const offsetOfBitmap = (inodeNumber % (UFS_BLOCK_SIZE * 8));
+	disk->readBlock((super->inode_bitmap_addr + indexOfBitmap), byteBuf);
+	byteBuf[(offsetOfBitmap / 8)] &= ~(1 << (offsetOfBitmap & 7));
+	disk->writeBlock((super->inode_bitmap_addr + indexOfBitmap), byteBuf);
+}
+
+int LocalFileSystem::write(int inodeNumber, const void *buffer, int size, int offset) {
+	Metrics::count(LFS_WRITES);
+	if (buffer == nullptr || size <= 0 || offset < 0) {
+		return -EINVALIDSIZE;
+	}
+
+	inode_t inode;
+	if (stat(inodeNumber, &inode)) {
+		return -EINVALIDINODE;
+	}
+
+	if (inode.type != UFS_REGULAR_FILE) {
+		return -EWRITETODIR;
+	}
+
+	// we don't support files with holes in them
+	if (inode.size < offset) {
+		return -EINVALIDSIZE;
+	}
+
+	if ((MAX_FILE_SIZE - offset) < size) {
+		return -ENOTENOUGHSPACE;
+	}
+
+	super_t super;
+	readSuperBlock(&super);
+
+	disk->beginTransaction();
+
+	int const end = offset + size;
+	int const numBlockNow = (inode.size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+	int const cntOfBlock = (end + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+	for (int x = numBlockNow; x < cntOfBlock; x++) {
+		int blockNumber = allocateDataBlock(disk, &super);
+		if (blockNumber < 0) {
+			disk->rollback();
+			return -ENOTENOUGHSPACE;
+		}
+		inode.direct[x] = blockNumber;
+	}
+
+	unsigned char byteBuf[UFS_BLOCK_SIZE];
+	const unsigned char *ptrBuf = (const unsigned char *) buffer;
+	for (int pos = offset; pos < end; ) {
+		int const x = pos / UFS_BLOCK_SIZE;
+		int const blockOffset = pos % UFS_BLOCK_SIZE;
+		int const copySize = min(UFS_BLOCK_SIZE - blockOffset, end - pos);
+		if (copySize == UFS_BLOCK_SIZE) {
+			memcpy(byteBuf, ptrBuf, UFS_BLOCK_SIZE);
+		} else if (x < numBlockNow) {
+			// keep the bytes of the block that we aren't writing
+			disk->readBlock((inode.direct[x]), byteBuf);
+			memcpy(byteBuf + blockOffset, ptrBuf, copySize);
+		} else {
+			memset(byteBuf, 0, UFS_BLOCK_SIZE);
+			memcpy(byteBuf + blockOffset, ptrBuf, copySize);
+		}
+		disk->writeBlock((inode.direct[x]), byteBuf);
+		ptrBuf += copySize;
+		pos += copySize;
+	}
+
+	if (inode.size < end) {
+		inode.size = end;
+		writeInode(disk, &super, inodeNumber, &inode);
+	}
+
+	disk->commit();
+	modified(inodeNumber);
+	return size;
+}
+
+int LocalFileSystem::truncate(int inodeNumber, int size) {
+	if (size < 0) {
+		return -EINVALIDSIZE;
+	}
+
+	inode_t inode;
+	if (stat(inodeNumber, &inode)) {
+		return -EINVALIDINODE;
+	}
+
+	if (inode.type != UFS_REGULAR_FILE) {
+		return -EWRITETODIR;
+	}
+
+	if (inode.size < size) {
+		return -EINVALIDSIZE;
+	}
+
+	if (inode.size == size) {
+		return 0;
+	}
+
+	super_t super;
+	readSuperBlock(&super);
+
+	disk->beginTransaction();
+
+	int const numBlockNow = (inode.size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+	int const cntOfBlock = (size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+	for (int x = cntOfBlock; x < numBlockNow; x++) {
+		freeDataBlock(disk, &super, inode.direct[x]);
+		inode.direct[x] = -1;
+	}
+
+	inode.size = size;
+	writeInode(disk, &super, inodeNumber, &inode);
+
+	disk->commit();
+	modified(inodeNumber);
+	return 0;
+}
+
+
+int LocalFileSystem::createUnlinked() {
+	super_t super;
+	readSuperBlock(&super);
+
+	disk->beginTransaction();
+	int inodeNumber = allocateInode(disk, &super);
+	if (inodeNumber < 0) {
+		disk->rollback();
+		return -ENOTENOUGHSPACE;
+	}
+
+	inode_t inode;
+	inode.type = UFS_REGULAR_FILE;
+	inode.size = 0;
+	for (int x = 0; x < DIRECT_PTRS; x++) {
+		inode.direct[x] = -1;
+	}
+	writeInode(disk, &super, inodeNumber, &inode);
+
+	disk->commit();
+	modified(inodeNumber);
+	return inodeNumber;
+}
+
+int LocalFileSystem::replace(int inodeNumber, int sourceInodeNumber) {
+	inode_t inode;
+	inode_t source;
+	if (stat(inodeNumber, &inode) || stat(sourceInodeNumber, &source) || inodeNumber == sourceInodeNumber) {
+		return -EINVALIDINODE;
+	}
+
+	if (inode.type != UFS_REGULAR_FILE || source.type != UFS_REGULAR_FILE) {
+		return -EWRITETODIR;
+	}
+
+	super_t super;
+	readSuperBlock(&super);
+
+	disk->beginTransaction();
+
+	int const numBlockNow = (inode.size + UFS_BLOCK_SIZE - 1) / UFS_BLOCK_SIZE;
+	for (int x = 0; x < numBlockNow; x++) {
+		freeDataBlock(disk, &super, inode.direct[x]);
+	}
+	writeInode(disk, &super, inodeNumber, &source);
+	freeInode(disk, &super, sourceInodeNumber);
+
+	disk->commit();
+	modified(inodeNumber);
+	modified(sourceInodeNumber);
+	return 0;
+}
+
+int LocalFileSystem::release(int inodeNumber) {
+	disk->beginTransaction();
+	int ret = truncate(inodeNumber, 0);
+	if (ret < 0) {
+		disk->rollback();
+		return ret;
+	}
+
+	super_t super;
+	readSuperBlock(&super);
+	freeInode(disk, &super, inodeNumber);
+
+	disk->commit();
+	modified(inodeNumber);
+	return 0;
+}
+
+
 int LocalFileSystem::unlink(int parentInodeNumber, string name) {
+  Metrics::count(LFS_UNLINKS);
   union {
     unsigned char byteBuf[UFS_BLOCK_SIZE];
     inode_t inodeBuf[(UFS_BLOCK_SIZE / sizeof(inode_t))];
@@ -914,6 +1200,8 @@ int LocalFileSystem::unlink(int parentInodeNumber, string name) {
 	disk->writeBlock((super.inode_bitmap_addr + indexOfBitmap), byteBuf);
 	
 	disk->commit();
+	modified(parentInodeNumber);
+	modified(inumNew);
   return 0;
 }
 
@@ -0,0 +1,321 @@
+#include <string.h>
+#include <time.h>
+
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "Metrics.h"
+
+using namespace std;
+
+// methods we count requests for, anything else counts as OTHER
+static const char *METHODS[] = {"HEAD", "GET", "PUT", "POST", "DELETE", "MOVE", "OTHER"};
+#define NUM_METHODS (sizeof(METHODS) / sizeof(METHODS[0]))
+#define NUM_STATUSES (600)
+
+// sub-buckets per power of two in the latency histograms
+#define SUB_BUCKET_BITS (3)
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+// enough buckets for latencies up to 2^40 microseconds
+#define NUM_BUCKETS ((40 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+
+static const char *COUNTER_NAMES[NUM_COUNTERS][2] = {
+  {"gunrock_received_bytes_total", "Request bytes read from clients."},
+  {"gunrock_sent_bytes_total", "Response bytes written to clients."},
+  {"gunrock_disk_blocks_read_total", "Blocks read from the disk image."},
+  {"gunrock_disk_blocks_written_total", "Blocks written to the disk image."},
+  {"gunrock_disk_syncs_total", "fsyncs of the disk image."},
+  {"gunrock_lfs_lookups_total", "Directory lookups in the file system."},
+  {"gunrock_lfs_reads_total", "File reads from the file system."},
+  {"gunrock_lfs_writes_total", "File writes to the file system."},
+  {"gunrock_lfs_creates_total", "Files and directories created."},
+  {"gunrock_lfs_unlinks_total", "Files and directories removed."},
+  {"gunrock_static_cache_hits_total", "Static files served from the cache."},
+  {"gunrock_static_cache_misses_total", "Static files loaded from disk."},
+  {"gunrock_worker_busy_seconds_total", "Time workers spent handling requests, divide its rate by gunrock_workers for utilization."},
+  {"gunrock_shed_total", "Requests turned away with a 503 because the server was overloaded."},
+  {"gunrock_replication_records_sent_total", "Writes applied by backups."},
+  {"gunrock_replication_failures_total", "Failed attempts to send writes to a backup."},
+  {"gunrock_replication_resync_blocks_total", "Disk blocks copied to backups that couldn't catch up from the log."},
+  {"gunrock_backend_requests_total", "Requests a gateway forwarded to storage nodes."},
+  {"gunrock_backend_connections_opened_total", "Connections a gateway opened to storage nodes, the rest of its requests reused one."},
+  {"gunrock_backend_failures_total", "Forwarded requests that got no answer from a storage node."},
+  {"gunrock_gateway_cache_hits_total", "Objects a gateway served from its cache without asking a storage node."},
+  {"gunrock_gateway_cache_misses_total", "Objects a gateway fetched because it didn't have them cached."},
+  {"gunrock_gateway_cache_revalidations_total", "Cached objects a gateway checked with their storage node because they went stale."},
+  {"gunrock_gateway_cache_coalesced_total", "Requests that waited for another request's fetch of the same object."},
+  {"gunrock_gateway_cache_rejected_total", "Objects kept out of the cache because they were wanted less than what they'd evict."},
+  {"gunrock_quorum_failures_total", "Reads and writes that too few replicas answered."},
+  {"gunrock_quorum_read_repairs_total", "Replicas brought up to date after a read found them behind."},
+  {"gunrock_rebalance_objects_moved_total", "Objects copied to the shard that owns them after the shards changed."},
+  {"gunrock_rebalance_bytes_moved_total", "Bytes of objects copied to the shard that owns them after the shards changed."},
+  {"gunrock_rebalance_fallback_reads_total", "Reads of moving entries that their new shard didn't have yet."},
+  {"gunrock_batch_operations_total", "Operations run as part of a batch posted to /ds3/."},
+};
+
+static const char *GAUGE_NAMES[NUM_GAUGES][2] = {
+  {"gunrock_queue_depth", "Connections accepted and waiting for a worker."},
+  {"gunrock_workers", "Threads handling requests."},
+  {"gunrock_inflight_bytes", "Request body bytes admitted and not yet handled."},
+  {"gunrock_replication_pending", "Writes waiting to be applied by the backup furthest behind."},
+  {"gunrock_backends_healthy", "Storage nodes a gateway currently sends requests to."},
+  {"gunrock_gateway_cache_bytes", "Memory used by a gateway's object cache."},
+  {"gunrock_rebalance_pending", "Top level entries still to be moved to the shard that owns them."},
+};
+
+// One thread's counts. Only the owning thread writes them, so plain
+// relaxed loads and stores are enough; readers may see a count that's a
+// moment old but never a torn one.
+struct MetricShard {
+  atomic<uint64_t> counters[NUM_COUNTERS];
+  atomic<uint64_t> requests[NUM_METHODS][NUM_STATUSES];
+  atomic<uint64_t> latency[NUM_METHODS][NUM_BUCKETS];
+  atomic<uint64_t> latencySum[NUM_METHODS];
+};
+
+// Moves every count in from into into and leaves from at zero. Only
+// safe while nothing else writes either of them.
+static void fold(MetricShard *from, MetricShard *into) {
+  for (int idx = 0; idx < NUM_COUNTERS; idx++) {
+    into->counters[idx].store(into->counters[idx].load() + from->counters[idx].exchange(0));
+  }
+  for (size_t method = 0; method < NUM_METHODS; method++) {
+    for (int idx = 0; idx < NUM_STATUSES; idx++) {
+      into->requests[method][idx].store(into->requests[method][idx].load() +
+                                        from->requests[method][idx].exchange(0));
+    }
+    for (int idx = 0; idx < NUM_BUCKETS; idx++) {
+      into->latency[method][idx].store(into->latency[method][idx].load() +
+                                       from->latency[method][idx].exchange(0));
+    }
+    into->latencySum[method].store(into->latencySum[method].load() + from->latencySum[method].exchange(0));
+  }
+}
+
+// shards of live threads and, all zero, the free ones waiting for a new
+// thread, along with what the threads that have exited counted
+static mutex shardsLock;
+static vector<MetricShard *> shards;
+static vector<MetricShard *> freeShards;
+static MetricShard retired;
+static atomic<int64_t> gauges[NUM_GAUGES];
+
+// Gives a thread's counts to retired when the thread exits and its shard
+// to the next thread to start, so threads that come and go don't leave a
+// shard behind each.
+struct ShardLease {
+  MetricShard *shard = NULL;
+
+  ~ShardLease() {
+    if (shard != NULL) {
+      lock_guard<mutex> guard(shardsLock);
+      fold(shard, &retired);
+      freeShards.push_back(shard);
+    }
+  }
+};
+
+static MetricShard *threadShard() {
+  static thread_local ShardLease lease;
+  if (lease.shard == NULL) {
+    lock_guard<mutex> guard(shardsLock);
+    if (freeShards.size() > 0) {
+      lease.shard = freeShards.back();
+      freeShards.pop_back();
+      return lease.shard;
+    }
+    MetricShard *shard = new MetricShard();
+    for (int idx = 0; idx < NUM_COUNTERS; idx++) {
+      shard->counters[idx].store(0);
+    }
+    for (size_t method = 0; method < NUM_METHODS; method++) {
+      for (int idx = 0; idx < NUM_STATUSES; idx++) {
+        shard->requests[method][idx].store(0);
+      }
+      for (int idx = 0; idx < NUM_BUCKETS; idx++) {
+        shard->latency[method][idx].store(0);
+      }
+      shard->latencySum[method].store(0);
+    }
+    shards.push_back(shard);
+    lease.shard = shard;
+  }
+  return lease.shard;
+}
+
+static void add(atomic<uint64_t> &value, uint64_t amount) {
+  value.store(value.load(memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+static int bucketFor(uint64_t usec) {
+  if (usec < SUB_BUCKETS) {
+    return usec;
+  }
+  int log2 = 63 - __builtin_clzll(usec);
+  int bucket = (log2 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS +
+    ((usec >> (log2 - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+  return bucket < NUM_BUCKETS ? bucket : NUM_BUCKETS - 1;
+}
+
+// The largest latency that falls in bucket.
+static uint64_t bucketLimit(int bucket) {
+  if (bucket < SUB_BUCKETS) {
+    return bucket;
+  }
+  int log2 = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+  uint64_t sub = bucket % SUB_BUCKETS;
+  return ((SUB_BUCKETS + sub + 1) << (log2 - SUB_BUCKET_BITS)) - 1;
+}
+
+void Metrics::count(MetricCounter counter, uint64_t amount) {
+  add(threadShard()->counters[counter], amount);
+}
+
+void Metrics::setGauge(MetricGauge gauge, int64_t value) {
+  gauges[gauge].store(value);
+}
+
+void Metrics::addGauge(MetricGauge gauge, int64_t amount) {
+  gauges[gauge].fetch_add(amount);
+}
+
+int64_t Metrics::gauge(MetricGauge gauge) {
+  return gauges[gauge].load();
+}
+
+void Metrics::recordRequest(const char *method, int status, uint64_t latencyUsec) {
+  size_t methodIndex = 0;
+  while (methodIndex < NUM_METHODS - 1 && strcmp(method, METHODS[methodIndex]) != 0) {
+    methodIndex++;
+  }
+  if (status < 0 || status >= NUM_STATUSES) {
+    status = 0;
+  }
+
+  MetricShard *shard = threadShard();
+  add(shard->requests[methodIndex][status], 1);
+  add(shard->latency[methodIndex][bucketFor(latencyUsec)], 1);
+  add(shard->latencySum[methodIndex], latencyUsec);
+}
+
+uint64_t Metrics::nowUsec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Renders every metric in the Prometheus text exposition format. Latency
+ * histograms are exported with a bucket per power of two, and the
+ * quantiles the finer buckets give us are exported alongside them.
+ */
+string Metrics::render() {
+  // add up the shards
+  uint64_t counters[NUM_COUNTERS] = {0};
+  vector<vector<uint64_t> > requests(NUM_METHODS, vector<uint64_t>(NUM_STATUSES));
+  vector<vector<uint64_t> > latency(NUM_METHODS, vector<uint64_t>(NUM_BUCKETS));
+  vector<uint64_t> latencySum(NUM_METHODS);
+  {
+    lock_guard<mutex> guard(shardsLock);
+    for (size_t idx = 0; idx <= shards.size(); idx++) {
+      MetricShard *shard = idx < shards.size() ? shards[idx] : &retired;
+      for (int counter = 0; counter < NUM_COUNTERS; counter++) {
+        counters[counter] += shard->counters[counter].load(memory_order_relaxed);
+      }
+      for (size_t method = 0; method < NUM_METHODS; method++) {
+        for (int status = 0; status < NUM_STATUSES; status++) {
+          requests[method][status] += shard->requests[method][status].load(memory_order_relaxed);
+        }
+        for (int bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+          latency[method][bucket] += shard->latency[method][bucket].load(memory_order_relaxed);
+        }
+        latencySum[method] += shard->latencySum[method].load(memory_order_relaxed);
+      }
+    }
+  }
+
+  stringstream ss;
+  ss.precision(12);
+  ss << "# HELP gunrock_requests_total Requests handled, by method and status.\n";
+  ss << "# TYPE gunrock_requests_total counter\n";
+  for (size_t method = 0; method < NUM_METHODS; method++) {
+    for (int status = 0; status < NUM_STATUSES; status++) {
+      if (requests[method][status] > 0) {
+        ss << "gunrock_requests_total{method=\"" << METHODS[method] << "\",status=\""
+           << status << "\"} " << requests[method][status] << "\n";
+      }
+    }
+  }
+
+  ss << "# HELP gunrock_request_duration_seconds Time from reading a request to sending its response.\n";
+  ss << "# TYPE gunrock_request_duration_seconds histogram\n";
+  for (size_t method = 0; method < NUM_METHODS; method++) {
+    uint64_t count = 0;
+    for (int bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+      count += latency[method][bucket];
+    }
+    if (count == 0) {
+      continue;
+    }
+
+    uint64_t cumulative = 0;
+    int bucket = 0;
+    // powers of two from 1us to 2^26us (about a minute)
+    for (int log2 = 0; log2 <= 26; log2++) {
+      uint64_t limit = ((uint64_t) 1 << log2) - 1;
+      while (bucket < NUM_BUCKETS && bucketLimit(bucket) <= limit) {
+        cumulative += latency[method][bucket++];
+      }
+      ss << "gunrock_request_duration_seconds_bucket{method=\"" << METHODS[method]
+         << "\",le=\"" << (double) (limit + 1) / 1e6 << "\"} " << cumulative << "\n";
+    }
+    ss << "gunrock_request_duration_seconds_bucket{method=\"" << METHODS[method]
+       << "\",le=\"+Inf\"} " << count << "\n";
+    ss << "gunrock_request_duration_seconds_sum{method=\"" << METHODS[method] << "\"} "
+       << (double) latencySum[method] / 1e6 << "\n";
+    ss << "gunrock_request_duration_seconds_count{method=\"" << METHODS[method] << "\"} "
+       << count << "\n";
+  }
+
+  ss << "# HELP gunrock_request_duration_quantile_seconds Request latency quantiles from the HDR histograms.\n";
+  ss << "# TYPE gunrock_request_duration_quantile_seconds gauge\n";
+  static const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+  for (size_t method = 0; method < NUM_METHODS; method++) {
+    uint64_t count = 0;
+    for (int bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+      count += latency[method][bucket];
+    }
+    if (count == 0) {
+      continue;
+    }
+    for (size_t idx = 0; idx < sizeof(QUANTILES) / sizeof(QUANTILES[0]); idx++) {
+      uint64_t rank = (uint64_t) (QUANTILES[idx] * count);
+      uint64_t seen = 0;
+      int bucket = 0;
+      while (bucket < NUM_BUCKETS - 1 && (seen += latency[method][bucket]) <= rank) {
+        bucket++;
+      }
+      ss << "gunrock_request_duration_quantile_seconds{method=\"" << METHODS[method]
+         << "\",quantile=\"" << QUANTILES[idx] << "\"} "
+         << (double) bucketLimit(bucket) / 1e6 << "\n";
+    }
+  }
+
+  for (int counter = 0; counter < NUM_COUNTERS; counter++) {
+    ss << "# HELP " << COUNTER_NAMES[counter][0] << " " << COUNTER_NAMES[counter][1] << "\n";
+    ss << "# TYPE " << COUNTER_NAMES[counter][0] << " counter\n";
+    if (counter == WORKER_BUSY_USEC) {
+      ss << COUNTER_NAMES[counter][0] << " " << (double) counters[counter] / 1e6 << "\n";
+    } else {
+      ss << COUNTER_NAMES[counter][0] << " " << counters[counter] << "\n";
+    }
+  }
+
+  for (int gauge = 0; gauge < NUM_GAUGES; gauge++) {
+    ss << "# HELP " << GAUGE_NAMES[gauge][0] << " " << GAUGE_NAMES[gauge][1] << "\n";
+    ss << "# TYPE " << GAUGE_NAMES[gauge][0] << " gauge\n";
+    ss << GAUGE_NAMES[gauge][0] << " " << gauges[gauge].load() << "\n";
+  }
+  return ss.str();
+}
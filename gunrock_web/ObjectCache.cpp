@@ -0,0 +1,191 @@
+#include <algorithm>
+
+#include "HashRing.h"
+#include "Metrics.h"
+#include "ObjectCache.h"
+#include "dthread.h"
+
+using namespace std;
+
+// rows in the sketch, each key counts in one counter per row
+#define SKETCH_DEPTH (4)
+// counters in each row, a power of two
+#define SKETCH_WIDTH (1 << 14)
+// counters stop going up here
+#define SKETCH_MAX_COUNT (15)
+// objects bigger than this share of the cache aren't worth what they'd evict
+#define MAX_OBJECT_SHARE (8)
+
+size_t CachedObject::memoryUsed() const {
+  size_t bytes = sizeof(*this) + etag.size() + contentType.size() + body->size();
+  map<string, string>::const_iterator iter;
+  for (iter = headers.begin(); iter != headers.end(); iter++) {
+    bytes += iter->first.size() + iter->second.size();
+  }
+  return bytes;
+}
+
+FrequencySketch::FrequencySketch(int width) {
+  m_width = width;
+  m_samples = 0;
+  m_counters.resize(m_width * SKETCH_DEPTH);
+}
+
+// Picks a counter in each row from two halves of one hash.
+void FrequencySketch::index(const string &key, size_t *slots) {
+  uint64_t hash = HashRing::hash(key);
+  uint64_t step = (hash >> 32) | 1;
+  for (int row = 0; row < SKETCH_DEPTH; row++) {
+    slots[row] = row * m_width + ((hash + row * step) & (m_width - 1));
+  }
+}
+
+void FrequencySketch::record(const string &key) {
+  size_t slots[SKETCH_DEPTH];
+  this->index(key, slots);
+  for (int row = 0; row < SKETCH_DEPTH; row++) {
+    if (m_counters[slots[row]] < SKETCH_MAX_COUNT) {
+      m_counters[slots[row]]++;
+    }
+  }
+  if (++m_samples >= m_width * 10) {
+    this->age();
+  }
+}
+
+// Other keys only ever add to a key's counters, so the smallest is the
+// closest to its own count.
+int FrequencySketch::estimate(const string &key) {
+  size_t slots[SKETCH_DEPTH];
+  this->index(key, slots);
+  int count = SKETCH_MAX_COUNT;
+  for (int row = 0; row < SKETCH_DEPTH; row++) {
+    count = min(count, (int) m_counters[slots[row]]);
+  }
+  return count;
+}
+
+void FrequencySketch::age() {
+  for (size_t idx = 0; idx < m_counters.size(); idx++) {
+    m_counters[idx] /= 2;
+  }
+  m_samples /= 2;
+}
+
+ObjectCache::ObjectCache(size_t maxBytes, uint64_t freshUsec) : m_sketch(SKETCH_WIDTH) {
+  m_maxBytes = maxBytes;
+  m_bytes = 0;
+  m_freshUsec = freshUsec;
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_filled, NULL);
+}
+
+bool ObjectCache::lookup(const string &key, shared_ptr<CachedObject> *object) {
+  dthread_mutex_lock(&m_lock);
+  m_sketch.record(key);
+
+  map<string, shared_ptr<Fill> >::iterator filling = m_fills.find(key);
+  if (filling != m_fills.end()) {
+    shared_ptr<Fill> fill = filling->second;
+    while (!fill->done) {
+      dthread_cond_wait(&m_filled, &m_lock);
+    }
+    *object = fill->invalidated ? shared_ptr<CachedObject>() : fill->object;
+    dthread_mutex_unlock(&m_lock);
+    Metrics::count(GATEWAY_CACHE_COALESCED);
+    return false;
+  }
+
+  object->reset();
+  map<string, Entry>::iterator iter = m_entries.find(key);
+  if (iter != m_entries.end()) {
+    m_lru.splice(m_lru.begin(), m_lru, iter->second.lru);
+    *object = iter->second.object;
+    if (Metrics::nowUsec() - (*object)->validatedUsec < m_freshUsec) {
+      dthread_mutex_unlock(&m_lock);
+      Metrics::count(GATEWAY_CACHE_HITS);
+      return false;
+    }
+  }
+
+  shared_ptr<Fill> fill = make_shared<Fill>();
+  fill->done = false;
+  fill->invalidated = false;
+  m_fills[key] = fill;
+  dthread_mutex_unlock(&m_lock);
+  Metrics::count(*object ? GATEWAY_CACHE_REVALIDATIONS : GATEWAY_CACHE_MISSES);
+  return true;
+}
+
+void ObjectCache::fill(const string &key, shared_ptr<CachedObject> object) {
+  dthread_mutex_lock(&m_lock);
+  map<string, shared_ptr<Fill> >::iterator filling = m_fills.find(key);
+  shared_ptr<Fill> fill = filling->second;
+  m_fills.erase(filling);
+  fill->done = true;
+  fill->object = object;
+
+  if (!fill->invalidated) {
+    map<string, Entry>::iterator iter = m_entries.find(key);
+    if (!object) {
+      // whatever we had is gone or can't be cached any more
+      if (iter != m_entries.end()) {
+        this->erase(iter);
+      }
+    } else if (iter == m_entries.end() || iter->second.object != object) {
+      this->insert(key, object);
+    }
+  }
+  dthread_cond_broadcast(&m_filled);
+  dthread_mutex_unlock(&m_lock);
+}
+
+void ObjectCache::invalidate(const string &prefix) {
+  dthread_mutex_lock(&m_lock);
+  map<string, Entry>::iterator iter = m_entries.lower_bound(prefix);
+  while (iter != m_entries.end() && iter->first.compare(0, prefix.size(), prefix) == 0) {
+    this->erase(iter++);
+  }
+
+  map<string, shared_ptr<Fill> >::iterator filling = m_fills.lower_bound(prefix);
+  for (; filling != m_fills.end() && filling->first.compare(0, prefix.size(), prefix) == 0; filling++) {
+    filling->second->invalidated = true;
+  }
+  dthread_mutex_unlock(&m_lock);
+}
+
+// Adds object under key with m_lock held, if it's wanted more than what
+// it would evict.
+void ObjectCache::insert(const string &key, shared_ptr<CachedObject> object) {
+  map<string, Entry>::iterator iter = m_entries.find(key);
+  if (iter != m_entries.end()) {
+    this->erase(iter);
+  }
+
+  size_t bytes = object->memoryUsed();
+  if (bytes > m_maxBytes / MAX_OBJECT_SHARE) {
+    return;
+  }
+  if (m_bytes + bytes > m_maxBytes && !m_lru.empty() &&
+      m_sketch.estimate(key) <= m_sketch.estimate(m_lru.back())) {
+    Metrics::count(GATEWAY_CACHE_REJECTED);
+    return;
+  }
+  while (m_bytes + bytes > m_maxBytes && !m_lru.empty()) {
+    this->erase(m_entries.find(m_lru.back()));
+  }
+
+  m_lru.push_front(key);
+  Entry &entry = m_entries[key];
+  entry.object = object;
+  entry.lru = m_lru.begin();
+  m_bytes += bytes;
+  Metrics::setGauge(GATEWAY_CACHE_BYTES, m_bytes);
+}
+
+void ObjectCache::erase(map<string, Entry>::iterator iter) {
+  m_bytes -= iter->second.object->memoryUsed();
+  m_lru.erase(iter->second.lru);
+  m_entries.erase(iter);
+  Metrics::setGauge(GATEWAY_CACHE_BYTES, m_bytes);
+}
@@ -0,0 +1,125 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+
+#include "ObjectVersions.h"
+#include "dthread.h"
+
+using namespace std;
+
+ObjectVersion::ObjectVersion() {
+  clock = 0;
+}
+
+string ObjectVersion::str() const {
+  return to_string(clock) + "@" + writer;
+}
+
+bool ObjectVersion::parse(string_view text, ObjectVersion *version) {
+  size_t at = text.find('@');
+  if (at == string_view::npos || at == 0) {
+    return false;
+  }
+  string clock(text.substr(0, at));
+  char *end;
+  version->clock = strtoull(clock.c_str(), &end, 10);
+  version->writer = text.substr(at + 1);
+  return *end == '\0' && version->clock > 0;
+}
+
+bool ObjectVersion::operator<(const ObjectVersion &other) const {
+  if (clock != other.clock) {
+    return clock < other.clock;
+  }
+  return writer < other.writer;
+}
+
+ObjectVersions::ObjectVersions(string journalFile) {
+  pthread_mutex_init(&m_lock, NULL);
+  m_journalFile = journalFile;
+  m_journal = -1;
+  this->load();
+}
+
+ObjectVersion ObjectVersions::get(string path, bool *deleted) {
+  dthread_mutex_lock(&m_lock);
+  map<string, Entry>::iterator iter = m_entries.find(path);
+  ObjectVersion version;
+  *deleted = false;
+  if (iter != m_entries.end()) {
+    version = iter->second.version;
+    *deleted = iter->second.deleted;
+  }
+  dthread_mutex_unlock(&m_lock);
+  return version;
+}
+
+void ObjectVersions::set(string path, const ObjectVersion &version, bool deleted) {
+  dthread_mutex_lock(&m_lock);
+  Entry &entry = m_entries[path];
+  entry.version = version;
+  entry.deleted = deleted;
+  this->append(string(deleted ? "D " : "P ") + version.str() + " " + path + "\n");
+  dthread_mutex_unlock(&m_lock);
+}
+
+// Reads the journal, where later lines for a path replace earlier ones,
+// and writes it back out with just the last line for each.
+void ObjectVersions::load() {
+  ifstream in(m_journalFile.c_str());
+  if (!in) {
+    // nothing has been written through a quorum gateway yet
+    return;
+  }
+
+  string line;
+  while (getline(in, line)) {
+    size_t space = line.find(' ', 2);
+    Entry entry;
+    if (in.eof() || line.size() < 2 || (line[0] != 'P' && line[0] != 'D') || space == string::npos ||
+        !ObjectVersion::parse(string_view(line).substr(2, space - 2), &entry.version)) {
+      // the tail of a line we were writing when we stopped
+      continue;
+    }
+    entry.deleted = line[0] == 'D';
+    m_entries[line.substr(space + 1)] = entry;
+  }
+  in.close();
+
+  string contents;
+  map<string, Entry>::iterator iter;
+  for (iter = m_entries.begin(); iter != m_entries.end(); iter++) {
+    contents += string(iter->second.deleted ? "D " : "P ") + iter->second.version.str() + " " +
+                iter->first + "\n";
+  }
+  string compacted = m_journalFile + ".tmp";
+  m_journal = open(compacted.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (m_journal >= 0 && contents.size() > 0) {
+    this->append(contents);
+  }
+  if (m_journal < 0 || rename(compacted.c_str(), m_journalFile.c_str()) != 0) {
+    cerr << "could not compact " << m_journalFile << endl;
+    exit(1);
+  }
+}
+
+// Adds line to the journal and waits for it to reach the disk, like the
+// disk image's own writes do.
+void ObjectVersions::append(const string &line) {
+  if (m_journal < 0) {
+    m_journal = open(m_journalFile.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (m_journal < 0) {
+      cerr << "could not open " << m_journalFile << endl;
+      exit(1);
+    }
+  }
+  if (write(m_journal, line.data(), line.size()) != (ssize_t) line.size()) {
+    cerr << "could not write " << m_journalFile << endl;
+    exit(1);
+  }
+  fsync(m_journal);
+}
@@ -0,0 +1,230 @@
+#include <deque>
+
+#include "Metrics.h"
+#include "QuorumCall.h"
+#include "dthread.h"
+
+using namespace std;
+
+// the threads every call's sends and repairs run on
+#define QUORUM_WORKERS (32)
+
+// A replica to send a call's request to, or a call to repair.
+struct QuorumTask {
+  QuorumCall *call;
+  size_t index;
+  bool repair;
+};
+
+static pthread_once_t workersStarted = PTHREAD_ONCE_INIT;
+static pthread_mutex_t tasksLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tasksChanged = PTHREAD_COND_INITIALIZER;
+static deque<QuorumTask> tasks;
+
+QuorumCall::QuorumCall(BackendPool *pool, string method, string url, map<string, string> headers,
+                       string body, bool readRepair) {
+  m_pool = pool;
+  m_method = method;
+  m_url = url;
+  m_headers = headers;
+  m_body = body;
+  m_readRepair = readRepair;
+  m_answered = 0;
+  m_running = 0;
+  m_references = 1;
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_changed, NULL);
+}
+
+QuorumReply *QuorumCall::run(const vector<Backend *> &replicas, int needed) {
+  m_replies.resize(replicas.size());
+  for (size_t idx = 0; idx < replicas.size(); idx++) {
+    m_replies[idx].backend = replicas[idx];
+    m_replies[idx].response = NULL;
+  }
+
+  dthread_mutex_lock(&m_lock);
+  m_running = replicas.size();
+  m_references += replicas.size();
+  dthread_mutex_unlock(&m_lock);
+
+  for (size_t idx = 0; idx < replicas.size(); idx++) {
+    enqueue(this, idx, false);
+  }
+
+  dthread_mutex_lock(&m_lock);
+  while (m_answered < needed && m_answered + m_running >= needed) {
+    dthread_cond_wait(&m_changed, &m_lock);
+  }
+  QuorumReply *reply = m_answered >= needed ? this->newest() : NULL;
+  dthread_mutex_unlock(&m_lock);
+  return reply;
+}
+
+void QuorumCall::release() {
+  this->unreference();
+}
+
+void QuorumCall::enqueue(QuorumCall *call, size_t index, bool repair) {
+  pthread_once(&workersStarted, startWorkers);
+  QuorumTask task;
+  task.call = call;
+  task.index = index;
+  task.repair = repair;
+  dthread_mutex_lock(&tasksLock);
+  tasks.push_back(task);
+  dthread_cond_signal(&tasksChanged);
+  dthread_mutex_unlock(&tasksLock);
+}
+
+void QuorumCall::startWorkers() {
+  for (int idx = 0; idx < QUORUM_WORKERS; idx++) {
+    pthread_t thread;
+    dthread_create(&thread, NULL, workLoop, NULL);
+    dthread_detach(thread);
+  }
+}
+
+void *QuorumCall::workLoop(void * /*arg*/) {
+  while (true) {
+    dthread_mutex_lock(&tasksLock);
+    while (tasks.empty()) {
+      dthread_cond_wait(&tasksChanged, &tasksLock);
+    }
+    QuorumTask task = tasks.front();
+    tasks.pop_front();
+    dthread_mutex_unlock(&tasksLock);
+
+    if (task.repair) {
+      task.call->repairAndFinish();
+    } else {
+      task.call->sendOne(task.index);
+    }
+  }
+  return NULL;
+}
+
+// Reads can be answered with any response the replica meant, like a 404,
+// but a write only counts once a replica has stored it.
+void QuorumCall::sendOne(size_t index) {
+  QuorumReply *reply = &this->m_replies[index];
+
+  HTTPClientResponse *response = NULL;
+  try {
+    response = this->m_pool->send(reply->backend, this->m_method, this->m_url, this->m_headers, this->m_body);
+  } catch (...) {
+    // the replica is down, response is still NULL
+  }
+  bool isRead = this->m_method == "GET" || this->m_method == "HEAD";
+  if (response != NULL && (isRead ? response->status() >= 500 : !response->success())) {
+    delete response;
+    response = NULL;
+  }
+  ObjectVersion version;
+  if (response != NULL && !ObjectVersion::parse(response->header("X-Ds3-Version"), &version)) {
+    version = ObjectVersion();
+  }
+
+  dthread_mutex_lock(&this->m_lock);
+  reply->response = response;
+  reply->version = version;
+  if (response != NULL) {
+    this->m_answered++;
+  }
+  this->m_running--;
+  dthread_cond_broadcast(&this->m_changed);
+  dthread_mutex_unlock(&this->m_lock);
+
+  this->unreference();
+}
+
+// The answer with the highest version, with m_lock held. Between equal
+// versions an object beats its absence, which only matters for objects
+// written before there were versions.
+QuorumReply *QuorumCall::newest() {
+  QuorumReply *best = NULL;
+  for (size_t idx = 0; idx < m_replies.size(); idx++) {
+    QuorumReply *reply = &m_replies[idx];
+    if (reply->response == NULL) {
+      continue;
+    }
+    if (best == NULL || best->version < reply->version ||
+        (!(reply->version < best->version) && best->response->status() == 404 &&
+         reply->response->status() != 404)) {
+      best = reply;
+    }
+  }
+  return best;
+}
+
+// The answer to repair the others with, if it's a file's contents or a
+// delete, and any replica that answered has an older version. Only used
+// once every replica is done, so nothing else touches the replies.
+QuorumReply *QuorumCall::repairSource() {
+  QuorumReply *best = this->newest();
+  if (best == NULL || best->version.empty()) {
+    return NULL;
+  }
+  if (best->response->status() != 404 &&
+      (best->response->status() != 200 || best->response->header("X-Ds3-Type") != "file")) {
+    return NULL;
+  }
+  for (size_t idx = 0; idx < m_replies.size(); idx++) {
+    if (m_replies[idx].response != NULL && m_replies[idx].version < best->version) {
+      return best;
+    }
+  }
+  return NULL;
+}
+
+// Brings the replicas that answered with an older version up to the
+// newest one.
+void QuorumCall::repair(QuorumReply *source) {
+  bool deleted = source->response->status() == 404;
+  map<string, string> headers;
+  headers["X-Ds3-Version"] = source->version.str();
+  for (size_t idx = 0; idx < m_replies.size(); idx++) {
+    QuorumReply *reply = &m_replies[idx];
+    if (reply->response == NULL || !(reply->version < source->version)) {
+      continue;
+    }
+    try {
+      delete m_pool->send(reply->backend, deleted ? "DELETE" : "PUT", m_url, headers,
+                          deleted ? "" : source->response->body());
+      Metrics::count(QUORUM_READ_REPAIRS);
+    } catch (...) {
+      // the next read will try again
+    }
+  }
+}
+
+// Repairs on a worker, so whoever let go of the call last, possibly the
+// request that made it, doesn't wait for it.
+void QuorumCall::repairAndFinish() {
+  this->repair(this->repairSource());
+  this->finish();
+}
+
+void QuorumCall::unreference() {
+  dthread_mutex_lock(&m_lock);
+  bool last = --m_references == 0;
+  dthread_mutex_unlock(&m_lock);
+  if (!last) {
+    return;
+  }
+
+  if (m_readRepair && this->repairSource() != NULL) {
+    enqueue(this, 0, true);
+    return;
+  }
+  this->finish();
+}
+
+void QuorumCall::finish() {
+  for (size_t idx = 0; idx < m_replies.size(); idx++) {
+    delete m_replies[idx].response;
+  }
+  pthread_mutex_destroy(&m_lock);
+  pthread_cond_destroy(&m_changed);
+  delete this;
+}
@@ -0,0 +1,49 @@
+#include <map>
+#include <string>
+
+#include "ClientError.h"
+#include "RebalanceService.h"
+
+using namespace std;
+using namespace std::placeholders;
+
+RebalanceService::RebalanceService(ShardService *shards) {
+  m_shards = shards;
+}
+
+void RebalanceService::addRoutes(Router *router) {
+  router->addRoute("GET", "/rebalance", bind(&RebalanceService::status, this, _1, _2));
+  router->addRoute("POST", "/rebalance", bind(&RebalanceService::post, this, _1, _2));
+  router->addRoute("PUT", "/rebalance/shards/:shard", bind(&RebalanceService::addShard, this, _1, _2));
+  router->addRoute("DELETE", "/rebalance/shards/:shard", bind(&RebalanceService::removeShard, this, _1, _2));
+}
+
+void RebalanceService::status(HTTPRequest *request, HTTPResponse *response) {
+  response->setContentType("text/plain");
+  response->setBody(m_shards->rebalanceStatus());
+}
+
+void RebalanceService::post(HTTPRequest *request, HTTPResponse *response) {
+  map<string, string> params = request->getParams();
+  if (params.size() != 1) {
+    throw ClientError::badRequest();
+  }
+  if (params.count("add") > 0) {
+    m_shards->addShard(params["add"]);
+  } else if (params.count("remove") > 0) {
+    m_shards->removeShard(params["remove"]);
+  } else {
+    throw ClientError::badRequest();
+  }
+  this->status(request, response);
+}
+
+void RebalanceService::addShard(HTTPRequest *request, HTTPResponse *response) {
+  m_shards->addShard(request->getPathParam("shard"));
+  this->status(request, response);
+}
+
+void RebalanceService::removeShard(HTTPRequest *request, HTTPResponse *response) {
+  m_shards->removeShard(request->getPathParam("shard"));
+  this->status(request, response);
+}
@@ -0,0 +1,346 @@
+#include <unistd.h>
+
+#include <iostream>
+#include <sstream>
+
+#include "HTTPClientResponse.h"
+#include "HttpUtils.h"
+#include "Metrics.h"
+#include "Rebalancer.h"
+#include "dthread.h"
+
+using namespace std;
+
+// how long we wait before trying a node we couldn't reach again
+#define RETRY_SECONDS (1)
+
+Rebalancer::Rebalancer(BackendPool *pool, uint64_t bytesPerSecond) {
+  m_pool = pool;
+  m_bytesPerSecond = bytesPerSecond;
+  m_running = false;
+  m_entries = 0;
+  m_objects = 0;
+  m_bytes = 0;
+  m_nextWrite = 0;
+  m_firstNewWrite = 0;
+  m_throttleStartUsec = 0;
+  m_throttleBytes = 0;
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_changed, NULL);
+}
+
+bool Rebalancer::start(HashRing oldRing, HashRing newRing, map<string, vector<Backend *> > shards) {
+  dthread_mutex_lock(&m_lock);
+  if (m_running) {
+    dthread_mutex_unlock(&m_lock);
+    return false;
+  }
+  m_running = true;
+  m_oldRing = oldRing;
+  m_newRing = newRing;
+  m_shards = shards;
+  m_moved.clear();
+  m_firstNewWrite = m_nextWrite;
+  m_entries = 0;
+  m_objects = 0;
+  m_bytes = 0;
+  dthread_mutex_unlock(&m_lock);
+
+  pthread_t thread;
+  dthread_create(&thread, NULL, moveLoop, this);
+  dthread_detach(thread);
+  return true;
+}
+
+bool Rebalancer::running() {
+  dthread_mutex_lock(&m_lock);
+  bool running = m_running;
+  dthread_mutex_unlock(&m_lock);
+  return running;
+}
+
+vector<Backend *> Rebalancer::source(string name) {
+  vector<Backend *> group;
+  dthread_mutex_lock(&m_lock);
+  if (m_running && m_moved.count(name) == 0) {
+    string from = m_oldRing.owner(name);
+    if (from != m_newRing.owner(name)) {
+      group = m_shards[from];
+    }
+  }
+  dthread_mutex_unlock(&m_lock);
+  return group;
+}
+
+vector<vector<Backend *> > Rebalancer::sources() {
+  vector<vector<Backend *> > groups;
+  dthread_mutex_lock(&m_lock);
+  if (m_running) {
+    vector<string> nodes = m_oldRing.nodes();
+    for (size_t idx = 0; idx < nodes.size(); idx++) {
+      if (!m_newRing.hasNode(nodes[idx])) {
+        groups.push_back(m_shards[nodes[idx]]);
+      }
+    }
+  }
+  dthread_mutex_unlock(&m_lock);
+  return groups;
+}
+
+uint64_t Rebalancer::beginWrite(string name) {
+  dthread_mutex_lock(&m_lock);
+  while (m_copying == name) {
+    dthread_cond_wait(&m_changed, &m_lock);
+  }
+  m_writers[name]++;
+  uint64_t write = m_nextWrite++;
+  m_writesInFlight.insert(write);
+  dthread_mutex_unlock(&m_lock);
+  return write;
+}
+
+void Rebalancer::endWrite(string name, uint64_t write) {
+  dthread_mutex_lock(&m_lock);
+  if (--m_writers[name] == 0) {
+    m_writers.erase(name);
+  }
+  m_writesInFlight.erase(write);
+  dthread_cond_broadcast(&m_changed);
+  dthread_mutex_unlock(&m_lock);
+}
+
+string Rebalancer::status() {
+  dthread_mutex_lock(&m_lock);
+  stringstream ss;
+  ss << "running " << (m_running ? 1 : 0) << endl
+     << "entries_moved " << m_moved.size() << endl
+     << "entries_total " << m_entries << endl
+     << "objects_copied " << m_objects << endl
+     << "bytes_copied " << m_bytes << endl;
+  dthread_mutex_unlock(&m_lock);
+  return ss.str();
+}
+
+// Finds the entries to move, then moves them one at a time, coming back
+// to any we couldn't move until they're all done.
+void *Rebalancer::moveLoop(void *arg) {
+  Rebalancer *rebalancer = (Rebalancer *) arg;
+  rebalancer->waitForEarlierWrites();
+  vector<string> names;
+  while (!rebalancer->findMoves(&names)) {
+    sleep(RETRY_SECONDS);
+  }
+
+  dthread_mutex_lock(&rebalancer->m_lock);
+  rebalancer->m_entries = names.size();
+  dthread_mutex_unlock(&rebalancer->m_lock);
+  Metrics::setGauge(REBALANCE_PENDING, names.size());
+  rebalancer->m_throttleStartUsec = Metrics::nowUsec();
+  rebalancer->m_throttleBytes = 0;
+
+  size_t next = 0;
+  while (names.size() > 0) {
+    next %= names.size();
+    if (rebalancer->move(names[next])) {
+      names.erase(names.begin() + next);
+      Metrics::setGauge(REBALANCE_PENDING, names.size());
+    } else {
+      next++;
+      sleep(RETRY_SECONDS);
+    }
+  }
+
+  dthread_mutex_lock(&rebalancer->m_lock);
+  rebalancer->m_running = false;
+  dthread_cond_broadcast(&rebalancer->m_changed);
+  dthread_mutex_unlock(&rebalancer->m_lock);
+  cerr << "rebalance done, moved " << rebalancer->m_entries << " entries" << endl;
+  return NULL;
+}
+
+// Waits for the writes that began before the ring changed, which may
+// have gone to an entry's old shard.
+void Rebalancer::waitForEarlierWrites() {
+  dthread_mutex_lock(&m_lock);
+  while (!m_writesInFlight.empty() && *m_writesInFlight.begin() < m_firstNewWrite) {
+    dthread_cond_wait(&m_changed, &m_lock);
+  }
+  dthread_mutex_unlock(&m_lock);
+}
+
+// Lists every old shard's top level entries and keeps the ones that
+// belong somewhere else now.
+bool Rebalancer::findMoves(vector<string> *names) {
+  names->clear();
+  vector<string> nodes = m_oldRing.nodes();
+  for (size_t idx = 0; idx < nodes.size(); idx++) {
+    string listing;
+    try {
+      map<string, string> headers;
+      HTTPClientResponse *response = m_pool->send(m_shards[nodes[idx]][0], "GET", "/ds3/", headers, "");
+      bool success = response->success();
+      listing = response->body();
+      delete response;
+      if (!success) {
+        return false;
+      }
+    } catch (...) {
+      return false;
+    }
+
+    vector<string> entries = HttpUtils::split(listing, '\n');
+    for (size_t entry = 0; entry < entries.size(); entry++) {
+      string name = entries[entry];
+      if (name.size() > 0 && name.back() == '/') {
+        name.pop_back();
+      }
+      if (m_oldRing.owner(name) == nodes[idx] && m_newRing.owner(name) != nodes[idx]) {
+        names->push_back(name);
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * Copies one entry to its new shard, keeping writes to it out while we
+ * do. Once it's there reads stop falling back to the old shard, so then
+ * we can delete it from there.
+ */
+bool Rebalancer::move(string name) {
+  dthread_mutex_lock(&m_lock);
+  while (m_writers.count(name) > 0) {
+    dthread_cond_wait(&m_changed, &m_lock);
+  }
+  m_copying = name;
+  vector<Backend *> from = m_shards[m_oldRing.owner(name)];
+  Backend *to = m_shards[m_newRing.owner(name)][0];
+  dthread_mutex_unlock(&m_lock);
+
+  bool copied = this->copyTree(from, to, name);
+
+  dthread_mutex_lock(&m_lock);
+  if (copied) {
+    m_moved.insert(name);
+  }
+  m_copying = "";
+  dthread_cond_broadcast(&m_changed);
+  dthread_mutex_unlock(&m_lock);
+
+  if (copied && !this->deleteTree(from[0], name)) {
+    cerr << "could not delete moved entry " << name << " from " << from[0]->name << endl;
+  }
+  this->throttle();
+  return copied;
+}
+
+// Copies the file or directory at path, and everything under it, to
+// the new shard's primary unless it already has it. We read from the
+// old primary, since its backups may not have its latest writes.
+bool Rebalancer::copyTree(const vector<Backend *> &from, Backend *to, string path) {
+  map<string, string> headers;
+  string body;
+  try {
+    HTTPClientResponse *source = m_pool->send(from[0], "GET", "/ds3/" + path, headers, "");
+    if (source->status() == 404) {
+      // deleted since we listed it
+      delete source;
+      return true;
+    }
+    if (!source->success()) {
+      delete source;
+      return false;
+    }
+
+    if (source->header("X-Ds3-Type") == "directory") {
+      vector<string> entries = HttpUtils::split(source->body(), '\n');
+      delete source;
+      for (size_t idx = 0; idx < entries.size(); idx++) {
+        string entry = entries[idx];
+        if (entry.size() > 0 && entry.back() == '/') {
+          entry.pop_back();
+        }
+        if (!this->copyTree(from, to, path + "/" + entry)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    body = source->body();
+    delete source;
+    HTTPClientResponse *existing = m_pool->send(to, "HEAD", "/ds3/" + path, headers, "");
+    int status = existing->status();
+    delete existing;
+    if (status != 404) {
+      // written since the ring changed, which is newer than ours
+      return status < 500;
+    }
+
+    HTTPClientResponse *copy = m_pool->send(to, "PUT", "/ds3/" + path, headers, body);
+    bool success = copy->success();
+    delete copy;
+    if (!success) {
+      return false;
+    }
+  } catch (...) {
+    return false;
+  }
+
+  dthread_mutex_lock(&m_lock);
+  m_objects++;
+  m_bytes += body.size();
+  dthread_mutex_unlock(&m_lock);
+  m_throttleBytes += body.size();
+  Metrics::count(REBALANCE_OBJECTS_MOVED);
+  Metrics::count(REBALANCE_BYTES_MOVED, body.size());
+  return true;
+}
+
+// Deletes a directory's entries before the directory, since only empty
+// ones can be deleted.
+bool Rebalancer::deleteTree(Backend *from, string path) {
+  map<string, string> headers;
+  try {
+    HTTPClientResponse *listing = m_pool->send(from, "GET", "/ds3/" + path, headers, "");
+    if (listing->status() == 404) {
+      delete listing;
+      return true;
+    }
+    if (listing->success() && listing->header("X-Ds3-Type") == "directory") {
+      vector<string> entries = HttpUtils::split(listing->body(), '\n');
+      for (size_t idx = 0; idx < entries.size(); idx++) {
+        string entry = entries[idx];
+        if (entry.size() > 0 && entry.back() == '/') {
+          entry.pop_back();
+        }
+        if (!this->deleteTree(from, path + "/" + entry)) {
+          delete listing;
+          return false;
+        }
+      }
+    }
+    delete listing;
+
+    HTTPClientResponse *response = m_pool->send(from, "DELETE", "/ds3/" + path, headers, "");
+    bool success = response->success() || response->status() == 404;
+    delete response;
+    return success;
+  } catch (...) {
+    return false;
+  }
+}
+
+// Sleeps for as long as it takes to keep the bytes we've copied since
+// the rebalance started under m_bytesPerSecond. We sleep between
+// entries rather than during one, so writes to it don't wait for us.
+void Rebalancer::throttle() {
+  if (m_bytesPerSecond == 0) {
+    return;
+  }
+  uint64_t dueUsec = m_throttleStartUsec + m_throttleBytes * 1000000 / m_bytesPerSecond;
+  uint64_t now = Metrics::nowUsec();
+  if (dueUsec > now) {
+    usleep(dueUsec - now);
+  }
+}
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <sstream>
+
+#include "DistributedFileSystemService.h"
+#include "HttpClient.h"
+#include "HTTPClientResponse.h"
+#include "Metrics.h"
+#include "Replication.h"
+#include "StringUtils.h"
+#include "dthread.h"
+
+using namespace std;
+
+// the most record bytes we keep in the log for backups to catch up from
+#define MAX_LOG_BYTES (64 * 1024 * 1024)
+// how long we wait before trying an unreachable backup again
+#define RETRY_SECONDS (1)
+// how long we wait on a backup to connect, or for each read or write,
+// before counting it unreachable; long enough for it to apply a resync
+#define BACKUP_TIMEOUT_MS (10000)
+// the most idle connections we keep to one backup
+#define MAX_IDLE_CONNECTIONS (2)
+
+void ReplicationRecord::encode(string *out) const {
+  char header[96];
+  snprintf(header, sizeof(header), "%llu %c %zu %zu\n", (unsigned long long) seq, op,
+           path.size(), data.size());
+  out->append(header).append(path).append(data);
+}
+
+size_t ReplicationRecord::decode(string_view in, ReplicationRecord *record) {
+  size_t newline = in.find('\n');
+  if (newline == string_view::npos) {
+    return 0;
+  }
+
+  unsigned long long seq;
+  char op;
+  size_t pathLength, dataLength;
+  string header(in.substr(0, newline));
+  if (sscanf(header.c_str(), "%llu %c %zu %zu", &seq, &op, &pathLength, &dataLength) != 4 ||
+      (op != PUT && op != DELETE && op != BLOCK) || in.size() - newline - 1 < pathLength + dataLength) {
+    return 0;
+  }
+
+  record->seq = seq;
+  record->op = op;
+  record->path = in.substr(newline + 1, pathLength);
+  record->data = in.substr(newline + 1 + pathLength, dataLength);
+  return newline + 1 + pathLength + dataLength;
+}
+
+Replicator::Replicator(DistributedFileSystemService *fileSystem, vector<string> backups, bool synchronous) :
+  m_connections(MAX_IDLE_CONNECTIONS, BACKUP_TIMEOUT_MS) {
+  m_fileSystem = fileSystem;
+  m_synchronous = synchronous;
+  m_nextSeq = 1;
+  m_logBytes = 0;
+  pthread_mutex_init(&m_lock, NULL);
+  pthread_cond_init(&m_changed, NULL);
+
+  stringstream ss;
+  ss << hex << (unsigned int) (time(NULL) ^ (getpid() << 16));
+  m_epoch = ss.str();
+
+  for (size_t idx = 0; idx < backups.size(); idx++) {
+    vector<string> hostPort = StringUtils::split(backups[idx], ':');
+    if (hostPort.size() != 2 || atoi(hostPort[1].c_str()) <= 0) {
+      cerr << "invalid backup " << backups[idx] << ", expected host:port" << endl;
+      exit(1);
+    }
+    Backup *backup = new Backup();
+    backup->replicator = this;
+    backup->host = hostPort[0];
+    backup->port = atoi(hostPort[1].c_str());
+    backup->appliedSeq = 0;
+    backup->reachable = true;
+    backup->inSync = false;
+    m_backups.push_back(backup);
+
+    pthread_t thread;
+    dthread_create(&thread, NULL, sendLoop, backup);
+    dthread_detach(thread);
+  }
+}
+
+string Replicator::epoch() {
+  return m_epoch;
+}
+
+uint64_t Replicator::lastSeq() {
+  dthread_mutex_lock(&m_lock);
+  uint64_t seq = m_nextSeq - 1;
+  dthread_mutex_unlock(&m_lock);
+  return seq;
+}
+
+uint64_t Replicator::append(char op, string path, string data) {
+  ReplicationRecord *record = new ReplicationRecord();
+  record->op = op;
+  record->path = path;
+  record->data = data;
+  shared_ptr<const ReplicationRecord> shared(record);
+
+  dthread_mutex_lock(&m_lock);
+  record->seq = m_nextSeq++;
+  m_log.push_back(shared);
+  m_logBytes += path.size() + data.size();
+  // backups that still need what we drop get it block by block instead
+  while (m_logBytes > MAX_LOG_BYTES && m_log.size() > 1) {
+    m_logBytes -= m_log.front()->path.size() + m_log.front()->data.size();
+    m_log.pop_front();
+  }
+  this->updatePending();
+  dthread_cond_broadcast(&m_changed);
+  dthread_mutex_unlock(&m_lock);
+  return record->seq;
+}
+
+void Replicator::waitForBackups(uint64_t seq) {
+  if (!m_synchronous) {
+    return;
+  }
+
+  dthread_mutex_lock(&m_lock);
+  while (true) {
+    bool waiting = false;
+    for (size_t idx = 0; idx < m_backups.size(); idx++) {
+      if (m_backups[idx]->reachable && m_backups[idx]->appliedSeq < seq) {
+        waiting = true;
+      }
+    }
+    if (!waiting) {
+      break;
+    }
+    dthread_cond_wait(&m_changed, &m_lock);
+  }
+  dthread_mutex_unlock(&m_lock);
+}
+
+// Reports how far the furthest behind backup is, with m_lock held.
+void Replicator::updatePending() {
+  uint64_t pending = 0;
+  for (size_t idx = 0; idx < m_backups.size(); idx++) {
+    pending = max(pending, m_nextSeq - 1 - m_backups[idx]->appliedSeq);
+  }
+  Metrics::setGauge(REPLICATION_PENDING, pending);
+}
+
+// Sends one backup its records in order, as many at a time as have piled
+// up, and keeps retrying the oldest ones until the backup takes them.
+void *Replicator::sendLoop(void *arg) {
+  Backup *backup = (Backup *) arg;
+  Replicator *replicator = backup->replicator;
+
+  while (true) {
+    if (!backup->inSync) {
+      bool synced = replicator->resync(backup);
+      dthread_mutex_lock(&replicator->m_lock);
+      backup->inSync = synced;
+      if (synced) {
+        backup->reachable = true;
+        replicator->updatePending();
+      } else {
+        if (backup->reachable) {
+          cerr << "backup " << backup->host << ":" << backup->port << " is unreachable" << endl;
+        }
+        backup->reachable = false;
+        Metrics::count(REPLICATION_FAILURES);
+      }
+      dthread_cond_broadcast(&replicator->m_changed);
+      dthread_mutex_unlock(&replicator->m_lock);
+      if (!synced) {
+        sleep(RETRY_SECONDS);
+      }
+      continue;
+    }
+
+    vector<shared_ptr<const ReplicationRecord> > records;
+    dthread_mutex_lock(&replicator->m_lock);
+    while (backup->appliedSeq + 1 >= replicator->m_nextSeq) {
+      dthread_cond_wait(&replicator->m_changed, &replicator->m_lock);
+    }
+    deque<shared_ptr<const ReplicationRecord> > &log = replicator->m_log;
+    if (log.front()->seq > backup->appliedSeq + 1) {
+      // the writes it needs next are gone from the log
+      backup->inSync = false;
+      dthread_mutex_unlock(&replicator->m_lock);
+      continue;
+    }
+    size_t bytes = 0;
+    for (size_t idx = backup->appliedSeq + 1 - log.front()->seq; idx < log.size() && bytes < REPLICATION_BATCH_BYTES; idx++) {
+      records.push_back(log[idx]);
+      bytes += log[idx]->data.size();
+    }
+    dthread_mutex_unlock(&replicator->m_lock);
+
+    bool sent = replicator->send(backup, records);
+
+    dthread_mutex_lock(&replicator->m_lock);
+    if (sent) {
+      backup->appliedSeq = records.back()->seq;
+      replicator->updatePending();
+      Metrics::count(REPLICATION_RECORDS_SENT, records.size());
+    } else {
+      if (backup->reachable) {
+        cerr << "backup " << backup->host << ":" << backup->port << " is unreachable" << endl;
+      }
+      backup->reachable = false;
+      // it may come back having lost or kept what we sent, so ask it
+      backup->inSync = false;
+      Metrics::count(REPLICATION_FAILURES);
+    }
+    dthread_cond_broadcast(&replicator->m_changed);
+    dthread_mutex_unlock(&replicator->m_lock);
+
+    if (!sent) {
+      sleep(RETRY_SECONDS);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Finds out where a backup is and sets its appliedSeq to match, copying
+ * the blocks it's missing if the log can't take it from there.
+ */
+bool Replicator::resync(Backup *backup) {
+  string status;
+  try {
+    HttpClient client(&m_connections, backup->host.c_str(), backup->port);
+    HTTPClientResponse *response = client.get("/replication");
+    bool success = response->success();
+    status = response->body();
+    delete response;
+    if (!success) {
+      return false;
+    }
+  } catch (...) {
+    return false;
+  }
+
+  stringstream ss(status);
+  string epoch;
+  uint64_t seq = 0;
+  ss >> epoch >> seq;
+
+  dthread_mutex_lock(&m_lock);
+  bool resumable = epoch == m_epoch && seq < m_nextSeq &&
+    (seq + 1 == m_nextSeq || (!m_log.empty() && m_log.front()->seq <= seq + 1));
+  if (resumable) {
+    backup->appliedSeq = seq;
+  }
+  dthread_mutex_unlock(&m_lock);
+
+  return resumable || this->copyBlocks(backup);
+}
+
+// Sends a backup the blocks of our disk that differ from its own, found
+// by comparing checksums, along with the last write they include.
+bool Replicator::copyBlocks(Backup *backup) {
+  cerr << "copying changed blocks to backup " << backup->host << ":" << backup->port << endl;
+  try {
+    HttpClient client(&m_connections, backup->host.c_str(), backup->port);
+    HTTPClientResponse *response = client.get("/replication?checksums=1");
+    bool success = response->success();
+    string checksums = response->body();
+    delete response;
+    if (!success) {
+      return false;
+    }
+
+    string blocks;
+    uint64_t seq;
+    int count;
+    if (!m_fileSystem->diffBlocks(checksums, &blocks, &seq, &count)) {
+      cerr << "backup " << backup->host << ":" << backup->port
+           << " has a disk of a different size and needs to be copied from this node" << endl;
+      return false;
+    }
+
+    HttpClient resync(&m_connections, backup->host.c_str(), backup->port);
+    resync.set_header("X-Ds3-Epoch", m_epoch);
+    resync.set_header("X-Ds3-Resync", to_string(seq));
+    response = resync.post("/replication", blocks);
+    success = response->success();
+    delete response;
+    if (!success) {
+      return false;
+    }
+
+    dthread_mutex_lock(&m_lock);
+    backup->appliedSeq = seq;
+    dthread_mutex_unlock(&m_lock);
+    Metrics::count(REPLICATION_RESYNC_BLOCKS, count);
+    return true;
+  } catch (...) {
+    return false;
+  }
+}
+
+bool Replicator::send(Backup *backup, vector<shared_ptr<const ReplicationRecord> > &records) {
+  string body;
+  for (size_t idx = 0; idx < records.size(); idx++) {
+    records[idx]->encode(&body);
+  }
+
+  try {
+    HttpClient client(&m_connections, backup->host.c_str(), backup->port);
+    client.set_header("X-Ds3-Epoch", m_epoch);
+    HTTPClientResponse *response = client.post("/replication", body);
+    bool success = response->success();
+    delete response;
+    return success;
+  } catch (...) {
+    return false;
+  }
+}
@@ -0,0 +1,134 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "ClientError.h"
+#include "Replication.h"
+#include "ReplicationService.h"
+#include "dthread.h"
+#include "ufs.h"
+
+using namespace std;
+
+ReplicationService::ReplicationService(DistributedFileSystemService *fileSystem, string stateFile) :
+  HttpService("/replication") {
+  m_fileSystem = fileSystem;
+  m_stateFile = stateFile;
+  m_appliedSeq = 0;
+  pthread_mutex_init(&m_lock, NULL);
+
+  ifstream in(m_stateFile.c_str());
+  if (!(in >> m_epoch >> m_appliedSeq)) {
+    m_epoch = "";
+    m_appliedSeq = 0;
+  }
+}
+
+void ReplicationService::get(HTTPRequest *request, HTTPResponse *response) {
+  if (request->getParams().count("checksums") > 0) {
+    response->setContentType("text/plain");
+    response->setBody(m_fileSystem->checksums());
+    return;
+  }
+
+  dthread_mutex_lock(&m_lock);
+  stringstream ss;
+  ss << m_epoch << " " << m_appliedSeq << endl;
+  dthread_mutex_unlock(&m_lock);
+  response->setContentType("text/plain");
+  response->setBody(ss.str());
+}
+
+void ReplicationService::post(HTTPRequest *request, HTTPResponse *response) {
+  string_view header;
+  if (!request->findHeader("X-Ds3-Epoch", &header)) {
+    throw ClientError::badRequest();
+  }
+  string epoch(header);
+  string_view resync;
+  bool isResync = request->findHeader("X-Ds3-Resync", &resync);
+
+  // a batch of records can go one record, and a bit for its path, over
+  // what primaries send in one request, and a resync is at most every block
+  size_t maxBytes = isResync ? m_fileSystem->maxDiffBytes() : REPLICATION_BATCH_BYTES + MAX_FILE_SIZE + 64 * 1024;
+  string body;
+  if (!request->getBody(&body, maxBytes)) {
+    throw ClientError::payloadTooLarge();
+  }
+
+  // one primary sends one batch at a time, the lock only keeps our
+  // position consistent if someone else posts to us too
+  dthread_mutex_lock(&m_lock);
+  try {
+    if (isResync) {
+      // we now have everything up to and including that write
+      m_fileSystem->applyBlocks(body);
+      m_epoch = epoch;
+      m_appliedSeq = strtoull(string(resync).c_str(), NULL, 10);
+      body = "";
+    } else if (epoch != m_epoch) {
+      // a primary has to bring us up to date with its disk before it can
+      // send us records
+      cerr << "records from primary " << epoch << " before it resynced us" << endl;
+      throw ClientError::conflict();
+    }
+
+    string_view records(body);
+    ReplicationRecord record;
+    while (records.size() > 0) {
+      size_t used = ReplicationRecord::decode(records, &record);
+      if (used == 0) {
+        throw ClientError::badRequest();
+      }
+      records.remove_prefix(used);
+      if (record.seq <= m_appliedSeq) {
+        // a retry of something we already have
+        continue;
+      }
+      if (record.seq != m_appliedSeq + 1) {
+        // applying it would leave us with a disk the primary never had,
+        // so we stop here and the primary resyncs us from where we are
+        cerr << "missed writes " << m_appliedSeq + 1 << " to " << record.seq - 1
+             << " from primary " << m_epoch << endl;
+        this->saveState();
+        throw ClientError::conflict();
+      }
+      m_fileSystem->apply(record);
+      m_appliedSeq = record.seq;
+    }
+    this->saveState();
+  } catch (...) {
+    dthread_mutex_unlock(&m_lock);
+    throw;
+  }
+  uint64_t appliedSeq = m_appliedSeq;
+  dthread_mutex_unlock(&m_lock);
+
+  stringstream ss;
+  ss << appliedSeq << endl;
+  response->setContentType("text/plain");
+  response->setBody(ss.str());
+}
+
+// Replaces the state file in one rename so a crash leaves the old one or
+// the new one. Being behind the file system is fine since records apply
+// again cleanly; being ahead of it isn't, so we write it after applying.
+void ReplicationService::saveState() {
+  string temporary = m_stateFile + ".tmp";
+  int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    cerr << "could not write " << temporary << endl;
+    return;
+  }
+  string state = m_epoch + " " + to_string(m_appliedSeq) + "\n";
+  if (write(fd, state.data(), state.size()) != (ssize_t) state.size() || fsync(fd) != 0) {
+    cerr << "could not write " << temporary << endl;
+  }
+  close(fd);
+  rename(temporary.c_str(), m_stateFile.c_str());
+}
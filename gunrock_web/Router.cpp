@@ -0,0 +1,247 @@
+#include <assert.h>
+#include <stdlib.h>
+
+#include <iostream>
+
+#include "Router.h"
+#include "ClientError.h"
+
+using namespace std;
+
+Router::Node::Node() {
+  this->param = NULL;
+  this->service = NULL;
+  this->hasRoute = false;
+}
+
+Router::Node::~Node() {
+  map<string, Node *, less<> >::iterator iter;
+  for (iter = children.begin(); iter != children.end(); iter++) {
+    delete iter->second;
+  }
+  delete param;
+}
+
+Router::Router() {
+  this->m_root = new Node();
+}
+
+Router::~Router() {
+  delete m_root;
+}
+
+/**
+ * Mounts service at its path prefix if that ends in '/', so it handles
+ * everything below it. Otherwise the service handles exactly that path.
+ */
+void Router::addService(HttpService *service) {
+  string prefix = service->pathPrefix();
+  assert(prefix.size() > 0 && prefix[0] == '/');
+
+  if (prefix[prefix.size() - 1] != '/') {
+    Node *node = insert(prefix);
+    node->hasRoute = true;
+    for (int method = 0; method < NUM_METHODS; method++) {
+      node->handlers[method] = [service, method](HTTPRequest *request, HTTPResponse *response) {
+        invokeService(service, method, request, response);
+      };
+    }
+    return;
+  }
+
+  Node *node = insert(prefix.substr(0, prefix.size() - 1));
+  if (node->service != NULL) {
+    cerr << "two services mounted at " << prefix << endl;
+    exit(1);
+  }
+  node->service = service;
+}
+
+// Routes method requests for exactly path to handler.
+void Router::addRoute(string method, string path, RouteHandler handler) {
+  int index = methodIndex(method);
+  if (index < 0) {
+    cerr << "can't route unknown method " << method << endl;
+    exit(1);
+  }
+
+  Node *node = insert(path);
+  node->hasRoute = true;
+  node->handlers[index] = handler;
+}
+
+/**
+ * Runs whatever handles request, throwing a ClientError if nothing does.
+ */
+void Router::dispatch(HTTPRequest *request, HTTPResponse *response) const {
+  int method = methodIndex(request);
+  if (method < 0) {
+    // The server doesn't know about this method
+    response->setStatus(501);
+    return;
+  }
+
+  string_view path = request->getPath();
+  Node *route = NULL;
+  Match match;
+  if (path.size() > 0 && path[0] == '/') {
+    route = matchRoute(m_root, path, 1, 0, &match);
+  }
+  if (route != NULL) {
+    if (!route->handlers[method]) {
+      throw ClientError::methodNotAllowed();
+    }
+    for (int idx = 0; idx < match.numParams; idx++) {
+      request->addPathParam(match.paramNames[idx], match.params[idx]);
+    }
+    route->handlers[method](request, response);
+    return;
+  }
+
+  HttpService *service = matchService(path);
+  if (service == NULL) {
+    throw ClientError::notFound();
+  }
+  invokeService(service, method, request, response);
+}
+
+// Finds or makes the node for path, one level per segment.
+Router::Node *Router::insert(string path) {
+  Node *node = m_root;
+  if (path.size() == 0) {
+    return node;
+  }
+  assert(path[0] == '/');
+
+  size_t pos = 1;
+  while (true) {
+    size_t end = path.find('/', pos);
+    string segment = path.substr(pos, end == string::npos ? string::npos : end - pos);
+    if (segment.size() > 0 && segment[0] == ':') {
+      if (node->param == NULL) {
+        node->param = new Node();
+        node->param->paramName = segment.substr(1);
+      } else if (node->param->paramName != segment.substr(1)) {
+        cerr << "conflicting parameter names in route " << path << endl;
+        exit(1);
+      }
+      node = node->param;
+    } else {
+      Node *&child = node->children[segment];
+      if (child == NULL) {
+        child = new Node();
+      }
+      node = child;
+    }
+
+    if (end == string::npos) {
+      return node;
+    }
+    pos = end + 1;
+  }
+}
+
+/**
+ * Matches the segments of path from pos on against the routes below
+ * node, preferring literal segments over parameters. The values of
+ * parameter segments on the way are left in match.
+ */
+Router::Node *Router::matchRoute(Node *node, string_view path, size_t pos, int depth, Match *match) const {
+  if (pos > path.size()) {
+    if (!node->hasRoute) {
+      return NULL;
+    }
+    match->numParams = depth;
+    return node;
+  }
+
+  size_t end = path.find('/', pos);
+  string_view segment = path.substr(pos, end == string_view::npos ? string_view::npos : end - pos);
+  size_t next = end == string_view::npos ? path.size() + 1 : end + 1;
+
+  map<string, Node *, less<> >::iterator child = node->children.find(segment);
+  if (child != node->children.end()) {
+    Node *route = matchRoute(child->second, path, next, depth, match);
+    if (route != NULL) {
+      return route;
+    }
+  }
+
+  if (node->param != NULL && segment.size() > 0 && depth < MAX_PARAMS) {
+    match->params[depth] = segment;
+    match->paramNames[depth] = node->param->paramName;
+    return matchRoute(node->param, path, next, depth + 1, match);
+  }
+  return NULL;
+}
+
+// Finds the service mounted at the longest prefix of path.
+HttpService *Router::matchService(string_view path) const {
+  HttpService *service = m_root->service;
+  if (path.size() == 0 || path[0] != '/') {
+    return service;
+  }
+
+  Node *node = m_root;
+  size_t pos = 1;
+  size_t end;
+  // a prefix only covers paths that go on past it
+  while ((end = path.find('/', pos)) != string_view::npos) {
+    map<string, Node *, less<> >::iterator child = node->children.find(path.substr(pos, end - pos));
+    if (child == node->children.end()) {
+      break;
+    }
+    node = child->second;
+    if (node->service != NULL) {
+      service = node->service;
+    }
+    pos = end + 1;
+  }
+  return service;
+}
+
+int Router::methodIndex(string method) {
+  if (method == "HEAD") {
+    return METHOD_HEAD;
+  } else if (method == "GET") {
+    return METHOD_GET;
+  } else if (method == "PUT") {
+    return METHOD_PUT;
+  } else if (method == "POST") {
+    return METHOD_POST;
+  } else if (method == "DELETE") {
+    return METHOD_DELETE;
+  } else if (method == "MOVE") {
+    return METHOD_MOVE;
+  }
+  return -1;
+}
+
+int Router::methodIndex(HTTPRequest *request) {
+  if (request->isHead()) {
+    return METHOD_HEAD;
+  } else if (request->isGet()) {
+    return METHOD_GET;
+  } else if (request->isPut()) {
+    return METHOD_PUT;
+  } else if (request->isPost()) {
+    return METHOD_POST;
+  } else if (request->isDelete()) {
+    return METHOD_DELETE;
+  } else if (request->isMove()) {
+    return METHOD_MOVE;
+  }
+  return -1;
+}
+
+void Router::invokeService(HttpService *service, int method,
+                           HTTPRequest *request, HTTPResponse *response) {
+  switch (method) {
+  case METHOD_HEAD: service->head(request, response); break;
+  case METHOD_GET: service->get(request, response); break;
+  case METHOD_PUT: service->put(request, response); break;
+  case METHOD_POST: service->post(request, response); break;
+  case METHOD_DELETE: service->del(request, response); break;
+  case METHOD_MOVE: service->move(request, response); break;
+  }
+}
@@ -0,0 +1,631 @@
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+#include "ClientError.h"
+#include "HTTPClientResponse.h"
+#include "HttpUtils.h"
+#include "Metrics.h"
+#include "ShardService.h"
+#include "StringUtils.h"
+#include "ufs.h"
+
+using namespace std;
+
+// request headers that change what a storage node sends back
+static const char *FORWARDED_REQUEST_HEADERS[] = {
+  "If-Match", "If-None-Match", "Range",
+};
+
+// response headers we pass back to the client as they are
+static const char *FORWARDED_RESPONSE_HEADERS[] = {
+  "Accept-Ranges", "Content-Range", "ETag", "X-Ds3-Type",
+};
+
+#define NUM_ELEMENTS(array) (sizeof(array) / sizeof(array[0]))
+
+// how long a cached object is served before we check it's still current
+#define CACHE_FRESH_USEC (1000 * 1000)
+
+// Holds a ShardService's ring lock for as long as it's in scope.
+class RingLock {
+ public:
+  RingLock(pthread_rwlock_t *lock, bool exclusive) {
+    m_lock = lock;
+    if (exclusive) {
+      pthread_rwlock_wrlock(m_lock);
+    } else {
+      pthread_rwlock_rdlock(m_lock);
+    }
+  }
+  ~RingLock() {
+    pthread_rwlock_unlock(m_lock);
+  }
+
+ private:
+  pthread_rwlock_t *m_lock;
+};
+
+// Adds the entries of a directory listing to entries.
+static void addListing(const string &listing, set<string> *entries) {
+  vector<string> lines = HttpUtils::split(listing, '\n');
+  entries->insert(lines.begin(), lines.end());
+}
+
+static string renderListing(const set<string> &entries) {
+  stringstream ss;
+  set<string>::const_iterator iter;
+  for (iter = entries.begin(); iter != entries.end(); iter++) {
+    ss << *iter << endl;
+  }
+  return ss.str();
+}
+
+ShardService::ShardService(vector<string> shards, size_t cacheBytes, uint64_t moveBytesPerSecond) :
+  HttpService("/ds3/"), m_rebalancer(&m_pool, moveBytesPerSecond) {
+  for (size_t idx = 0; idx < shards.size(); idx++) {
+    vector<Backend *> group = this->parseShard(shards[idx]);
+    if (group.empty()) {
+      cerr << "invalid shard " << shards[idx] << ", expected host:port[|host:port...]" << endl;
+      exit(1);
+    }
+    m_ring.addNode(group[0]->name);
+    m_shards[group[0]->name] = group;
+  }
+
+  // a change to the ring would never get the lock if requests could
+  // keep taking it first
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&m_ringLock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  m_pool.startHealthChecks();
+  m_cache = cacheBytes > 0 ? new ObjectCache(cacheBytes, CACHE_FRESH_USEC) : NULL;
+  m_replicas = 0;
+  m_readQuorum = 0;
+  m_writeQuorum = 0;
+  m_lastClock = 0;
+
+  stringstream ss;
+  ss << hex << (unsigned int) (time(NULL) ^ (getpid() << 16));
+  m_writerId = ss.str();
+}
+
+void ShardService::setQuorum(int replicas, int reads, int writes) {
+  map<string, vector<Backend *> >::iterator iter;
+  for (iter = m_shards.begin(); iter != m_shards.end(); iter++) {
+    if (iter->second.size() > 1) {
+      cerr << "quorum nodes replicate to each other, they can't have backups" << endl;
+      exit(1);
+    }
+  }
+  if (replicas > (int) m_shards.size() || reads < 1 || reads > replicas || writes < 1 || writes > replicas) {
+    cerr << "a quorum needs 1 <= R, W <= N <= " << m_shards.size() << " nodes" << endl;
+    exit(1);
+  }
+  m_replicas = replicas;
+  m_readQuorum = reads;
+  m_writeQuorum = writes;
+  delete m_cache;
+  m_cache = NULL;
+}
+
+// The nodes of a "primary|backup|..." shard, or none if it isn't one.
+vector<Backend *> ShardService::parseShard(string shard) {
+  vector<string> nodes = StringUtils::split(shard, '|');
+  vector<Backend *> group;
+  for (size_t node = 0; node < nodes.size(); node++) {
+    Backend *backend = m_pool.add(nodes[node]);
+    if (backend == NULL) {
+      return vector<Backend *>();
+    }
+    group.push_back(backend);
+  }
+  return group;
+}
+
+// Quorums would need every replica set that changes to be moved at
+// once, so they keep the shards they started with.
+void ShardService::addShard(string shard) {
+  if (m_replicas > 0) {
+    throw ClientError::badRequest();
+  }
+  vector<Backend *> group = this->parseShard(shard);
+  if (group.empty()) {
+    throw ClientError::badRequest();
+  }
+
+  RingLock writeLock(&m_ringLock, true);
+  if (m_ring.hasNode(group[0]->name)) {
+    throw ClientError::conflict();
+  }
+  HashRing ring = m_ring;
+  ring.addNode(group[0]->name);
+  m_shards[group[0]->name] = group;
+  this->rebalance(ring);
+}
+
+void ShardService::removeShard(string primary) {
+  if (m_replicas > 0) {
+    throw ClientError::badRequest();
+  }
+
+  RingLock writeLock(&m_ringLock, true);
+  if (!m_ring.hasNode(primary)) {
+    throw ClientError::notFound();
+  }
+  if (m_ring.nodes().size() == 1) {
+    // there'd be nowhere to move its entries to
+    throw ClientError::badRequest();
+  }
+  HashRing ring = m_ring;
+  ring.removeNode(primary);
+  this->rebalance(ring);
+}
+
+string ShardService::rebalanceStatus() {
+  return m_rebalancer.status();
+}
+
+// Switches to ring and starts moving entries to match, with the ring
+// lock held so no request picks a shard from the ring halfway through.
+void ShardService::rebalance(const HashRing &ring) {
+  if (!m_rebalancer.start(m_ring, ring, m_shards)) {
+    throw ClientError::conflict();
+  }
+  m_ring = ring;
+}
+
+// The first path component under /ds3/, which picks the node, or "" for
+// the root itself.
+string ShardService::topLevelName(HTTPRequest *request) {
+  string path(request->getPath().substr(this->pathPrefix().length()));
+  return path.substr(0, path.find('/'));
+}
+
+void ShardService::head(HTTPRequest *request, HTTPResponse *response) {
+  string name = topLevelName(request);
+  if (name.empty()) {
+    response->setHeader("X-Ds3-Type", "directory");
+    response->withoutBody(-1);
+    return;
+  }
+  if (m_replicas > 0) {
+    this->quorumRead(name, request, response);
+    return;
+  }
+  this->read(name, request, response);
+}
+
+void ShardService::get(HTTPRequest *request, HTTPResponse *response) {
+  string name = topLevelName(request);
+  if (name.empty()) {
+    listRoot(response);
+    return;
+  }
+  if (m_replicas > 0) {
+    this->quorumRead(name, request, response);
+    return;
+  }
+  if (m_cache != NULL && this->isCacheable(request) && m_rebalancer.source(name).empty()) {
+    this->getCached(name, request, response);
+    return;
+  }
+  this->read(name, request, response);
+}
+
+void ShardService::put(HTTPRequest *request, HTTPResponse *response) {
+  string name = topLevelName(request);
+  if (name.empty()) {
+    throw ClientError::badRequest();
+  }
+  this->write(name, request, response);
+}
+
+void ShardService::del(HTTPRequest *request, HTTPResponse *response) {
+  string name = topLevelName(request);
+  if (name.empty()) {
+    throw ClientError::badRequest();
+  }
+  this->write(name, request, response);
+}
+
+// The shard that owns name, and the one it's moving away from if it is.
+vector<Backend *> ShardService::owners(string name, vector<Backend *> *moving) {
+  RingLock readLock(&m_ringLock, false);
+  *moving = m_rebalancer.source(name);
+  return m_shards[m_ring.owner(name)];
+}
+
+// The shard member to read name from.
+Backend *ShardService::reader(string name) {
+  vector<Backend *> moving;
+  return m_pool.choose(this->owners(name, &moving));
+}
+
+void ShardService::read(string name, HTTPRequest *request, HTTPResponse *response) {
+  vector<Backend *> moving;
+  vector<Backend *> group = this->owners(name, &moving);
+  if (moving.empty()) {
+    forward(m_pool.choose(group), request, response);
+  } else {
+    this->readMoving(group, moving, request, response);
+  }
+}
+
+/**
+ * Reads an entry on its way to another shard from its new shard, and
+ * from its old one if it hasn't been copied yet. A directory can be in
+ * both places at once, part copied and part written since, so then we
+ * answer with both listings.
+ */
+void ShardService::readMoving(const vector<Backend *> &owners, const vector<Backend *> &moving,
+                              HTTPRequest *request, HTTPResponse *response) {
+  map<string, string> headers = this->forwardedHeaders(request);
+  HTTPClientResponse *reply = this->send(m_pool.choose(owners), request, headers);
+  bool directory = reply->status() == 200 && reply->header("X-Ds3-Type") == "directory";
+  if (reply->status() != 404 && !(directory && request->isGet())) {
+    this->relay(reply, request, response);
+    delete reply;
+    return;
+  }
+
+  HTTPClientResponse *old;
+  try {
+    old = this->send(m_pool.choose(moving), request, headers);
+  } catch (...) {
+    delete reply;
+    throw;
+  }
+  if (!directory) {
+    Metrics::count(REBALANCE_FALLBACK_READS);
+    this->relay(old, request, response);
+  } else if (old->status() == 200 && old->header("X-Ds3-Type") == "directory") {
+    // neither shard's ETag describes the two listings together
+    set<string> entries;
+    addListing(reply->body(), &entries);
+    addListing(old->body(), &entries);
+    response->setHeader("X-Ds3-Type", "directory");
+    response->setBody(renderListing(entries));
+  } else {
+    this->relay(reply, request, response);
+  }
+  delete reply;
+  delete old;
+}
+
+/**
+ * Writes an entry on its way to another shard to its new shard. A delete
+ * has to reach the old shard too, or reads would find what it deleted
+ * there, so if the new shard has nothing to delete the old shard answers
+ * it.
+ */
+void ShardService::writeMoving(Backend *owner, Backend *moving, HTTPRequest *request, const string &body,
+                               HTTPResponse *response) {
+  map<string, string> headers = this->forwardedHeaders(request);
+  HTTPClientResponse *reply = this->send(owner, request, headers, body);
+  try {
+    if (request->isDelete() && reply->status() == 404) {
+      HTTPClientResponse *old = this->send(moving, request, headers, body);
+      delete reply;
+      reply = old;
+    } else if (request->isDelete() && reply->success()) {
+      // the client's preconditions were for what it just deleted
+      delete this->send(moving, request, map<string, string>(), body);
+    }
+    this->relay(reply, request, response);
+  } catch (...) {
+    delete reply;
+    throw;
+  }
+  delete reply;
+}
+
+/**
+ * Sends a write to the shard's primary and drops anything it may have
+ * changed from the cache, whether or not it worked. The body is read
+ * first and the ring lock only held to pick the shard, so a slow client
+ * holds up no one else. The rebalancer knows about every write in flight
+ * instead, and waits for those still on their way to an old shard.
+ */
+void ShardService::write(string name, HTTPRequest *request, HTTPResponse *response) {
+  string body;
+  if (request->isPut() && !request->getBody(&body, MAX_FILE_SIZE)) {
+    // storage nodes couldn't store it either
+    throw ClientError::insufficientStorage();
+  }
+  if (m_replicas > 0) {
+    this->quorumWrite(name, request, body, response);
+    return;
+  }
+
+  uint64_t write = m_rebalancer.beginWrite(name);
+  try {
+    Backend *owner;
+    vector<Backend *> moving;
+    {
+      RingLock readLock(&m_ringLock, false);
+      owner = m_shards[m_ring.owner(name)][0];
+      moving = m_rebalancer.source(name);
+    }
+    if (moving.empty()) {
+      forward(owner, request, response, body);
+    } else {
+      this->writeMoving(owner, moving[0], request, body, response);
+    }
+  } catch (...) {
+    m_rebalancer.endWrite(name, write);
+    if (m_cache != NULL) {
+      m_cache->invalidate(this->pathPrefix() + name);
+    }
+    throw;
+  }
+  m_rebalancer.endWrite(name, write);
+  if (m_cache != NULL) {
+    m_cache->invalidate(this->pathPrefix() + name);
+  }
+}
+
+map<string, string> ShardService::forwardedHeaders(HTTPRequest *request) {
+  map<string, string> headers;
+  for (size_t idx = 0; idx < NUM_ELEMENTS(FORWARDED_REQUEST_HEADERS); idx++) {
+    string_view value;
+    if (request->findHeader(FORWARDED_REQUEST_HEADERS[idx], &value)) {
+      headers[FORWARDED_REQUEST_HEADERS[idx]] = string(value);
+    }
+  }
+  return headers;
+}
+
+// Sends request to backend and copies its response into ours.
+void ShardService::forward(Backend *backend, HTTPRequest *request, HTTPResponse *response, const string &body) {
+  HTTPClientResponse *reply = this->send(backend, request, this->forwardedHeaders(request), body);
+  this->relay(reply, request, response);
+  delete reply;
+}
+
+/**
+ * Sends request to backend with headers of our choosing and the body we
+ * read from the client, if any. Bodies are relayed whole, which is fine
+ * for ds3 objects since they're small. We ask for them uncompressed
+ * because the client reads them whole too.
+ */
+HTTPClientResponse *ShardService::send(Backend *backend, HTTPRequest *request, map<string, string> headers,
+                                       const string &body) {
+  try {
+    return m_pool.send(backend, request->getMethodName(), request->getUrl(), headers, body);
+  } catch (...) {
+    throw ClientError::badGateway();
+  }
+}
+
+void ShardService::relay(HTTPClientResponse *reply, HTTPRequest *request, HTTPResponse *response) {
+  response->setStatus(reply->status());
+  for (size_t idx = 0; idx < NUM_ELEMENTS(FORWARDED_RESPONSE_HEADERS); idx++) {
+    string value = reply->header(FORWARDED_RESPONSE_HEADERS[idx]);
+    if (value.size() > 0) {
+      response->setHeader(FORWARDED_RESPONSE_HEADERS[idx], value);
+    }
+  }
+  string contentType = reply->header("Content-Type");
+  if (contentType.size() > 0) {
+    response->setContentType(contentType);
+  }
+
+  if (request->isHead()) {
+    string length = reply->header("Content-Length");
+    response->withoutBody(length.size() > 0 ? atoi(length.c_str()) : -1);
+  } else {
+    response->setBody(reply->body());
+  }
+}
+
+// Only whole objects are cached. We answer If-None-Match ourselves, but
+// If-Match and Range go to the storage node.
+bool ShardService::isCacheable(HTTPRequest *request) {
+  string_view value;
+  return !request->findHeader("If-Match", &value) && !request->findHeader("Range", &value);
+}
+
+/**
+ * Serves a GET from the cache. If the object isn't cached, or has been
+ * for long enough that it may have changed, we fetch it, asking only for
+ * changes if we have a copy. Other requests for it wait for our fetch.
+ */
+void ShardService::getCached(string name, HTTPRequest *request, HTTPResponse *response) {
+  string key = request->getUrl();
+  shared_ptr<CachedObject> object;
+  if (m_cache->lookup(key, &object)) {
+    map<string, string> headers;
+    if (object) {
+      headers["If-None-Match"] = object->etag;
+    }
+
+    HTTPClientResponse *reply;
+    try {
+      reply = this->send(this->reader(name), request, headers);
+    } catch (...) {
+      m_cache->fill(key, shared_ptr<CachedObject>());
+      throw;
+    }
+
+    if (reply->status() == 304 && object) {
+      object->validatedUsec = Metrics::nowUsec();
+    } else if (reply->status() == 200 && reply->header("ETag").size() > 0) {
+      object = make_shared<CachedObject>();
+      object->etag = reply->header("ETag");
+      object->contentType = reply->header("Content-Type");
+      for (size_t idx = 0; idx < NUM_ELEMENTS(FORWARDED_RESPONSE_HEADERS); idx++) {
+        string value = reply->header(FORWARDED_RESPONSE_HEADERS[idx]);
+        if (value.size() > 0) {
+          object->headers[FORWARDED_RESPONSE_HEADERS[idx]] = value;
+        }
+      }
+      object->body = make_shared<const string>(reply->body());
+      object->validatedUsec = Metrics::nowUsec();
+    } else {
+      object.reset();
+    }
+    m_cache->fill(key, object);
+
+    if (!object) {
+      this->relay(reply, request, response);
+      delete reply;
+      return;
+    }
+    delete reply;
+  } else if (!object) {
+    // whoever fetched it for us got something we don't cache
+    forward(this->reader(name), request, response);
+    return;
+  }
+
+  map<string, string>::iterator iter;
+  for (iter = object->headers.begin(); iter != object->headers.end(); iter++) {
+    response->setHeader(iter->first, iter->second);
+  }
+  if (object->contentType.size() > 0) {
+    response->setContentType(object->contentType);
+  }
+  string_view value;
+  if (request->findHeader("If-None-Match", &value) &&
+      HttpUtils::etagMatches(string(value), object->etag, true)) {
+    response->setStatus(304);
+    return;
+  }
+  response->setSharedBody(object->body);
+}
+
+// The nodes that hold name when every object is on m_replicas of them.
+vector<Backend *> ShardService::replicas(string name) {
+  vector<string> owners = m_ring.owners(name, m_replicas);
+  vector<Backend *> backends;
+  for (size_t idx = 0; idx < owners.size(); idx++) {
+    backends.push_back(m_shards[owners[idx]][0]);
+  }
+  return backends;
+}
+
+// A version newer than any we've handed out, from the wall clock so that
+// versions from different gateways are in about the order they were made.
+ObjectVersion ShardService::nextVersion() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  uint64_t clock = (uint64_t) now.tv_sec * 1000000 + now.tv_usec;
+  uint64_t last = m_lastClock;
+  while (!m_lastClock.compare_exchange_weak(last, max(clock, last + 1))) {
+  }
+
+  ObjectVersion version;
+  version.clock = max(clock, last + 1);
+  version.writer = m_writerId;
+  return version;
+}
+
+/**
+ * Reads from every replica and answers with the newest of the first R
+ * answers. Replicas keep ETags of their own, so the version stands in
+ * for them and we evaluate If-None-Match against it here.
+ */
+void ShardService::quorumRead(string name, HTTPRequest *request, HTTPResponse *response) {
+  map<string, string> headers;
+  string_view range;
+  if (request->findHeader("Range", &range)) {
+    headers["Range"] = string(range);
+  }
+
+  // only whole objects are worth copying to replicas that are behind
+  bool repair = request->isGet() && range.size() == 0;
+  QuorumCall *call = new QuorumCall(&m_pool, request->getMethodName(), request->getUrl(), headers, "", repair);
+  QuorumReply *reply = call->run(this->replicas(name), m_readQuorum);
+  if (reply == NULL) {
+    call->release();
+    Metrics::count(QUORUM_FAILURES);
+    throw ClientError::badGateway();
+  }
+
+  string_view value;
+  string etag = "\"" + reply->version.str() + "\"";
+  if (!reply->version.empty() && reply->response->status() == 200 &&
+      request->findHeader("If-None-Match", &value) && HttpUtils::etagMatches(string(value), etag, true)) {
+    response->setHeader("ETag", etag);
+    response->setStatus(304);
+    call->release();
+    return;
+  }
+  this->relay(reply->response, request, response);
+  if (!reply->version.empty()) {
+    response->setHeader("ETag", etag);
+    response->setHeader("X-Ds3-Version", reply->version.str());
+  }
+  call->release();
+}
+
+/**
+ * Sends a write with a new version to every replica and answers once W
+ * of them stored it. Conditional writes would need the replicas to agree
+ * on an ETag, which they don't, so we don't take them.
+ */
+void ShardService::quorumWrite(string name, HTTPRequest *request, const string &body, HTTPResponse *response) {
+  string_view value;
+  if (request->findHeader("If-Match", &value) || request->findHeader("If-None-Match", &value)) {
+    throw ClientError::badRequest();
+  }
+
+  ObjectVersion version = this->nextVersion();
+  map<string, string> headers;
+  headers["X-Ds3-Version"] = version.str();
+  QuorumCall *call = new QuorumCall(&m_pool, request->getMethodName(), request->getUrl(), headers, body, false);
+  QuorumReply *reply = call->run(this->replicas(name), m_writeQuorum);
+  if (reply == NULL) {
+    call->release();
+    Metrics::count(QUORUM_FAILURES);
+    throw ClientError::badGateway();
+  }
+  this->relay(reply->response, request, response);
+  response->setHeader("ETag", "\"" + version.str() + "\"");
+  response->setHeader("X-Ds3-Version", version.str());
+  call->release();
+}
+
+// Lists the root by asking every shard for its top level entries at the
+// same time, including shards entries are still moving away from. Any
+// shard we can't reach would leave entries out, so then the whole
+// listing fails.
+void ShardService::listRoot(HTTPResponse *response) {
+  vector<Backend *> backends;
+  {
+    RingLock readLock(&m_ringLock, false);
+    vector<string> nodes = m_ring.nodes();
+    for (size_t idx = 0; idx < nodes.size(); idx++) {
+      backends.push_back(m_pool.choose(m_shards[nodes[idx]]));
+    }
+    vector<vector<Backend *> > moving = m_rebalancer.sources();
+    for (size_t idx = 0; idx < moving.size(); idx++) {
+      backends.push_back(m_pool.choose(moving[idx]));
+    }
+  }
+
+  vector<HTTPClientResponse *> replies = m_pool.sendAll(backends, "GET", "/ds3/");
+  set<string> entries;
+  bool succeeded = true;
+  for (size_t idx = 0; idx < replies.size(); idx++) {
+    if (replies[idx] == NULL || !replies[idx]->success()) {
+      succeeded = false;
+    } else {
+      addListing(replies[idx]->body(), &entries);
+    }
+    delete replies[idx];
+  }
+  if (!succeeded) {
+    throw ClientError::badGateway();
+  }
+  response->setHeader("X-Ds3-Type", "directory");
+  response->setBody(renderListing(entries));
+}
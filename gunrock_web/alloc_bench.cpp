@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <new>
+#include <string>
+#include <string_view>
+
+#include "Arena.h"
+#include "HTTPRequest.h"
+#include "HTTPResponse.h"
+#include "MySocket.h"
+
+using namespace std;
+
+/*
+  Counts the heap allocations it takes to read a request and build and
+  send its response, once with the request's memory coming from the heap
+  the way it used to and once from an Arena that is reset between
+  requests, like gunrock_web does.
+
+  usage: alloc_bench [iterations]
+*/
+
+static unsigned long allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == NULL) {
+    throw bad_alloc();
+  }
+  return p;
+}
+
+// std::pmr's default resource allocates through the aligned versions
+void *operator new(size_t size, align_val_t alignment) {
+  allocations++;
+  void *p = aligned_alloc((size_t) alignment, (size + (size_t) alignment - 1) & ~((size_t) alignment - 1));
+  if (p == NULL) {
+    throw bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p, align_val_t /*alignment*/) noexcept {
+  free(p);
+}
+
+void operator delete(void *p, size_t /*size*/, align_val_t /*alignment*/) noexcept {
+  free(p);
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete(void *p, size_t /*size*/) noexcept {
+  free(p);
+}
+
+static const char *REQUEST =
+  "GET /ds3/a/b/file.txt HTTP/1.1\r\n"
+  "Host: localhost:8080\r\n"
+  "User-Agent: curl/7.88.1\r\n"
+  "Accept: */*\r\n"
+  "Accept-Encoding: gzip, deflate\r\n"
+  "If-None-Match: \"7f878a0d-12-3\"\r\n"
+  "X-Auth-Token: 0123456789abcdef0123456789abcdef\r\n"
+  "\r\n";
+
+// A socket that hands out one canned request and drops what's written.
+class CannedSocket : public MySocket {
+ public:
+  CannedSocket(const char *request) : request(request), offset(0) {}
+
+  virtual int read(void *buffer, int len) {
+    int copySize = min((size_t) len, strlen(request) - offset);
+    if (copySize <= 0) {
+      throw SocketReadError();
+    }
+    memcpy(buffer, request + offset, copySize);
+    offset += copySize;
+    return copySize;
+  }
+
+  virtual void write(string /*data*/) {}
+  virtual void writeVector(struct iovec * /*iov*/, int /*iovcnt*/) {}
+  virtual void sendFile(int /*fd*/, off_t /*offset*/, size_t /*count*/) {}
+
+ private:
+  const char *request;
+  size_t offset;
+};
+
+static void handle(CannedSocket *client, HTTPRequest *request, HTTPResponse *response) {
+  request->readRequest();
+
+  string_view value;
+  request->findHeader("If-None-Match", &value);
+  request->findHeader("Accept-Encoding", &value);
+  request->getPath();
+
+  response->setHeader("ETag", "\"7f878a0d-12-4\"");
+  response->setHeader("X-Ds3-Type", "file");
+  response->setHeader("Accept-Ranges", "bytes");
+  response->setBody("hello world\n");
+  response->write(client);
+}
+
+static double perRequest(bool useArena, int iterations) {
+  Arena arena;
+  // warm up so one time allocations don't count
+  for (int idx = 0; idx < 2; idx++) {
+    CannedSocket client(REQUEST);
+    HTTPRequest request(&client, 8080);
+    HTTPResponse response;
+    handle(&client, &request, &response);
+  }
+
+  unsigned long before = allocations;
+  for (int idx = 0; idx < iterations; idx++) {
+    CannedSocket client(REQUEST);
+    if (useArena) {
+      HTTPRequest *request = arena.create<HTTPRequest>(&client, 8080, &arena);
+      HTTPResponse *response = arena.create<HTTPResponse>(&arena);
+      handle(&client, request, response);
+      arena.destroy(response);
+      arena.destroy(request);
+      arena.reset();
+    } else {
+      HTTPRequest *request = new HTTPRequest(&client, 8080);
+      HTTPResponse *response = new HTTPResponse();
+      handle(&client, request, response);
+      delete response;
+      delete request;
+    }
+  }
+  return (double) (allocations - before) / iterations;
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = argc > 1 ? atoi(argv[1]) : 10000;
+  if (iterations <= 0) {
+    cerr << "usage: " << argv[0] << " [iterations]" << endl;
+    return 1;
+  }
+
+  cout << "heap allocations per request" << endl;
+  cout << "  heap:  " << perRequest(false, iterations) << endl;
+  cout << "  arena: " << perRequest(true, iterations) << endl;
+  return 0;
+}
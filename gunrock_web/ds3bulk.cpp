@@ -0,0 +1,70 @@
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "BulkTransfer.h"
+#include "StringUtils.h"
+
+using namespace std;
+
+void usage(char *program) {
+  cerr << "usage: " << program << " [-c connections] [-r retries] [-q] host:port upload localDir remoteDir" << endl;
+  cerr << "       " << program << " [-c connections] [-r retries] [-q] host:port download remoteDir localDir" << endl;
+  cerr << "For example:" << endl;
+  cerr << "    $ " << program << " -c 16 localhost:8080 upload photos /ds3/photos" << endl;
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  signal(SIGPIPE, SIG_IGN);
+  int connections = 8;
+  int retries = 3;
+  bool quiet = false;
+
+  int option;
+  while ((option = getopt(argc, argv, "c:r:q")) != -1) {
+    switch (option) {
+    case 'c':
+      connections = atoi(optarg);
+      break;
+    case 'r':
+      retries = atoi(optarg);
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if (argc - optind != 4 || connections < 1 || retries < 0) {
+    usage(argv[0]);
+  }
+  vector<string> hostPort = StringUtils::split(argv[optind], ':');
+  string direction = argv[optind + 1];
+  if (hostPort.size() != 2 || atoi(hostPort[1].c_str()) <= 0 || (direction != "upload" && direction != "download")) {
+    usage(argv[0]);
+  }
+
+  BulkTransfer transfer(hostPort[0], atoi(hostPort[1].c_str()), connections, retries);
+  if (!quiet) {
+    transfer.setProgress(&cerr);
+  }
+  BulkTransferStats stats = direction == "upload" ? transfer.upload(argv[optind + 2], argv[optind + 3])
+                                                  : transfer.download(argv[optind + 2], argv[optind + 3]);
+
+  vector<string> failed = transfer.failed();
+  for (size_t idx = 0; idx < failed.size(); idx++) {
+    cerr << "failed: " << failed[idx] << endl;
+  }
+  cout << stats.files << " files, " << stats.bytes << " bytes in " << fixed << setprecision(2) << stats.seconds
+       << " s (" << stats.bytes / 1e6 / max(stats.seconds, 1e-3) << " MB/s), " << stats.retries << " retries, "
+       << stats.failures << " failed" << endl;
+  return failed.empty() ? 0 : 1;
+}
@@ -4,6 +4,7 @@
 #include <signal.h>
 #include <fcntl.h>
 
+#include <atomic>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -11,6 +12,7 @@
 #include <sstream>
 #include <deque>
 
+#include "Arena.h"
 #include "ClientError.h"
 #include "HTTPRequest.h"
 #include "HTTPResponse.h"
@@ -19,8 +21,17 @@
 #include "FileService.h"
 #include "DistributedFileSystemService.h"
 #include "MySocket.h"
+#include "Metrics.h"
+#include "MetricsService.h"
 #include "MyServerSocket.h"
+#include "Replication.h"
+#include "ReplicationService.h"
+#include "Router.h"
+#include "RebalanceService.h"
+#include "ShardService.h"
+#include "StringUtils.h"
 #include "dthread.h"
+#include "ufs.h"
 
 using namespace std;
 int PORT = 8080;
@@ -30,45 +41,49 @@ string BASEDIR = "static";
 string SCHEDALG = "FIFO";
 string LOGFILE = "/dev/null";
 string DISKFILE = "disk.img";
+// what to do with new connections while every buffer slot is taken:
+// "block" stops accepting them, "shed" turns them away with a 503
+string OVERLOAD = "block";
+// the most request body bytes workers take on at once, 0 for no limit
+long long MAX_INFLIGHT_BYTES = 64 * 1024 * 1024;
+// "host:port" of each backup we ship our writes to, if we're a primary
+vector<string> BACKUPS;
+// whether a write waits for the backups ("sync") or not ("async")
+string ACKMODE = "sync";
+// backups apply their primary's writes and turn away everyone else's
+bool IS_BACKUP = false;
+// "host:port" of the storage nodes we spread /ds3/ over, if we're a gateway
+vector<string> SHARDS;
+// how much memory a gateway caches objects in, 0 for no cache
+long long CACHE_BYTES = 64 * 1024 * 1024;
+// "N,R,W" if a gateway keeps every object on N nodes and reads and
+// writes need R and W of them
+string QUORUM;
+// how many bytes a second a gateway copies between nodes after its
+// shards change, 0 for no limit
+long long MOVE_BYTES_PER_SECOND = 4 * 1024 * 1024;
 
-vector<HttpService *> services;
+// how long we ask clients we turn away to wait before trying again
+#define RETRY_AFTER_SECONDS "1"
+// how long an idle keep-alive connection keeps its worker
+#define KEEPALIVE_TIMEOUT_MS (5000)
+// the most requests we serve on one connection before closing it
+#define MAX_REQUESTS_PER_CONNECTION (100)
 
-HttpService *find_service(HTTPRequest *request) {
-   // find a service that is registered for this path prefix
-  for (unsigned int idx = 0; idx < services.size(); idx++) {
-    if (request->getPath().find(services[idx]->pathPrefix()) == 0) {
-      return services[idx];
-    }
-  }
-
-  return NULL;
-}
+Router *router;
 
+// connections accepted and waiting for a worker, at most BUFFER_SIZE
+deque<MySocket *> connections;
+pthread_mutex_t connectionsLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t connectionsNotEmpty = PTHREAD_COND_INITIALIZER;
+pthread_cond_t connectionsNotFull = PTHREAD_COND_INITIALIZER;
 
-void invoke_service_method(HttpService *service, HTTPRequest *request, HTTPResponse *response) {
-  stringstream payload;
+// request body bytes of the requests workers are handling right now
+atomic<long long> inflightBytes(0);
 
+void invoke_service_method(HTTPRequest *request, HTTPResponse *response) {
   try {
-    // invoke the service if we found one
-    if (service == NULL) {
-      // not found status
-      response->setStatus(404);
-    } else if (request->isHead()) {
-      service->head(request, response);
-    } else if (request->isGet()) {
-      service->get(request, response);
-    } else if (request->isPut()) {
-      service->put(request, response);
-    } else if (request->isPost()) {
-      service->post(request, response);
-    } else if (request->isDelete()) {
-      service->del(request, response);
-    } else if (request->isMove()) {
-      service->move(request, response);
-    } else {
-      // The server doesn't know about this method
-      response->setStatus(501);
-    }
+    router->dispatch(request, response);
   } catch (ClientError &ce) {
     response->setStatus(ce.status_code);
   } catch (...) {
@@ -78,56 +93,212 @@ void invoke_service_method(HttpService *service, HTTPRequest *request, HTTPRespo
   }
 }
 
-void handle_request(MySocket *client) {
-  HTTPRequest *request = new HTTPRequest(client, PORT);
-  HTTPResponse *response = new HTTPResponse();
-  stringstream payload;
+// Tells the client we're too busy to serve it and when to try again.
+void reject_overloaded(HTTPResponse *response) {
+  response->setStatus(503);
+  response->setHeader("Retry-After", RETRY_AFTER_SECONDS);
+  Metrics::count(REQUESTS_SHED);
+}
+
+/**
+ * Takes on a request with a body of bodyBytes, unless that would put
+ * more than MAX_INFLIGHT_BYTES in flight. A request is always taken on
+ * when nothing else is in flight, so no body is too big to ever be let in.
+ */
+bool admit_request(long long bodyBytes) {
+  long long before = inflightBytes.fetch_add(bodyBytes);
+  if (MAX_INFLIGHT_BYTES > 0 && before > 0 && before + bodyBytes > MAX_INFLIGHT_BYTES) {
+    inflightBytes -= bodyBytes;
+    return false;
+  }
+  Metrics::addGauge(INFLIGHT_BYTES, bodyBytes);
+  return true;
+}
+
+void finish_request(long long bodyBytes) {
+  inflightBytes -= bodyBytes;
+  Metrics::addGauge(INFLIGHT_BYTES, -bodyBytes);
+}
+
+/**
+ * Reads one request from client, runs it and sends the response back.
+ * Everything that only lives as long as the request is allocated from
+ * arena, which is reset before we return. Returns whether the client can
+ * send another request on the connection, which it can't after
+ * lastRequest.
+ */
+bool handle_request(MySocket *client, Arena *arena, bool lastRequest) {
+  uint64_t start = Metrics::nowUsec();
+  HTTPRequest *request = arena->create<HTTPRequest>(client, PORT, arena);
+  HTTPResponse *response = arena->create<HTTPResponse>(arena);
+  char payload[128];
   
   // read in the request
   bool readResult = false;
   try {
-    payload << "client: " << (void *) client;
-    sync_print("read_request_enter", payload.str());
+    snprintf(payload, sizeof(payload), "client: %p", (void *) client);
+    sync_print("read_request_enter", payload);
     readResult = request->readRequest();
-    sync_print("read_request_return", payload.str());
+    sync_print("read_request_return", payload);
   } catch (...) {
     // swallow it
   }    
     
-  if (!readResult) {
+  bool admitted = false;
+  bool keepAlive = false;
+  long long bodyBytes = 0;
+  if (readResult) {
+    // a chunked body's length isn't known up front, so we count it as
+    // the biggest file a PUT can store, which is what most of them are
+    bodyBytes = request->isChunked() ? MAX_FILE_SIZE : max(request->getContentLength(), 0LL);
+    admitted = admit_request(bodyBytes);
+  }
+
+  if (readResult) {
+    if (admitted) {
+      invoke_service_method(request, response);
+      try {
+        request->discardBody();
+        keepAlive = request->keepAlive() && !lastRequest;
+      } catch (...) {
+        // swallow it, we still try to send the response
+      }
+    } else {
+      // we never read the body, so this connection can't be reused
+      reject_overloaded(response);
+    }
+    response->setHeader("Connection", keepAlive ? "keep-alive" : "close");
+
+    // send data back to the client and clean up
+    snprintf(payload, sizeof(payload), " RESPONSE %d client: %p", response->getStatus(), (void *) client);
+    sync_print("write_response", payload);
+    try {
+      response->write(client);
+    } catch (...) {
+      // the client went away while we were sending the response
+      keepAlive = false;
+    }
+    Metrics::recordRequest(request->getMethodName(), response->getStatus(), Metrics::nowUsec() - start);
+    Metrics::count(BYTES_OUT, response->getBytesSent());
+  } else {
     // there was a problem reading in the request, bail
-    delete response;
-    delete request;
-    sync_print("read_request_error", payload.str());
-    return;
+    sync_print("read_request_error", payload);
+  }
+
+  if (admitted) {
+    finish_request(bodyBytes);
+  }
+  Metrics::count(BYTES_IN, request->getBytesRead());
+  arena->destroy(response);
+  arena->destroy(request);
+  arena->reset();
+  Metrics::count(WORKER_BUSY_USEC, Metrics::nowUsec() - start);
+  return keepAlive;
+}
+
+bool connections_waiting() {
+  dthread_mutex_lock(&connectionsLock);
+  bool waiting = !connections.empty();
+  dthread_mutex_unlock(&connectionsLock);
+  return waiting;
+}
+
+/**
+ * Serves requests on client until it closes the connection or wants it
+ * closed. Between requests the connection keeps its worker for a while,
+ * but only while no other connection is waiting for one.
+ */
+void handle_connection(MySocket *client, Arena *arena) {
+  int served = 0;
+  while (true) {
+    served++;
+    if (!handle_request(client, arena, served == MAX_REQUESTS_PER_CONNECTION)) {
+      break;
+    }
+    if (!client->waitReadable(connections_waiting() ? 0 : KEEPALIVE_TIMEOUT_MS)) {
+      break;
+    }
   }
-  
-  HttpService *service = find_service(request);
-  invoke_service_method(service, request, response);
-
-  // send data back to the client and clean up
-  payload.str(""); payload.clear();
-  payload << " RESPONSE " << response->getStatus() << " client: " << (void *) client;
-  sync_print("write_response", payload.str());
-  cout << payload.str() << endl;
-  client->write(response->response());
-    
-  delete response;
-  delete request;
 
-  payload.str(""); payload.clear();
-  payload << " client: " << (void *) client;
-  sync_print("close_connection", payload.str());
-  client->close();
+  char payload[64];
+  snprintf(payload, sizeof(payload), " client: %p", (void *) client);
+  sync_print("close_connection", payload);
+  // a client may have sent more than we served
+  client->lingeringClose();
   delete client;
 }
 
+// Turns a connection away without reading its request.
+void shed_connection(MySocket *client) {
+  HTTPResponse response;
+  reject_overloaded(&response);
+  sync_print("shed_connection", "");
+  try {
+    response.write(client);
+  } catch (...) {
+    // they'll find out when they try again
+  }
+  client->lingeringClose();
+  delete client;
+}
+
+// Waits until there's a free slot in the buffer.
+void wait_for_room() {
+  dthread_mutex_lock(&connectionsLock);
+  while ((int) connections.size() >= BUFFER_SIZE) {
+    dthread_cond_wait(&connectionsNotFull, &connectionsLock);
+  }
+  dthread_mutex_unlock(&connectionsLock);
+}
+
+// Hands client to a worker, returning false if the buffer is full.
+bool enqueue_connection(MySocket *client) {
+  bool queued = false;
+  dthread_mutex_lock(&connectionsLock);
+  if ((int) connections.size() < BUFFER_SIZE) {
+    connections.push_back(client);
+    Metrics::setGauge(QUEUE_DEPTH, connections.size());
+    dthread_cond_signal(&connectionsNotEmpty);
+    queued = true;
+  }
+  dthread_mutex_unlock(&connectionsLock);
+  return queued;
+}
+
+MySocket *dequeue_connection() {
+  dthread_mutex_lock(&connectionsLock);
+  while (connections.empty()) {
+    dthread_cond_wait(&connectionsNotEmpty, &connectionsLock);
+  }
+  MySocket *client = connections.front();
+  connections.pop_front();
+  Metrics::setGauge(QUEUE_DEPTH, connections.size());
+  dthread_cond_signal(&connectionsNotFull);
+  dthread_mutex_unlock(&connectionsLock);
+  return client;
+}
+
+// Each worker handles one connection at a time with an arena of its own.
+void *worker(void *arg) {
+  Arena arena;
+  while (true) {
+    handle_connection(dequeue_connection(), &arena);
+  }
+  return NULL;
+}
+
+void usage(char *program) {
+  cerr<< "usage: " << program << " [-p port] [-t threads] [-b buffers] [-i diskFile] [-o block|shed] [-m maxInflightBytes]"
+      << " [-B backup,... [-A sync|async] | -R | -S node[|backup...],... [-C cacheBytes] [-Q N,R,W] [-M moveBytesPerSecond]]" << endl;
+  exit(1);
+}
+
 int main(int argc, char *argv[]) {
 
   signal(SIGPIPE, SIG_IGN);
   int option;
 
-  while ((option = getopt(argc, argv, "d:p:t:b:s:l:i:")) != -1) {
+  while ((option = getopt(argc, argv, "d:p:t:b:s:l:i:o:m:B:A:RS:C:Q:M:")) != -1) {
     switch (option) {
     case 'd':
       BASEDIR = string(optarg);
@@ -150,12 +321,45 @@ int main(int argc, char *argv[]) {
     case 'i':
       DISKFILE = string(optarg);
       break;
+    case 'o':
+      OVERLOAD = string(optarg);
+      break;
+    case 'm':
+      MAX_INFLIGHT_BYTES = atoll(optarg);
+      break;
+    case 'B':
+      BACKUPS = StringUtils::split(string(optarg), ',');
+      break;
+    case 'A':
+      ACKMODE = string(optarg);
+      break;
+    case 'R':
+      IS_BACKUP = true;
+      break;
+    case 'S':
+      SHARDS = StringUtils::split(string(optarg), ',');
+      break;
+    case 'C':
+      CACHE_BYTES = atoll(optarg);
+      break;
+    case 'Q':
+      QUORUM = string(optarg);
+      break;
+    case 'M':
+      MOVE_BYTES_PER_SECOND = atoll(optarg);
+      break;
     default:
-      cerr<< "usage: " << argv[0] << " [-p port] [-t threads] [-b buffers] [-i diskFile]" << endl;
-      exit(1);
+      usage(argv[0]);
     }
   }
 
+  if (THREAD_POOL_SIZE < 1 || BUFFER_SIZE < 1 || CACHE_BYTES < 0 || MOVE_BYTES_PER_SECOND < 0 || (OVERLOAD != "block" && OVERLOAD != "shed") ||
+      (ACKMODE != "sync" && ACKMODE != "async") || (IS_BACKUP && BACKUPS.size() > 0) ||
+      (SHARDS.size() > 0 && (IS_BACKUP || BACKUPS.size() > 0)) ||
+      (QUORUM.size() > 0 && (SHARDS.size() == 0 || StringUtils::split(QUORUM, ',').size() != 3))) {
+    usage(argv[0]);
+  }
+
   set_log_file(LOGFILE);
 
   cout << "Listening on port " << PORT << endl;
@@ -164,15 +368,50 @@ int main(int argc, char *argv[]) {
   MyServerSocket *server = new MyServerSocket(PORT);
   MySocket *client;
 
-  // The order that you push services dictates the search order
-  // for path prefix matching
-  services.push_back(new DistributedFileSystemService(DISKFILE));
-  services.push_back(new FileService(BASEDIR));
+  // requests go to the route for their exact path if there is one, or else
+  // to the service mounted at the longest prefix of their path
+  router = new Router();
+  if (SHARDS.size() > 0) {
+    // a gateway keeps no objects of its own
+    ShardService *shards = new ShardService(SHARDS, CACHE_BYTES, MOVE_BYTES_PER_SECOND);
+    if (QUORUM.size() > 0) {
+      vector<string> quorum = StringUtils::split(QUORUM, ',');
+      shards->setQuorum(atoi(quorum[0].c_str()), atoi(quorum[1].c_str()), atoi(quorum[2].c_str()));
+    }
+    router->addService(shards);
+    RebalanceService *rebalance = new RebalanceService(shards);
+    rebalance->addRoutes(router);
+  } else {
+    DistributedFileSystemService *fileSystem = new DistributedFileSystemService(DISKFILE);
+    router->addService(fileSystem);
+    if (BACKUPS.size() > 0) {
+      fileSystem->setReplicator(new Replicator(fileSystem, BACKUPS, ACKMODE == "sync"));
+    }
+    if (IS_BACKUP) {
+      fileSystem->setReadOnly(true);
+      router->addService(new ReplicationService(fileSystem, DISKFILE + ".replication"));
+    }
+  }
+  router->addService(new FileService(BASEDIR));
+  router->addService(new MetricsService());
+  Metrics::setGauge(WORKERS, THREAD_POOL_SIZE);
+
+  for (int idx = 0; idx < THREAD_POOL_SIZE; idx++) {
+    pthread_t thread;
+    dthread_create(&thread, NULL, worker, NULL);
+    dthread_detach(thread);
+  }
   
   while(true) {
+    if (OVERLOAD == "block") {
+      // leave new connections in the listen backlog until a worker frees up
+      wait_for_room();
+    }
     sync_print("waiting_to_accept", "");
     client = server->accept();
     sync_print("client_accepted", "");
-    handle_request(client);
+    if (!enqueue_connection(client)) {
+      shed_connection(client);
+    }
   }
 }
@@ -0,0 +1,54 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+#include <memory_resource>
+#include <new>
+#include <utility>
+#include <vector>
+
+/**
+ * A bump allocator for everything that lives only as long as one request:
+ * the request and response objects, the parser's strings and the header
+ * table. Allocating is a pointer bump, freeing does nothing, and reset
+ * throws it all away at once when the request is done so the next
+ * request on the connection reuses the same memory.
+ *
+ * Containers use it through std::pmr. Objects made with create have to
+ * be destroyed with destroy before reset since reset runs no destructors.
+ */
+class Arena : public std::pmr::memory_resource {
+ public:
+  Arena(size_t blockSize = 16 * 1024);
+  ~Arena();
+
+  void reset();
+
+  template <class T, class... Args> T *create(Args &&... args) {
+    return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+  }
+
+  template <class T> void destroy(T *object) {
+    if (object != NULL) {
+      object->~T();
+    }
+  }
+
+ protected:
+  virtual void *do_allocate(size_t bytes, size_t alignment);
+  virtual void do_deallocate(void *p, size_t bytes, size_t alignment);
+  virtual bool do_is_equal(const std::pmr::memory_resource &other) const noexcept;
+
+ private:
+  void newBlock(size_t minSize);
+
+  size_t m_blockSize;
+  // the first block is kept across resets, the rest are for requests that
+  // outgrow it and are freed by reset
+  std::vector<char *> m_blocks;
+  char *m_next;
+  char *m_end;
+};
+
+#endif
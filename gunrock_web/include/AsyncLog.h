@@ -0,0 +1,26 @@
+#ifndef _ASYNC_LOG_H_
+#define _ASYNC_LOG_H_
+
+#include <string>
+#include <string_view>
+
+/**
+ * The log behind sync_print. Each thread appends its lines to a ring
+ * buffer of its own without taking a lock, and a background thread
+ * drains the rings into the log file in batches. A thread's ring goes
+ * to the next thread that logs once it exits, and if too many threads
+ * are logging at once the rest share one ring under a lock.
+ *
+ * Every line takes a number from one atomic counter when it is logged
+ * and the writer puts the lines back in that order, so the file reads
+ * exactly as if every thread had written it under one lock. Thread ids
+ * are handed out in the order threads first log, as they always were.
+ */
+class AsyncLog {
+ public:
+  static void open(std::string fileName);
+  static void log(std::string_view function, std::string_view payload);
+  static void flush();
+};
+
+#endif
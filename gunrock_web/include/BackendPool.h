@@ -0,0 +1,88 @@
+#ifndef _BACKEND_POOL_H_
+#define _BACKEND_POOL_H_
+
+#include <pthread.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "HTTPClientResponse.h"
+#include "HttpConnectionPool.h"
+#include "MySocket.h"
+
+// A storage node a gateway forwards requests to.
+struct Backend {
+  std::string name;  // "host:port"
+  std::string host;
+  int port;
+  // requests sent and not yet answered
+  std::atomic<int> outstanding;
+  std::atomic<bool> healthy;
+};
+
+/**
+ * The connections a gateway keeps open to its storage nodes. Each
+ * request borrows an idle keep-alive connection to its node, or opens
+ * one if there isn't any, and gives it back when the response has been
+ * read, so most requests skip the connect.
+ *
+ * A node that fails a request, or doesn't answer it in time, is marked
+ * unhealthy and left out of choose() until a health check gets an
+ * answer from it again. Every node has a thread of its own asking it for
+ * HEAD /ds3/ once a second, so one that hangs doesn't hold up the checks
+ * of the others.
+ */
+class BackendPool {
+ public:
+  BackendPool();
+
+  // Adds the node at "host:port", returning NULL if name isn't one.
+  Backend *add(std::string name);
+
+  // The healthy candidate with the fewest requests outstanding. If none
+  // of them are healthy we try the first one anyway.
+  Backend *choose(const std::vector<Backend *> &candidates);
+
+  /**
+   * Sends a request to backend and reads its response, which the caller
+   * deletes. A connection that was idle may have been closed by the node
+   * just as we took it, so we send the request again on a new one if
+   * that's safe: the method is idempotent, and either sending failed or
+   * the connection closed before any of the response came back. Throws
+   * a SocketError if the node can't be reached or doesn't answer in
+   * time.
+   */
+  HTTPClientResponse *send(Backend *backend, std::string method, std::string url,
+                           const std::map<std::string, std::string> &headers, std::string body);
+
+  /**
+   * Sends the same request to every one of backends and only then reads
+   * their responses, so the nodes all work on it at once without a
+   * thread each. Returns a response for each backend, or NULL for those
+   * we couldn't get one from, which the caller deletes.
+   */
+  std::vector<HTTPClientResponse *> sendAll(const std::vector<Backend *> &backends, std::string method,
+                                            std::string url);
+
+  void startHealthChecks();
+
+ private:
+  struct HealthCheck {
+    BackendPool *pool;
+    Backend *backend;
+  };
+
+  void setHealthy(Backend *backend, bool healthy);
+  void startHealthCheck(Backend *backend);
+  static void *healthLoop(void *arg);
+
+  pthread_mutex_t m_lock;
+  std::vector<Backend *> m_backends;
+  bool m_checkingHealth;
+  // open connections no request is using
+  HttpConnectionPool m_connections;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef _BODY_STREAM_H_
+#define _BODY_STREAM_H_
+
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <zlib.h>
+
+#include "MySocket.h"
+
+/**
+ * A response body that is produced while it is written to the client
+ * instead of being held in memory as one string.
+ */
+class BodyStream {
+ public:
+  virtual ~BodyStream() {}
+
+  // total size of the body in bytes, or -1 if it isn't known up front,
+  // in which case the body is sent with chunked transfer encoding
+  virtual int size() = 0;
+
+  // copy up to len bytes of the body into buffer, returns 0 at the end
+  virtual int read(void *buffer, int len) = 0;
+
+  // streams that can send their whole body to the client without going
+  // through read (e.g. with sendfile) return true here and do so in
+  // sendTo, which is called once the headers have been written
+  virtual bool sendsItself() { return false; }
+  virtual void sendTo(MySocket * /*client*/) {}
+};
+
+// A body stream over a string we already have in memory.
+class StringBodyStream : public BodyStream {
+ public:
+  StringBodyStream(std::string data);
+
+  virtual int size();
+  virtual int read(void *buffer, int len);
+
+ private:
+  std::string data;
+  size_t offset;
+};
+
+// A body stream over part of an open file that is sent with sendfile.
+// The stream doesn't own the file descriptor.
+class FileDescriptorBodyStream : public BodyStream {
+ public:
+  FileDescriptorBodyStream(int fd, off_t offset, int length);
+
+  virtual int size();
+  virtual int read(void *buffer, int len);
+  virtual bool sendsItself() { return true; }
+  virtual void sendTo(MySocket *client);
+
+ private:
+  int fd;
+  off_t offset;
+  int remaining;
+  int length;
+};
+
+// Sends several body streams back to back, e.g. the parts of a
+// multipart response. Takes ownership of the streams it is given.
+class MultiBodyStream : public BodyStream {
+ public:
+  MultiBodyStream();
+  ~MultiBodyStream();
+
+  void add(BodyStream *stream);
+
+  virtual int size();
+  virtual int read(void *buffer, int len);
+
+ private:
+  std::vector<BodyStream *> streams;
+  size_t current;
+};
+
+// Compresses another body stream with gzip or deflate as it is read.
+// The compressed size isn't known up front, so it is sent chunked.
+// Takes ownership of the source stream.
+class DeflateBodyStream : public BodyStream {
+ public:
+  DeflateBodyStream(BodyStream *source, bool gzip);
+  ~DeflateBodyStream();
+
+  virtual int size();
+  virtual int read(void *buffer, int len);
+
+ private:
+  BodyStream *source;
+  z_stream zstream;
+  bool sourceDone;
+  bool finished;
+  unsigned char input[4096];
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef _BULK_TRANSFER_H_
+#define _BULK_TRANSFER_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "HTTPClientResponse.h"
+#include "HttpConnectionPool.h"
+
+// What a bulk transfer has done so far.
+struct BulkTransferStats {
+  uint64_t files;
+  uint64_t bytes;
+  uint64_t retries;
+  uint64_t failures;
+  double seconds;
+};
+
+/**
+ * Uploads a local directory tree to a server's /ds3/ namespace, or
+ * downloads one from it, with a number of requests in flight at once
+ * so the server rather than one request at a time sets the pace. Each
+ * worker thread keeps a keep-alive connection for all its requests.
+ *
+ * A request that can't reach the server, or that it turns away with a
+ * 502, 503 or 504, is tried again after a backoff that doubles each
+ * time. Any other failure, or running
+ * out of tries, counts the file as failed and moves on to the next.
+ */
+class BulkTransfer {
+ public:
+  BulkTransfer(std::string host, int port, int connections, int retries);
+
+  // Reports progress to out about once a second while a transfer runs.
+  void setProgress(std::ostream *out);
+
+  /**
+   * Copies every file under localDir to remoteDir, a path under /ds3/,
+   * keeping their paths relative to it. Directories on the server are
+   * made by the files put in them, so empty ones aren't copied.
+   */
+  BulkTransferStats upload(std::string localDir, std::string remoteDir);
+  // Copies everything under remoteDir, a path under /ds3/, to localDir.
+  BulkTransferStats download(std::string remoteDir, std::string localDir);
+
+  // Files that failed in the last transfer, by their remote path.
+  std::vector<std::string> failed();
+
+ private:
+  // a file to upload, or a file or directory to download
+  struct Job {
+    std::string remote;
+    std::string local;
+  };
+
+  BulkTransferStats run(bool upload, std::deque<Job> jobs);
+  static void *workLoop(void *arg);
+  static void *progressLoop(void *arg);
+  bool nextJob(Job *job);
+  void finishJob();
+  void addJob(const Job &job);
+  void transfer(const Job &job);
+  bool uploadFile(const Job &job);
+  bool downloadPath(const Job &job);
+  HTTPClientResponse *send(std::string method, std::string path, const std::string &body);
+  BulkTransferStats stats();
+
+  std::string m_host;
+  int m_port;
+  int m_connections;
+  int m_retries;
+  std::ostream *m_progress;
+  HttpConnectionPool m_pool;
+
+  pthread_mutex_t m_lock;
+  pthread_cond_t m_changed;
+  bool m_upload;
+  std::deque<Job> m_jobs;
+  // jobs being worked on, which may add more
+  int m_active;
+  bool m_done;
+  std::vector<std::string> m_failed;
+  uint64_t m_startUsec;
+  std::atomic<uint64_t> m_files;
+  std::atomic<uint64_t> m_bytes;
+  std::atomic<uint64_t> m_retried;
+  std::atomic<uint64_t> m_failures;
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <deque>
+#include <vector>
 
 struct UndoRecord {
   int blockNumber;
@@ -23,6 +24,11 @@ class Disk {
   // 一个事务里边的所有程序代码，要么全部执行成功，要么全部不执行
   // 如果成功，就commit
   // 如果不成功，就执行回滚
+
+  // Transactions nest: a beginTransaction inside an open transaction
+  // starts a savepoint. Its rollback only undoes the writes made since
+  // the savepoint and its commit folds them into the outer transaction,
+  // which is the only one that makes them permanent.
   
  private:
   std::string imageFile;
@@ -30,6 +36,8 @@ class Disk {
   int imageFileSize;
   bool isInTransaction;
   std::deque<struct UndoRecord> undoLog;
+  // undoLog sizes at the start of each open (nested) transaction
+  std::vector<size_t> savepoints;
 };
 
 #endif
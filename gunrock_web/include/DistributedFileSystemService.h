@@ -1,21 +1,103 @@
 #ifndef _DISTRIBUTEDFILESYSTEMSERVICE_H_
 #define _DISTRIBUTEDFILESYSTEMSERVICE_H_
 
+#include "BodyStream.h"
 #include "HttpService.h"
 #include "LocalFileSystem.h"
+#include "ObjectVersions.h"
+#include "Replication.h"
 
+#include <pthread.h>
+
+#include <map>
 #include <string>
+#include <string_view>
+#include <vector>
+
+// One operation of a batch. Operations are framed as
+// "op pathLength dataLength\n" followed by the path and the data, the
+// same way replication records are, and results come back framed as
+// "status pathLength dataLength\n" followed by the path and the data:
+// the contents or listing for a GET, the new ETag for a PUT.
+struct BatchOperation {
+  static const char GET = 'G';
+  static const char PUT = 'P';
+  static const char DELETE = 'D';
+
+  char op;
+  std::string path;
+  // the new contents of the file for a PUT, empty otherwise
+  std::string data;
+
+  // Decodes the operation at the start of in, returning how many bytes
+  // it took up or 0 if in doesn't start with a whole operation.
+  static size_t decode(std::string_view in, BatchOperation *operation);
+};
 
 class DistributedFileSystemService : public HttpService {
  public:
   DistributedFileSystemService(std::string driveFile);
 
+  virtual void head(HTTPRequest *request, HTTPResponse *response);
   virtual void get(HTTPRequest *request, HTTPResponse *response);
   virtual void put(HTTPRequest *request, HTTPResponse *response);
   virtual void del(HTTPRequest *request, HTTPResponse *response);
+  // Runs a batch of operations posted to /ds3/ itself.
+  virtual void post(HTTPRequest *request, HTTPResponse *response);
+
+  // Applies a write shipped to us by our primary.
+  void apply(const ReplicationRecord &record);
+  // A checksum of every disk block, one per line in hex.
+  std::string checksums();
+  // Encodes BLOCK records for the blocks whose checksums differ from
+  // ours, returning false if there's a different number of blocks. seq
+  // is set to the last write the blocks include and count to how many
+  // there are.
+  bool diffBlocks(const std::string &checksums, std::string *blocks, uint64_t *seq, int *count);
+  // The most bytes diffBlocks can encode, if every block differs.
+  size_t maxDiffBytes();
+  // Writes the blocks another node's diffBlocks sent us.
+  void applyBlocks(std::string_view blocks);
+  // Ships every write we commit to backups with replicator.
+  void setReplicator(Replicator *replicator);
+  // Turns away writes from clients, for backups.
+  void setReadOnly(bool readOnly);
 
 private:
+  // the directories a batch has already walked to, by their path
+  typedef std::map<std::string, int> DirectoryCache;
+
+  int lookupPath(std::string path);
+  int lookupPath(const std::string &path, DirectoryCache *directories);
+  int resolveParent(const std::string &path, bool create, DirectoryCache *directories, std::string *name);
+  int statPath(HTTPRequest *request, HTTPResponse *response, inode_t *inode);
+  std::string makeETag(int inum);
+  bool checkPreconditions(HTTPRequest *request, std::string etag, bool isRead);
+  bool requestVersion(HTTPRequest *request, ObjectVersion *version);
+  bool supersedes(std::string path, const ObjectVersion &version, HTTPResponse *response);
+  void compressBody(HTTPRequest *request, HTTPResponse *response);
+  BodyStream *streamFile(int inum, const inode_t &inode, int offset, int length);
+  void sendFile(HTTPRequest *request, HTTPResponse *response, int inum, inode_t inode);
+  int createFile(std::string path, DirectoryCache *directories);
+  std::string listDirectory(int inum, const inode_t &inode);
+  void writeContents(int inum, const std::string &data);
+  int stageBody(HTTPRequest *request, std::string *copy);
+  std::string readContents(int inum);
+  void removePath(std::string path, HTTPRequest *request);
+  void runReads(std::vector<BatchOperation> &operations, MultiBodyStream *results);
+  void runWrites(std::vector<BatchOperation> &operations, MultiBodyStream *results, HTTPResponse *response);
+  void readEntry(const std::string &path, DirectoryCache *directories, MultiBodyStream *results, bool stream);
+
   LocalFileSystem *fileSystem;
+  // held shared by requests that only read the file system, and by the
+  // streams sending file data after them while they read each block, and
+  // exclusively by writes; never held while talking to a client
+  pthread_rwlock_t fileSystemLock;
+  std::string etagEpoch;
+  Replicator *replicator;
+  bool readOnly;
+  // versions of the writes quorum gateways sent us
+  ObjectVersions *versions;
 };
 
 #endif
@@ -3,7 +3,45 @@
 
 #include "HttpService.h"
 
+#include <list>
+#include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
+
+#include <pthread.h>
+#include <sys/types.h>
+
+// A compressed copy of a static file along with the headers to send it
+// with. contents is empty if compressing didn't make the file smaller.
+struct StaticVariant {
+  std::shared_ptr<const std::string> contents;
+  std::shared_ptr<const std::string> headers;
+};
+
+// A static file along with everything we serve it with. Small files keep
+// their contents in memory; larger ones keep a descriptor open to send
+// from, which is closed once the file has left the cache and the last
+// response sending it is done.
+struct StaticFile {
+  StaticFile();
+  ~StaticFile();
+
+  size_t memoryUsed();
+
+  int fd;
+  off_t size;
+  ino_t inode;
+  time_t mtime;
+  std::string contentType;
+  std::string etag;
+  std::shared_ptr<const std::string> contents;
+  std::shared_ptr<const std::string> headers;
+  bool compressible;
+  std::map<std::string, StaticVariant> variants;
+  // whether the file is in the cache, and so counts toward its budget
+  bool cached;
+};
 
 class FileService : public HttpService {
  public:
@@ -14,9 +52,27 @@ class FileService : public HttpService {
 
 private:
   bool endswith(std::string str, std::string suffix);
-  std::string readFile(std::string path);
+  std::shared_ptr<StaticFile> lookupFile(std::string path);
+  std::shared_ptr<StaticFile> lookupCachedFile(std::string path, bool exists, const struct stat &st);
+  std::shared_ptr<StaticFile> loadFile(std::string path, const struct stat &st);
+  StaticVariant compressedVariant(std::shared_ptr<StaticFile> file, std::string encoding);
+  const StaticVariant &makeVariant(std::shared_ptr<StaticFile> file, std::string encoding);
+
+  struct CachedFile {
+    std::shared_ptr<StaticFile> file;
+    // where the file's path is in m_lru
+    std::list<std::string>::iterator lru;
+  };
+  void eraseFile(std::unordered_map<std::string, CachedFile>::iterator iter);
+  void evictFiles();
 
   std::string m_basedir;
+  // guards the cache and the variants of every file in it
+  pthread_mutex_t m_lock;
+  std::unordered_map<std::string, CachedFile> m_files;
+  // paths of the cached files, most recently used first
+  std::list<std::string> m_lru;
+  size_t m_cachedBytes;
 };
 
 #endif
@@ -3,7 +3,9 @@
 
 #include "http_parser.h"
 
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 
@@ -11,7 +13,8 @@ class HTTP {
  public:
     typedef enum {INIT, HEADER, FIELD, VALUE, BODY, DONE} HttpState;
 
-    HTTP(http_parser_type httpType = HTTP_REQUEST);
+    HTTP(http_parser_type httpType = HTTP_REQUEST,
+         std::pmr::memory_resource *memory = std::pmr::get_default_resource());
     ~HTTP();
 
     int addData(const unsigned char *data, int len);
@@ -21,7 +24,7 @@ class HTTP {
     std::string getReplyHeader();
     std::string getHost();
     std::string getUrl();
-    std::string getPath();
+    std::string_view getPath() {return m_path;}
     bool isConnect() {return m_method == HTTP_CONNECT;}
     bool isHead() {return m_method == HTTP_HEAD;}
     bool isGet() {return m_method == HTTP_GET;}
@@ -29,11 +32,17 @@ class HTTP {
     bool isPost() {return m_method == HTTP_POST;}
     bool isDelete() {return m_method == HTTP_DELETE;}
     bool isMove() {return m_method == HTTP_MOVE;}
+    const char *getMethodName() {return http_method_str((enum http_method) m_method);}
     std::string getBody();
-    std::string getQuery() {return m_query;}
-    std::vector< std::pair< std::string *, std::string *> > getHeaders() {
-      return m_headers;
-    }
+    void takeBody(std::pmr::string &body);
+    long long getContentLength() {return m_contentLength;}
+    // whether the client wants to send more requests on this connection
+    bool keepAlive() {return m_keepAlive;}
+    std::string getQuery() {return std::string(m_query);}
+    bool findHeader(std::string_view name, std::string_view *value);
+    size_t headerCount() {return m_headers.size();}
+    std::string_view headerName(size_t idx);
+    std::string_view headerValue(size_t idx);
   
  private:
     static int message_begin_cb(http_parser *parser);
@@ -55,6 +64,7 @@ class HTTP {
     void appendHeaderValue(const char *at, size_t len);
     void addHeaderField();
     void messageComplete(unsigned char method);
+    void indexHeaders();
 
     http_parser_settings m_settings;
     http_parser m_parser;
@@ -62,14 +72,32 @@ class HTTP {
     bool m_doneParsing;
     bool m_headerDone;
 
-    std::string m_url;
-    std::string m_path;
-    std::string m_query;
+    // everything we parse out of the request lives in the memory we're
+    // given, which is usually the request's arena
+    std::pmr::string m_url;
+    std::pmr::string m_path;
+    std::pmr::string m_query;
     std::string m_host;
-    std::string *m_field;
-    std::string *m_value;
-    std::vector< std::pair< std::string *, std::string *> > m_headers;
-    std::string m_body;
+
+    // where one header's name and value are in m_headerBuffer
+    struct HeaderEntry {
+        unsigned int nameOffset;
+        unsigned int nameLength;
+        unsigned int valueOffset;
+        unsigned int valueLength;
+    };
+    // every header name and value back to back, which the headers point
+    // into by offset since the buffer moves as it grows
+    std::pmr::string m_headerBuffer;
+    std::pmr::vector<HeaderEntry> m_headers;
+    bool m_pendingHeader;
+    // open addressing hash of lower case header names to m_headers
+    // indexes, built the first time a header is looked up
+    std::pmr::vector<int> m_headerIndex;
+    size_t m_indexedHeaders;
+    std::pmr::string m_body;
+    long long m_contentLength;
+    bool m_keepAlive;
     std::string m_statusStr;
     unsigned char m_method;
     http_parser_type m_httpType;
@@ -9,12 +9,15 @@
 #include "StringUtils.h"
 
 #include <map>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <vector>
 
 class HTTPRequest {
 public:
-  HTTPRequest(MySocket *sock, int serverPort);
+  HTTPRequest(MySocket *sock, int serverPort,
+              std::pmr::memory_resource *memory = std::pmr::get_default_resource());
   ~HTTPRequest();
   
   bool readRequest();
@@ -22,9 +25,11 @@ public:
   std::string getHost();
   std::string getRequest();
   std::string getUrl();
-  std::string getPath();
+  std::string_view getPath();
+  std::string getPathParam(std::string name);
+  void addPathParam(std::string_view name, std::string_view value);
   std::vector<std::string> getPathComponents();
-  std::string getHeader(std::string key);
+  bool findHeader(std::string_view name, std::string_view *value);
   bool hasAuthToken();
   std::string getAuthToken();
   bool isConnect();
@@ -34,20 +39,34 @@ public:
   bool isPost() {return m_http->isPost();}
   bool isDelete() {return m_http->isDelete();}
   bool isMove() {return m_http->isMove();}
+  const char *getMethodName() {return m_http->getMethodName();}
+  unsigned long getBytesRead() {return m_totalBytesRead;}
   std::map<std::string, std::string> getParams();
   WwwFormEncodedDict formEncodedBody();
-  std::string getBody() {return m_http->getBody();}
+  std::string getBody();
+  bool getBody(std::string *body, size_t maxBytes);
+  int readBody(void *buffer, int len);
+  void discardBody();
+  long long getContentLength() {return m_http->getContentLength();}
+  bool isChunked();
+  bool keepAlive() {return m_http->keepAlive();}
   
   void printDebugInfo();
     
  protected:
     void onRead(const char *buffer, unsigned int len);
+    void readMore();
 
     MySocket *m_sock;
+    std::pmr::memory_resource *m_memory;
     HTTP *m_http;
     int m_serverPort;
     unsigned long m_totalBytesRead;
     unsigned long m_totalBytesWritten;
+    std::pmr::string m_bodyChunk;
+    size_t m_bodyOffset;
+    // views into the router's names and our path
+    std::pmr::vector<std::pair<std::string_view, std::string_view> > m_pathParams;
 };
 
 #endif
@@ -2,27 +2,51 @@
 #define HTTP_RESPONSE_H_
 
 #include <map>
+#include <memory>
+#include <memory_resource>
 #include <string>
+#include <string_view>
+
+#include "BodyStream.h"
+#include "MySocket.h"
 
 class HTTPResponse {
  public:
-  HTTPResponse();
+  HTTPResponse(std::pmr::memory_resource *memory = std::pmr::get_default_resource());
+  ~HTTPResponse();
   void withStreaming();
-  void setHeader(std::string name, std::string value);
+  void withoutBody(int contentLength);
+  void setHeader(std::string_view name, std::string_view value);
   void setBody(std::string data);
-  void setContentType(std::string contentType);
+  void setBodyStream(BodyStream *stream);
+  void setSharedBody(std::shared_ptr<const std::string> data);
+  void setPreparedHeaders(std::shared_ptr<const std::string> lines);
+  void encodeBody(std::string encoding);
+  void setContentType(std::string_view contentType);
   void setStatus(int status);
   int getStatus();
+  long long getBytesSent();
+  int bodySize();
   std::string response();
+  void write(MySocket *client);
 
  private:
   std::string statusToString();
+  const std::string &headerBlock();
+  void sendVector(MySocket *client, struct iovec *iov, int iovcnt);
 
   int status;
   bool streaming;
-  std::map<std::string, std::string> headers;
+  bool headOnly;
+  int contentLength;
+  long long bytesSent;
+  // headers live in the request's memory, usually its arena
+  std::pmr::map<std::pmr::string, std::pmr::string, std::less<> > headers;
   std::string body;
-  std::string contentType;
+  std::shared_ptr<const std::string> sharedBody;
+  std::shared_ptr<const std::string> preparedHeaders;
+  BodyStream *bodyStream;
+  std::pmr::string contentType;
 };
 
 #endif
@@ -0,0 +1,41 @@
+#ifndef _HASH_RING_H_
+#define _HASH_RING_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * A consistent hash ring. Every node is placed on the ring at a number
+ * of pseudo-random points (virtual nodes) and a key belongs to the node
+ * at the first point at or after the key's own hash, wrapping around.
+ * Virtual nodes spread each node's share of the keys over many small
+ * arcs, so shares stay even and adding or removing a node only moves
+ * the keys on the arcs it gains or loses.
+ */
+class HashRing {
+ public:
+  HashRing(int virtualNodes = 64);
+
+  void addNode(std::string node);
+  void removeNode(std::string node);
+  bool hasNode(std::string node);
+  std::vector<std::string> nodes();
+
+  // The node that owns key, or "" if the ring is empty.
+  std::string owner(std::string_view key);
+  // The first count distinct nodes at or after key, owner first.
+  std::vector<std::string> owners(std::string_view key, int count);
+
+  static uint64_t hash(std::string_view key);
+
+ private:
+  int m_virtualNodes;
+  std::vector<std::string> m_nodes;
+  std::map<uint64_t, std::string> m_points;
+};
+
+#endif
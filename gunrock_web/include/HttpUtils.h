@@ -22,6 +22,13 @@ class HttpUtils {
 
   static std::vector<std::string> split(const std::string &s, char delim);
 
+  static bool parseRange(std::string header, int size,
+                         std::vector<std::pair<int, int> > &ranges);
+  static bool etagMatches(std::string header, std::string etag, bool weak);
+
+  static std::string negotiateEncoding(std::string acceptEncoding);
+  static std::string compress(const std::string &data, std::string encoding);
+
  private:
   static std::vector<std::string> &split(const std::string &s,
 					 char delim,
@@ -2,6 +2,7 @@
 #define _LOCAL_FILE_SYSTEM_H_
 
 #include <string>
+#include <vector>
 
 #include "Disk.h"
 #include "ufs.h"
@@ -100,6 +101,34 @@ class LocalFileSystem {
    */
   int write(int inodeNumber, const void *buffer, int size);
 
+  /**
+   * Write part of a file.
+   *
+   * Writes a buffer of size to the file starting `offset` bytes into it,
+   * allocating data blocks as the file grows. Unlike write, content past
+   * the end of the written range is kept, so a file can be filled in
+   * piece by piece and then cut to its final size with truncate.
+   *
+   * Success: number of bytes written
+   * Failure: -EINVALIDINODE, -EINVALIDSIZE, -EWRITETODIR, -ENOTENOUGHSPACE.
+   * Failure modes: invalid inodeNumber, invalid size, offset past the
+   * end of the file, not a regular file, or not enough space on disk.
+   */
+  int write(int inodeNumber, const void *buffer, int size, int offset);
+
+  /**
+   * Shrink a file.
+   *
+   * Sets the size of the file to `size` bytes and frees the data blocks
+   * that are no longer used.
+   *
+   * Success: 0
+   * Failure: -EINVALIDINODE, -EINVALIDSIZE, -EWRITETODIR.
+   * Failure modes: invalid inodeNumber, size larger than the file, not a
+   * regular file.
+   */
+  int truncate(int inodeNumber, int size);
+
   /**
    * Read the contents of a file or directory.
    *
@@ -126,7 +155,51 @@ class LocalFileSystem {
    * existing is NOT a failure by our definition. You can't unlink '.' or '..'
    */
   int unlink(int parentInodeNumber, std::string name);
+
+  /**
+   * Make a file that isn't in any directory.
+   *
+   * Allocates an empty regular file that can be filled in with write and
+   * then given a name with replace, or thrown away with release.
+   *
+   * Success: inode number of the new file
+   * Failure: -ENOTENOUGHSPACE.
+   * Failure modes: no free inodes.
+   */
+  int createUnlinked();
+
+  /**
+   * Move the contents of one file into another.
+   *
+   * Frees the data blocks of inodeNumber, gives it the data of
+   * sourceInodeNumber, and then frees sourceInodeNumber, which must be a
+   * file made by createUnlinked.
+   *
+   * Success: 0
+   * Failure: -EINVALIDINODE, -EWRITETODIR.
+   * Failure modes: either inode is invalid, or either isn't a regular file.
+   */
+  int replace(int inodeNumber, int sourceInodeNumber);
+
+  /**
+   * Free a file made by createUnlinked along with its data.
+   *
+   * Success: 0
+   * Failure: -EINVALIDINODE, -EWRITETODIR.
+   * Failure modes: invalid inodeNumber, not a regular file.
+   */
+  int release(int inodeNumber);
   
+  /**
+   * Modification counter of an inode.
+   *
+   * Goes up every time the inode or its data is changed through this
+   * object: when a file is written or truncated, when an entry is added
+   * to or removed from a directory, and when an inode is allocated or
+   * freed. Counters only live in memory and start at 0.
+   */
+  unsigned int generation(int inodeNumber);
+
   /**
    * Some helper functions that you need to implement and use in your
    * implementation of the higher-level functions. When you operate on
@@ -147,6 +220,11 @@ class LocalFileSystem {
   // it in a function you add that is not part of the LocalFileSystem object but
   // can still access the disk.
   Disk *disk;
+
+ private:
+  void modified(int inodeNumber);
+
+  std::vector<unsigned int> generations;
 };  
 
 #endif
@@ -0,0 +1,81 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+
+// Counters we keep. Their names and help text are in Metrics.cpp.
+enum MetricCounter {
+  BYTES_IN,
+  BYTES_OUT,
+  DISK_BLOCKS_READ,
+  DISK_BLOCKS_WRITTEN,
+  DISK_SYNCS,
+  LFS_LOOKUPS,
+  LFS_READS,
+  LFS_WRITES,
+  LFS_CREATES,
+  LFS_UNLINKS,
+  STATIC_CACHE_HITS,
+  STATIC_CACHE_MISSES,
+  WORKER_BUSY_USEC,
+  REQUESTS_SHED,
+  REPLICATION_RECORDS_SENT,
+  REPLICATION_FAILURES,
+  REPLICATION_RESYNC_BLOCKS,
+  BACKEND_REQUESTS,
+  BACKEND_CONNECTIONS_OPENED,
+  BACKEND_FAILURES,
+  GATEWAY_CACHE_HITS,
+  GATEWAY_CACHE_MISSES,
+  GATEWAY_CACHE_REVALIDATIONS,
+  GATEWAY_CACHE_COALESCED,
+  GATEWAY_CACHE_REJECTED,
+  QUORUM_FAILURES,
+  QUORUM_READ_REPAIRS,
+  REBALANCE_OBJECTS_MOVED,
+  REBALANCE_BYTES_MOVED,
+  REBALANCE_FALLBACK_READS,
+  BATCH_OPERATIONS,
+  NUM_COUNTERS
+};
+
+// Values that go up and down, set by whoever owns them.
+enum MetricGauge {
+  QUEUE_DEPTH,
+  WORKERS,
+  INFLIGHT_BYTES,
+  REPLICATION_PENDING,
+  BACKENDS_HEALTHY,
+  GATEWAY_CACHE_BYTES,
+  REBALANCE_PENDING,
+  NUM_GAUGES
+};
+
+/**
+ * Counts what the server does and renders it in the Prometheus text
+ * format. Every thread counts into a shard of its own, which only that
+ * thread writes, so counting never contends and never takes a lock;
+ * reading the metrics adds the shards up. When a thread exits its counts
+ * are added to a total kept for exited threads and its shard is reused.
+ *
+ * Request latencies go into log-linear (HDR style) histograms with 8
+ * buckets per power of two microseconds, which keeps them within 12.5%
+ * of the real value at any scale.
+ */
+class Metrics {
+ public:
+  static void count(MetricCounter counter, uint64_t amount = 1);
+  static void setGauge(MetricGauge gauge, int64_t value);
+  static void addGauge(MetricGauge gauge, int64_t amount);
+  static int64_t gauge(MetricGauge gauge);
+
+  static void recordRequest(const char *method, int status, uint64_t latencyUsec);
+
+  static uint64_t nowUsec();
+  static std::string render();
+};
+
+#endif
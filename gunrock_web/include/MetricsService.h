@@ -0,0 +1,15 @@
+#ifndef _METRICSSERVICE_H_
+#define _METRICSSERVICE_H_
+
+#include "HttpService.h"
+
+// Serves everything Metrics counts for Prometheus to scrape.
+class MetricsService : public HttpService {
+ public:
+  MetricsService();
+
+  virtual void get(HTTPRequest *request, HTTPResponse *response);
+  virtual void head(HTTPRequest *request, HTTPResponse *response);
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef _OBJECT_CACHE_H_
+#define _OBJECT_CACHE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// One response body and the headers we serve it with.
+struct CachedObject {
+  std::string etag;
+  std::string contentType;
+  std::map<std::string, std::string> headers;
+  std::shared_ptr<const std::string> body;
+  // when a storage node last told us this is current
+  std::atomic<uint64_t> validatedUsec;
+
+  size_t memoryUsed() const;
+};
+
+/**
+ * Estimates how often keys have been seen recently with a count-min
+ * sketch of small saturating counters. Every counter is halved once as
+ * many keys have been recorded as the sketch has counters in a row times
+ * ten, so old popularity fades and the counters stay small.
+ */
+class FrequencySketch {
+ public:
+  FrequencySketch(int width);
+  void record(const std::string &key);
+  int estimate(const std::string &key);
+
+ private:
+  void index(const std::string &key, size_t *slots);
+  void age();
+
+  std::vector<uint8_t> m_counters;
+  size_t m_width;
+  size_t m_samples;
+};
+
+/**
+ * A size bounded cache of object responses for the gateway. Entries are
+ * kept in least recently used order, but a new entry only gets in if the
+ * sketch says its key is wanted more often than the entry it would push
+ * out (TinyLFU), so a scan of objects read once can't flush the hot ones.
+ *
+ * Entries are fresh for a moment after a storage node vouches for them
+ * and are then revalidated with If-None-Match, which costs a round trip
+ * but no body unless the object changed.
+ *
+ * Requests for the same key while one of them is fetching it wait for
+ * that fetch rather than making their own.
+ */
+class ObjectCache {
+ public:
+  ObjectCache(size_t maxBytes, uint64_t freshUsec);
+
+  /**
+   * Looks key up. Returns false when *object is the answer: a fresh
+   * entry, or what another request fetching key just got, which is NULL
+   * if it couldn't be cached. Returns true when the caller should fetch
+   * key itself and then call fill(); *object is then the stale entry to
+   * revalidate, or NULL.
+   */
+  bool lookup(const std::string &key, std::shared_ptr<CachedObject> *object);
+
+  // Ends the caller's fetch of key with what it got, NULL if nothing
+  // cacheable, and wakes the requests waiting for it.
+  void fill(const std::string &key, std::shared_ptr<CachedObject> object);
+
+  // Drops every entry whose key starts with prefix. Fetches of those
+  // keys already under way won't be cached or handed to their waiters.
+  void invalidate(const std::string &prefix);
+
+ private:
+  // A fetch in progress.
+  struct Fill {
+    bool done;
+    // set if the object changed while we were fetching it, so what we
+    // got may be out of date
+    bool invalidated;
+    std::shared_ptr<CachedObject> object;
+  };
+  struct Entry {
+    std::shared_ptr<CachedObject> object;
+    std::list<std::string>::iterator lru;
+  };
+
+  void insert(const std::string &key, std::shared_ptr<CachedObject> object);
+  void erase(std::map<std::string, Entry>::iterator iter);
+
+  pthread_mutex_t m_lock;
+  pthread_cond_t m_filled;
+  size_t m_maxBytes;
+  size_t m_bytes;
+  uint64_t m_freshUsec;
+  // ordered so invalidate() can find a prefix
+  std::map<std::string, Entry> m_entries;
+  // most recently used first
+  std::list<std::string> m_lru;
+  std::map<std::string, std::shared_ptr<Fill> > m_fills;
+  FrequencySketch m_sketch;
+};
+
+#endif
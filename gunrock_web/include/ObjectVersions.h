@@ -0,0 +1,61 @@
+#ifndef _OBJECT_VERSIONS_H_
+#define _OBJECT_VERSIONS_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <string_view>
+
+/**
+ * The version a gateway gave one write to an object: a clock reading
+ * that only goes up, and the gateway that read it so writes from two
+ * gateways in the same microsecond still have an order. The text form
+ * is "clock@writer".
+ */
+struct ObjectVersion {
+  uint64_t clock;
+  std::string writer;
+
+  ObjectVersion();
+  // whether this is a version at all, rather than an object never
+  // written through a quorum gateway
+  bool empty() const { return clock == 0; }
+  std::string str() const;
+  static bool parse(std::string_view text, ObjectVersion *version);
+  bool operator<(const ObjectVersion &other) const;
+};
+
+/**
+ * The versions of the objects a storage node holds. They're appended to
+ * a journal next to the disk image, which is read back and compacted
+ * when we start, since the file system has nowhere to keep them.
+ *
+ * Deleting an object keeps its version as a tombstone, so a replica that
+ * missed a delete can be told apart from one that missed a write.
+ */
+class ObjectVersions {
+ public:
+  ObjectVersions(std::string journalFile);
+
+  // The version of path, or an empty one, and whether it was deleted.
+  ObjectVersion get(std::string path, bool *deleted);
+  void set(std::string path, const ObjectVersion &version, bool deleted);
+
+ private:
+  struct Entry {
+    ObjectVersion version;
+    bool deleted;
+  };
+
+  void load();
+  void append(const std::string &line);
+
+  pthread_mutex_t m_lock;
+  std::string m_journalFile;
+  int m_journal;
+  std::map<std::string, Entry> m_entries;
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef _QUORUM_CALL_H_
+#define _QUORUM_CALL_H_
+
+#include <pthread.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "BackendPool.h"
+#include "HTTPClientResponse.h"
+#include "ObjectVersions.h"
+
+// One replica's answer to a quorum call.
+struct QuorumReply {
+  Backend *backend;
+  // NULL until the replica answers, and if it never does
+  HTTPClientResponse *response;
+  ObjectVersion version;
+};
+
+/**
+ * Sends one request to every replica of an object at once and waits
+ * only until enough of them have answered, so a read or write costs the
+ * latency of the fastest R or W replicas rather than the slowest.
+ *
+ * A call outlives the request that made it, since the replicas still
+ * answering hold on to it. When the last of them is done, a read call
+ * repairs the replicas that answered with an older version, by sending
+ * them the newest one with its version.
+ *
+ * The sends and repairs of every call run on one fixed set of worker
+ * threads, and the backend pool gives up on a replica that doesn't
+ * answer in time, so a hung replica can't pile up threads or calls.
+ */
+class QuorumCall {
+ public:
+  QuorumCall(BackendPool *pool, std::string method, std::string url,
+             std::map<std::string, std::string> headers, std::string body, bool readRepair);
+
+  /**
+   * Starts the request on every replica and waits for needed of them to
+   * answer. Returns the newest answer, or NULL if too many replicas
+   * failed. The answer belongs to the call and is valid until release().
+   */
+  QuorumReply *run(const std::vector<Backend *> &replicas, int needed);
+  // Lets go of the call; the replicas still answering finish it.
+  void release();
+
+ private:
+  static void enqueue(QuorumCall *call, size_t index, bool repair);
+  static void startWorkers();
+  static void *workLoop(void *arg);
+  void sendOne(size_t index);
+  void repairAndFinish();
+  QuorumReply *newest();
+  QuorumReply *repairSource();
+  void repair(QuorumReply *source);
+  void unreference();
+  void finish();
+
+  BackendPool *m_pool;
+  std::string m_method;
+  std::string m_url;
+  std::map<std::string, std::string> m_headers;
+  std::string m_body;
+  bool m_readRepair;
+
+  pthread_mutex_t m_lock;
+  pthread_cond_t m_changed;
+  std::vector<QuorumReply> m_replies;
+  int m_answered;
+  int m_running;
+  // the caller and each replica still answering
+  int m_references;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _REBALANCESERVICE_H_
+#define _REBALANCESERVICE_H_
+
+#include "HTTPRequest.h"
+#include "HTTPResponse.h"
+#include "Router.h"
+#include "ShardService.h"
+
+/**
+ * Changes a gateway's shards while it runs. PUT /rebalance/shards/:shard
+ * adds a "primary|backup|..." shard and DELETE /rebalance/shards/:primary
+ * removes one, as do POST /rebalance?add=shard and ?remove=primary, and
+ * each starts moving entries to where they belong now. GET /rebalance
+ * reports how far that has got.
+ */
+class RebalanceService {
+ public:
+  RebalanceService(ShardService *shards);
+
+  void addRoutes(Router *router);
+
+  void status(HTTPRequest *request, HTTPResponse *response);
+  void post(HTTPRequest *request, HTTPResponse *response);
+  void addShard(HTTPRequest *request, HTTPResponse *response);
+  void removeShard(HTTPRequest *request, HTTPResponse *response);
+
+ private:
+  ShardService *m_shards;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef _REBALANCER_H_
+#define _REBALANCER_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "BackendPool.h"
+#include "HashRing.h"
+
+/**
+ * Moves the top level entries of /ds3/ to the shards that own them once
+ * a gateway's hash ring changes, in the background and while requests
+ * keep being served.
+ *
+ * An entry whose owner changed is moving until we've copied it. Writes
+ * to it go to its new shard right away, so they're never lost, and
+ * reads go there first and fall back to its old shard for whatever
+ * hasn't been copied yet. We never copy over something the new shard
+ * already has, since that was written after the ring changed, and we
+ * never copy an entry while a write to it is in flight. Once an entry
+ * is copied we delete it from its old shard.
+ *
+ * Every write through the gateway is registered with us, not just those
+ * to moving entries, and we only start looking for entries to move once
+ * the writes that began before the ring changed are done. Those may be
+ * on their way to an old shard with an entry we'd otherwise miss.
+ *
+ * Copies are limited to a number of bytes a second so that moving data
+ * doesn't crowd out the requests being served.
+ */
+class Rebalancer {
+ public:
+  // bytesPerSecond of 0 copies as fast as the nodes go
+  Rebalancer(BackendPool *pool, uint64_t bytesPerSecond);
+
+  /**
+   * Starts moving entries from where oldRing puts them to where newRing
+   * does. shards has every node's group by its primary's name, for both
+   * rings. Returns false if the last rebalance is still going.
+   */
+  bool start(HashRing oldRing, HashRing newRing, std::map<std::string, std::vector<Backend *> > shards);
+  bool running();
+
+  // The group name is moving away from, or an empty one if it isn't moving.
+  std::vector<Backend *> source(std::string name);
+  // The groups that were removed and still have entries to move away.
+  std::vector<std::vector<Backend *> > sources();
+
+  // Writes to an entry wait while we copy it, and we wait for them.
+  // beginWrite returns the number endWrite wants back.
+  uint64_t beginWrite(std::string name);
+  void endWrite(std::string name, uint64_t write);
+
+  // How far the rebalance has got, as "key value" lines.
+  std::string status();
+
+ private:
+  static void *moveLoop(void *arg);
+  void waitForEarlierWrites();
+  bool findMoves(std::vector<std::string> *names);
+  bool move(std::string name);
+  bool copyTree(const std::vector<Backend *> &from, Backend *to, std::string path);
+  bool deleteTree(Backend *from, std::string path);
+  void throttle();
+
+  BackendPool *m_pool;
+  uint64_t m_bytesPerSecond;
+
+  pthread_mutex_t m_lock;
+  pthread_cond_t m_changed;
+  bool m_running;
+  HashRing m_oldRing;
+  HashRing m_newRing;
+  std::map<std::string, std::vector<Backend *> > m_shards;
+  // entries that have been copied to their new shard
+  std::set<std::string> m_moved;
+  // the entry being copied, if any, and writes in flight by entry
+  std::string m_copying;
+  std::map<std::string, int> m_writers;
+  // every write in flight by its number, and the first write that began
+  // after the ring last changed
+  std::set<uint64_t> m_writesInFlight;
+  uint64_t m_nextWrite;
+  uint64_t m_firstNewWrite;
+  // progress, for status()
+  size_t m_entries;
+  uint64_t m_objects;
+  uint64_t m_bytes;
+
+  // only touched by the thread doing the moving
+  uint64_t m_throttleStartUsec;
+  uint64_t m_throttleBytes;
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef _REPLICATION_H_
+#define _REPLICATION_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "HttpConnectionPool.h"
+
+class DistributedFileSystemService;
+
+// the most record bytes a primary sends a backup in one request, which a
+// batch can go over by the one record that takes it past this
+#define REPLICATION_BATCH_BYTES (1024 * 1024)
+
+// One committed change to the file system, as primaries ship it to their
+// backups. Records are framed as "seq op pathLength dataLength\n"
+// followed by the path and the data, so any number of them can be sent
+// back to back in one body.
+//
+// A BLOCK record carries one disk block for a backup being brought up to
+// date block by block; its path is the block number and its seq the last
+// write the block already includes.
+struct ReplicationRecord {
+  static const char PUT = 'P';
+  static const char DELETE = 'D';
+  static const char BLOCK = 'B';
+
+  uint64_t seq;
+  char op;
+  std::string path;
+  // the whole new contents of the file for a PUT, empty for a DELETE
+  std::string data;
+
+  void encode(std::string *out) const;
+  // Decodes the record at the start of in, returning how many bytes it
+  // took up or 0 if in doesn't start with a whole record.
+  static size_t decode(std::string_view in, ReplicationRecord *record);
+};
+
+/**
+ * Ships the writes a primary commits to its backups. Writes are kept in
+ * a log of the most recent ones, and each backup has a thread of its own
+ * that tails the log, sending records in the order they were committed
+ * and retrying until the backup takes them.
+ *
+ * A backup that went away asks to pick up from the last record it
+ * applied, which costs only the writes it missed. If those are no longer
+ * in the log, or the backup last heard from an earlier run of this
+ * primary, we compare checksums of every disk block with it instead and
+ * send just the blocks that differ.
+ *
+ * In synchronous mode a write isn't acknowledged to the client until
+ * every reachable backup has applied it, so losing the primary loses
+ * nothing that was acknowledged. A backup that stops answering counts
+ * as unreachable once its connection times out, so it can't hold up
+ * writes for longer than that. In asynchronous mode writes are
+ * acknowledged as soon as they commit locally and backups trail behind.
+ */
+class Replicator {
+ public:
+  // backups are "host:port" strings of backups of fileSystem
+  Replicator(DistributedFileSystemService *fileSystem, std::vector<std::string> backups, bool synchronous);
+
+  // Queues a committed write for every backup and returns its sequence
+  // number. Call it with the file system locked so records are numbered
+  // in the order their writes committed.
+  uint64_t append(char op, std::string path, std::string data);
+  // In synchronous mode, waits until every backup has applied seq or is
+  // unreachable. Returns right away in asynchronous mode.
+  void waitForBackups(uint64_t seq);
+
+  // Identifies this run of the primary. Sequence numbers start over when
+  // it restarts, so backups only compare numbers from the same epoch.
+  std::string epoch();
+  // The sequence number of the last write appended.
+  uint64_t lastSeq();
+
+ private:
+  struct Backup {
+    Replicator *replicator;
+    std::string host;
+    int port;
+    uint64_t appliedSeq;
+    bool reachable;
+    // whether appliedSeq is where the backup really is, which we have
+    // to ask it after it's been unreachable
+    bool inSync;
+  };
+
+  void updatePending();
+  static void *sendLoop(void *arg);
+  bool send(Backup *backup, std::vector<std::shared_ptr<const ReplicationRecord> > &records);
+  bool resync(Backup *backup);
+  bool copyBlocks(Backup *backup);
+
+  DistributedFileSystemService *m_fileSystem;
+  bool m_synchronous;
+  std::string m_epoch;
+  uint64_t m_nextSeq;
+  // the most recent writes, oldest first
+  std::deque<std::shared_ptr<const ReplicationRecord> > m_log;
+  size_t m_logBytes;
+  std::vector<Backup *> m_backups;
+  // connections to the backups, which give up on one that stops answering
+  HttpConnectionPool m_connections;
+  pthread_mutex_t m_lock;
+  pthread_cond_t m_changed;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _REPLICATIONSERVICE_H_
+#define _REPLICATIONSERVICE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "DistributedFileSystemService.h"
+#include "HttpService.h"
+
+/**
+ * Takes the writes a primary ships to this backup and applies them to
+ * its file system. A POST carries one or more records in the order they
+ * committed and a GET reports how far we've got. How far we've got is
+ * kept in stateFile too, so after a restart the primary only has to send
+ * what we missed.
+ *
+ * A primary that can't do that asks for our block checksums with
+ * GET ?checksums=1 and then POSTs the blocks that differ, with an
+ * X-Ds3-Resync header saying which write they bring us up to.
+ *
+ * Records that skip past the one we need next, or that come from a
+ * primary run we haven't been resynced by, get a 409 instead of being
+ * applied, which sends the primary back to asking where we are.
+ */
+class ReplicationService : public HttpService {
+ public:
+  ReplicationService(DistributedFileSystemService *fileSystem, std::string stateFile);
+
+  virtual void get(HTTPRequest *request, HTTPResponse *response);
+  virtual void post(HTTPRequest *request, HTTPResponse *response);
+
+ private:
+  void saveState();
+
+  DistributedFileSystemService *m_fileSystem;
+  std::string m_stateFile;
+  pthread_mutex_t m_lock;
+  // the primary run we last heard from and the last record we applied
+  std::string m_epoch;
+  uint64_t m_appliedSeq;
+};
+
+#endif
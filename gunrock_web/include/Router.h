@@ -0,0 +1,80 @@
+#ifndef _ROUTER_H_
+#define _ROUTER_H_
+
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+
+#include "HTTPRequest.h"
+#include "HTTPResponse.h"
+#include "HttpService.h"
+
+// Handles one method on one route.
+typedef std::function<void(HTTPRequest *, HTTPResponse *)> RouteHandler;
+
+/**
+ * Maps request paths to handlers with a trie of path segments that is
+ * built once at startup, so finding a route doesn't copy the path.
+ *
+ * Routes are either exact paths with a handler per method, where a
+ * ":name" segment matches any one segment and is passed on with
+ * HTTPRequest::getPathParam, or services mounted at a path prefix that
+ * handle everything below it. A service whose prefix doesn't end in '/'
+ * is an exact route for every method. An exact route wins over a service and a
+ * longer prefix wins over a shorter one.
+ *
+ * Routes are all added before the server starts, after which the router
+ * doesn't change, so every worker can dispatch with it at once.
+ */
+class Router {
+ public:
+  Router();
+  ~Router();
+
+  void addService(HttpService *service);
+  void addRoute(std::string method, std::string path, RouteHandler handler);
+  void dispatch(HTTPRequest *request, HTTPResponse *response) const;
+
+ private:
+  enum Method {
+    METHOD_HEAD, METHOD_GET, METHOD_PUT, METHOD_POST, METHOD_DELETE, METHOD_MOVE,
+    NUM_METHODS
+  };
+
+  struct Node {
+    Node();
+    ~Node();
+
+    std::map<std::string, Node *, std::less<> > children;
+    // the child for a ":name" segment, if there is one
+    Node *param;
+    std::string paramName;
+    HttpService *service;
+    bool hasRoute;
+    RouteHandler handlers[NUM_METHODS];
+  };
+
+  // the most ":name" segments one route can have
+  static const int MAX_PARAMS = 8;
+
+  // The ":name" segments one request matched on its way to a route.
+  struct Match {
+    std::string_view paramNames[MAX_PARAMS];
+    std::string_view params[MAX_PARAMS];
+    int numParams;
+  };
+
+  static int methodIndex(std::string method);
+  static int methodIndex(HTTPRequest *request);
+  static void invokeService(HttpService *service, int method,
+                            HTTPRequest *request, HTTPResponse *response);
+
+  Node *insert(std::string path);
+  Node *matchRoute(Node *node, std::string_view path, size_t pos, int depth, Match *match) const;
+  HttpService *matchService(std::string_view path) const;
+
+  Node *m_root;
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef _SHARDSERVICE_H_
+#define _SHARDSERVICE_H_
+
+#include <pthread.h>
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "BackendPool.h"
+#include "HashRing.h"
+#include "HttpService.h"
+#include "ObjectCache.h"
+#include "QuorumCall.h"
+#include "Rebalancer.h"
+
+/**
+ * Spreads the /ds3/ namespace over a set of storage nodes. Each top
+ * level entry, along with everything under it, lives on the node the
+ * hash ring assigns its name to, so requests are forwarded to that one
+ * node. Listing the root is the only request that needs every node, and
+ * it asks them all at once and merges their listings.
+ *
+ * A shard can be a group of nodes, a primary and the backups it
+ * replicates to. Writes go to the primary and reads to whichever member
+ * of the group is healthy and least busy, so reads from a backup that
+ * replicates asynchronously can trail the latest writes a little.
+ *
+ * The node running this service stores nothing itself. It talks to the
+ * storage nodes over a pool of keep-alive connections, and keeps the
+ * objects it reads most in an ObjectCache. Writes through this gateway
+ * drop what they change from the cache right away; writes through any
+ * other way show up once the cached copy is revalidated.
+ *
+ * With a quorum set, every top level entry is instead stored on the
+ * first N nodes the ring assigns it to. Writes are tagged with a new
+ * version and succeed once W of them have stored it, and reads return
+ * the newest version out of the first R replicas to answer, repairing
+ * the older ones behind the scenes. R + W > N means every read sees the
+ * latest successful write.
+ *
+ * Shards can be added and removed while we run. The entries that belong
+ * to a different shard afterwards are moved there by a Rebalancer, and
+ * until each one is we read it from both shards.
+ */
+class ShardService : public HttpService {
+ public:
+  // shards are "host:port" strings, or "primary|backup|..." groups of them
+  // cacheBytes of 0 turns the cache off, and moveBytesPerSecond limits
+  // how fast a rebalance copies entries between shards
+  ShardService(std::vector<std::string> shards, size_t cacheBytes, uint64_t moveBytesPerSecond);
+  // Stores every object on replicas nodes, with reads and writes needing
+  // that many of them to answer. Quorums have no use for the cache.
+  void setQuorum(int replicas, int reads, int writes);
+
+  /**
+   * Adds a shard, or removes the one with this primary, and starts
+   * moving entries to where they belong now. Throws a ClientError if
+   * the shard is no good or the last rebalance is still going.
+   */
+  void addShard(std::string shard);
+  void removeShard(std::string primary);
+  std::string rebalanceStatus();
+
+  virtual void head(HTTPRequest *request, HTTPResponse *response);
+  virtual void get(HTTPRequest *request, HTTPResponse *response);
+  virtual void put(HTTPRequest *request, HTTPResponse *response);
+  virtual void del(HTTPRequest *request, HTTPResponse *response);
+
+ private:
+  std::vector<Backend *> parseShard(std::string shard);
+  void rebalance(const HashRing &ring);
+  std::string topLevelName(HTTPRequest *request);
+  std::vector<Backend *> owners(std::string name, std::vector<Backend *> *moving);
+  Backend *reader(std::string name);
+  std::map<std::string, std::string> forwardedHeaders(HTTPRequest *request);
+  void forward(Backend *backend, HTTPRequest *request, HTTPResponse *response, const std::string &body = "");
+  void read(std::string name, HTTPRequest *request, HTTPResponse *response);
+  void readMoving(const std::vector<Backend *> &owners, const std::vector<Backend *> &moving,
+                  HTTPRequest *request, HTTPResponse *response);
+  void writeMoving(Backend *owner, Backend *moving, HTTPRequest *request, const std::string &body,
+                   HTTPResponse *response);
+  HTTPClientResponse *send(Backend *backend, HTTPRequest *request,
+                           std::map<std::string, std::string> headers, const std::string &body = "");
+  void relay(HTTPClientResponse *reply, HTTPRequest *request, HTTPResponse *response);
+  void write(std::string name, HTTPRequest *request, HTTPResponse *response);
+  bool isCacheable(HTTPRequest *request);
+  void getCached(std::string name, HTTPRequest *request, HTTPResponse *response);
+  void listRoot(HTTPResponse *response);
+  std::vector<Backend *> replicas(std::string name);
+  ObjectVersion nextVersion();
+  void quorumRead(std::string name, HTTPRequest *request, HTTPResponse *response);
+  void quorumWrite(std::string name, HTTPRequest *request, const std::string &body, HTTPResponse *response);
+
+  // guards the ring and the shards, held only long enough to pick one
+  pthread_rwlock_t m_ringLock;
+  HashRing m_ring;
+  BackendPool m_pool;
+  // every shard's nodes by its primary's name, primary first, including
+  // those that were removed
+  std::map<std::string, std::vector<Backend *> > m_shards;
+  Rebalancer m_rebalancer;
+  ObjectCache *m_cache;
+  // N, R and W, or 0 without a quorum
+  int m_replicas;
+  int m_readQuorum;
+  int m_writeQuorum;
+  // names this gateway in the versions it hands out
+  std::string m_writerId;
+  std::atomic<uint64_t> m_lastClock;
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <pthread.h>
 #include <string>
+#include <string_view>
 
 int dthread_create(pthread_t *thread, const pthread_attr_t *attr,
 		   void *(*start_routine)(void *), void *arg);
@@ -15,9 +16,13 @@ int dthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
 int dthread_cond_signal(pthread_cond_t *cond);
 int dthread_cond_broadcast(pthread_cond_t *cond);
 
+int dthread_rwlock_rdlock(pthread_rwlock_t *rwlock);
+int dthread_rwlock_wrlock(pthread_rwlock_t *rwlock);
+int dthread_rwlock_unlock(pthread_rwlock_t *rwlock);
+
 
 // don't use these, they're used by the autograder
-void sync_print(std::string function, std::string payload);
+void sync_print(std::string_view function, std::string_view payload);
 void set_log_file(std::string file_name);
 
 #endif
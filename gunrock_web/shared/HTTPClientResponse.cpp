@@ -4,49 +4,158 @@
 #include <string>
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 
 #include <sstream>
 
 using namespace std;
 
-HTTPClientResponse::HTTPClientResponse(MySocket *sock) {
+HTTPClientResponse::HTTPClientResponse(MySocket *sock, bool headRequest) {
     m_sock = sock;
     m_status_code = 0;
+    m_headRequest = headRequest;
+    m_keepAlive = false;
+    m_received = false;
 }
 
-
-string HTTPClientResponse::readResponse() {
-  string full_response;
-
-  while (true) {
-    string response;
+// Reads from the socket until data holds at least size bytes, returning
+// false if the connection closed first.
+bool HTTPClientResponse::fill(string &data, size_t size) {
+  char buffer[4096];
+  while (data.size() < size) {
     try {
-      response = m_sock->read();
+      int ret = m_sock->read(buffer, sizeof(buffer));
+      data.append(buffer, ret);
+      m_received = true;
     } catch (...) {
-      break;
+      return false;
     }
-
-    full_response += response;
   }
+  return true;
+}
 
-  size_t delimiter = full_response.find("\r\n\r\n");
-  if (delimiter == string::npos) {
-    return "";
+/**
+ * Reads one response. The body ends where its Content-Length or chunked
+ * encoding says, so the connection can be used again, and anything the
+ * server sent after it is left on the socket. A body with neither runs
+ * to the end of the connection.
+ */
+string HTTPClientResponse::readResponse() {
+  string data;
+  size_t delimiter;
+  while ((delimiter = data.find("\r\n\r\n")) == string::npos) {
+    if (!fill(data, data.size() + 1)) {
+      return "";
+    }
   }
 
-  m_body = full_response.substr(delimiter+4);
-  string header_string = full_response.substr(0, delimiter);
+  string header_string = data.substr(0, delimiter);
   stringstream header_stream(header_string);
 
   string line;
   while (getline(header_stream, line)) {
+    if (line.size() > 0 && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
+    size_t colon = line.find(':');
     if (line.find("HTTP/1.1 ") == 0 || line.find("HTTP/1.0") == 0) {
       stringstream header_line(line);
       string http;
       header_line >> http >> m_status_code >> m_status_message;
+    } else if (colon != string::npos) {
+      string name = line.substr(0, colon);
+      size_t value = line.find_first_not_of(" \t", colon + 1);
+      m_headers[lowercase(name)] = value == string::npos ? "" : line.substr(value);
     }
   }
-  
+
+  size_t offset = delimiter + 4;
+  m_keepAlive = lowercase(header("Connection")) != "close" && line.find("HTTP/1.0") != 0;
+  string length = header("Content-Length");
+  if (m_headRequest || m_status_code == 204 || m_status_code == 304 ||
+      (m_status_code >= 100 && m_status_code < 200)) {
+    // no body, whatever the headers say
+  } else if (lowercase(header("Transfer-Encoding")).find("chunked") != string::npos) {
+    if (!readChunkedBody(data, offset)) {
+      m_status_code = 0;
+      m_keepAlive = false;
+      return "";
+    }
+    return m_body;
+  } else if (length.size() > 0) {
+    size_t size = strtoull(length.c_str(), NULL, 10);
+    if (!fill(data, offset + size)) {
+      m_status_code = 0;
+      m_keepAlive = false;
+      return "";
+    }
+    m_body = data.substr(offset, size);
+    offset += size;
+  } else {
+    fill(data, (size_t) -1);
+    m_body = data.substr(offset);
+    offset = data.size();
+    m_keepAlive = false;
+  }
+
+  if (offset < data.size()) {
+    m_sock->unread(data.data() + offset, data.size() - offset);
+  }
   return m_body;
 }
+
+// Decodes a chunked body that starts at offset in data, reading more of
+// it as needed.
+bool HTTPClientResponse::readChunkedBody(string &data, size_t offset) {
+  while (true) {
+    size_t lineEnd;
+    while ((lineEnd = data.find("\r\n", offset)) == string::npos) {
+      if (!fill(data, data.size() + 1)) {
+        return false;
+      }
+    }
+    size_t size = strtoull(data.c_str() + offset, NULL, 16);
+    offset = lineEnd + 2;
+    if (size == 0) {
+      break;
+    }
+    if (!fill(data, offset + size + 2)) {
+      return false;
+    }
+    m_body.append(data, offset, size);
+    offset += size + 2;
+  }
+
+  // skip any trailers up to the blank line that ends the body
+  while (true) {
+    size_t lineEnd;
+    while ((lineEnd = data.find("\r\n", offset)) == string::npos) {
+      if (!fill(data, data.size() + 1)) {
+        return false;
+      }
+    }
+    bool blank = lineEnd == offset;
+    offset = lineEnd + 2;
+    if (blank) {
+      break;
+    }
+  }
+
+  if (offset < data.size()) {
+    m_sock->unread(data.data() + offset, data.size() - offset);
+  }
+  return true;
+}
+
+string HTTPClientResponse::header(string name) {
+  map<string, string>::iterator iter = m_headers.find(lowercase(name));
+  return iter == m_headers.end() ? "" : iter->second;
+}
+
+string HTTPClientResponse::lowercase(string str) {
+  for (size_t idx = 0; idx < str.size(); idx++) {
+    str[idx] = tolower(str[idx]);
+  }
+  return str;
+}
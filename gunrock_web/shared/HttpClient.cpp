@@ -5,7 +5,7 @@
 //#include "MySslSocket.h"
 #include "Base64.h"
 
-#include <sstream>
+#include <sys/uio.h>
 
 using namespace std;
 
@@ -14,20 +14,54 @@ HttpClient::HttpClient(const char *inet_addr, int port, bool use_tls) {
     //connection = new MySslSocket(inet_addr, port);
     cerr << "Removed SSL sockets for now" << endl;
     exit(1);
-  } else {
-    connection = new MySocket(inet_addr, port);
   }
-  
-  stringstream host;
-  host << inet_addr << ":" << port;
-  headers["Host"] = host.str();
+  this->pool = HttpConnectionPool::shared();
+  this->host = inet_addr;
+  this->port = port;
+  connection = pool->acquire(host, port, &reused);
+  reusable = true;
+
+  headers["Host"] = host + ":" + to_string(port);
+  headers["User-Agent"] = string("Gunrock/1.0");
+  headers["Accept"] = string("*/*");
+  headers["Connection"] = string("keep-alive");
+}
+
+HttpClient::HttpClient(HttpConnectionPool *pool, const char *inet_addr, int port) {
+  this->pool = pool;
+  this->host = inet_addr;
+  this->port = port;
+  connection = pool->acquire(host, port, &reused);
+  reusable = true;
+
+  headers["Host"] = host + ":" + to_string(port);
+  headers["User-Agent"] = string("Gunrock/1.0");
+  headers["Accept"] = string("*/*");
+  headers["Connection"] = string("keep-alive");
+}
+
+HttpClient::HttpClient(MySocket *connection, string host) {
+  this->connection = connection;
+  this->pool = NULL;
+  this->port = 0;
+  reused = false;
+  reusable = true;
+
+  headers["Host"] = host;
   headers["User-Agent"] = string("Gunrock/1.0");
   headers["Accept"] = string("*/*");
-  headers["Connection"] = string("close");
+  headers["Connection"] = string("keep-alive");
 }
 
 HttpClient::~HttpClient() {
-  delete connection;
+  if (pool == NULL) {
+    return;
+  }
+  if (reusable && pendingMethods.empty()) {
+    pool->release(host, port, connection);
+  } else {
+    delete connection;
+  }
 }
 
 void HttpClient::set_header(string key, string value) {
@@ -41,57 +75,106 @@ void HttpClient::set_basic_auth(string username, string password) {
   set_header("Authorization", value);
 }
 
-void HttpClient::write_request(string path, string method, string body) {
-  stringstream request;
-
-  // PART 1: implement support for handling the body, if it exists
-  request << method << " " << path << " HTTP/1.1\r\n";
-  if (body.size() > 0) {
-    stringstream length;
-    length << body.size();
-    headers["Content-Length"] = length.str();
-  } else {
-    headers.erase("Content-Length");
-  }
-  
+// The head goes out of a buffer we reuse and the body straight from the
+// caller's string, in one writev, so neither is copied into the other.
+void HttpClient::write_request(const string &path, const string &method, const string &body) {
+  requestBuffer.clear();
+  requestBuffer.append(method).append(" ").append(path).append(" HTTP/1.1\r\n");
   map<string, string>::iterator iter;
   for (iter = headers.begin(); iter != headers.end(); iter++) {
-    request << iter->first << ": " << iter->second << "\r\n";
-  } 
-  
-  request << "\r\n";
-
+    if (iter->first != "Content-Length") {
+      requestBuffer.append(iter->first).append(": ").append(iter->second).append("\r\n");
+    }
+  }
   if (body.size() > 0) {
-    request << body;
+    requestBuffer.append("Content-Length: ").append(to_string(body.size())).append("\r\n");
+  }
+  requestBuffer.append("\r\n");
+
+  struct iovec iov[2];
+  iov[0].iov_base = &requestBuffer[0];
+  iov[0].iov_len = requestBuffer.size();
+  iov[1].iov_base = (void *) body.data();
+  iov[1].iov_len = body.size();
+  try {
+    connection->writeVector(iov, body.size() > 0 ? 2 : 1);
+  } catch (...) {
+    reusable = false;
+    throw;
   }
-  
-  connection->write(request.str());
+  pendingMethods.push_back(method);
 }
 
-
-
 HTTPClientResponse *HttpClient::read_response() {
-  HTTPClientResponse *response = new HTTPClientResponse(connection);
+  string method;
+  if (!pendingMethods.empty()) {
+    method = pendingMethods.front();
+    pendingMethods.pop_front();
+  }
+  HTTPClientResponse *response = new HTTPClientResponse(connection, method == "HEAD");
   response->readResponse();
+  if (response->keepAlive()) {
+    reused = true;
+  } else {
+    reusable = false;
+  }
   return response;
 }
 
-HTTPClientResponse *HttpClient::get(string path) {
-  write_request(path, "GET", "");
-  return read_response();
+bool HttpClient::idempotent(const string &method) {
+  return method == "GET" || method == "HEAD" || method == "PUT" || method == "DELETE" || method == "OPTIONS";
 }
 
-HTTPClientResponse *HttpClient::post(string path, string body) {
-  write_request(path, "POST", body);
+/**
+ * Sends one request and reads its response. A connection that sat idle
+ * may have been closed by the server just as we took it, in which case
+ * the request never got to it, so we try once more on a new connection.
+ * We only know the server didn't see it if sending failed or nothing at
+ * all came back before the connection closed, and even then only send
+ * it again if doing it twice is harmless.
+ */
+HTTPClientResponse *HttpClient::request(const string &method, const string &path, const string &body) {
+  if (pool != NULL && reused && pendingMethods.empty() && idempotent(method)) {
+    bool retry = false;
+    try {
+      write_request(path, method, body);
+    } catch (...) {
+      retry = true;
+    }
+    if (!retry) {
+      HTTPClientResponse *response = read_response();
+      if (response->status() != 0 || response->received() || connection->timedOut()) {
+        return response;
+      }
+      delete response;
+    }
+    delete connection;
+    connection = NULL;
+    pendingMethods.clear();
+    connection = pool->connect(host, port);
+    reused = false;
+    reusable = true;
+  }
+  write_request(path, method, body);
   return read_response();
 }
 
-HTTPClientResponse *HttpClient::put(string path, string body) {
-  write_request(path, "PUT", body);
-  return read_response();
+HTTPClientResponse *HttpClient::get(string path) {
+  return request("GET", path, "");
+}
+
+HTTPClientResponse *HttpClient::head(string path) {
+  return request("HEAD", path, "");
+}
+
+HTTPClientResponse *HttpClient::post(string path, const string &body) {
+  return request("POST", path, body);
+}
+
+HTTPClientResponse *HttpClient::put(string path, const string &body) {
+  return request("PUT", path, body);
 }
 
 HTTPClientResponse *HttpClient::del(string path) {
-  write_request(path, "DELETE", "");
-  return read_response();
+  return request("DELETE", path, "");
 }
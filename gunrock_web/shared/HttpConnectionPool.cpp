@@ -0,0 +1,83 @@
+#include "HttpConnectionPool.h"
+
+using namespace std;
+
+HttpConnectionPool::HttpConnectionPool(size_t maxIdle, int timeoutMs) {
+  m_maxIdle = maxIdle;
+  m_timeoutMs = timeoutMs;
+  pthread_mutex_init(&m_lock, NULL);
+}
+
+HttpConnectionPool::~HttpConnectionPool() {
+  map<string, vector<MySocket *> >::iterator iter;
+  for (iter = m_idle.begin(); iter != m_idle.end(); iter++) {
+    for (size_t idx = 0; idx < iter->second.size(); idx++) {
+      delete iter->second[idx];
+    }
+  }
+  pthread_mutex_destroy(&m_lock);
+}
+
+HttpConnectionPool *HttpConnectionPool::shared() {
+  // never deleted, so threads still using it at exit are fine
+  static HttpConnectionPool *pool = new HttpConnectionPool();
+  return pool;
+}
+
+string HttpConnectionPool::key(const string &host, int port) {
+  return host + ":" + to_string(port);
+}
+
+// Skips idle connections the server has since closed, and any it sent
+// something on that we never asked for, instead of failing a request on
+// them. A server can still close one just after we check it.
+MySocket *HttpConnectionPool::acquire(const string &host, int port, bool *reused) {
+  vector<MySocket *> closed;
+  MySocket *connection = NULL;
+  pthread_mutex_lock(&m_lock);
+  vector<MySocket *> &idle = m_idle[key(host, port)];
+  while (connection == NULL && !idle.empty()) {
+    connection = idle.back();
+    idle.pop_back();
+    if (connection->isClosed() || connection->waitReadable(0)) {
+      closed.push_back(connection);
+      connection = NULL;
+    }
+  }
+  pthread_mutex_unlock(&m_lock);
+
+  for (size_t idx = 0; idx < closed.size(); idx++) {
+    delete closed[idx];
+  }
+  *reused = connection != NULL;
+  if (connection == NULL) {
+    connection = this->connect(host, port);
+  }
+  return connection;
+}
+
+MySocket *HttpConnectionPool::connect(const string &host, int port) {
+  return m_timeoutMs > 0 ? new MySocket(host.c_str(), port, m_timeoutMs) : new MySocket(host.c_str(), port);
+}
+
+void HttpConnectionPool::release(const string &host, int port, MySocket *connection) {
+  pthread_mutex_lock(&m_lock);
+  vector<MySocket *> &idle = m_idle[key(host, port)];
+  if (idle.size() < m_maxIdle) {
+    idle.push_back(connection);
+    connection = NULL;
+  }
+  pthread_mutex_unlock(&m_lock);
+  delete connection;
+}
+
+void HttpConnectionPool::clear(const string &host, int port) {
+  vector<MySocket *> closed;
+  pthread_mutex_lock(&m_lock);
+  closed.swap(m_idle[key(host, port)]);
+  pthread_mutex_unlock(&m_lock);
+
+  for (size_t idx = 0; idx < closed.size(); idx++) {
+    delete closed[idx];
+  }
+}
@@ -1,33 +1,55 @@
 #include "MySocket.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <poll.h>
 #include <unistd.h>
+#include <errno.h>
 #include <string.h>
+#include <sys/time.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <string>
 
+#include <algorithm>
 #include <iostream>
 
 using namespace std;
 
 MySocket::MySocket(const char *inetAddr, int port) {
+  m_timedOut = false;
   call_connect(inetAddr, port);
 }
 
-void MySocket::call_connect(const char *inetAddr, int port) {
+MySocket::MySocket(const char *inetAddr, int port, int timeoutMs) {
+  m_timedOut = false;
+  call_connect(inetAddr, port, timeoutMs);
+}
+
+void MySocket::call_connect(const char *inetAddr, int port, int timeoutMs) {
     struct sockaddr_in server;
     struct addrinfo hints;
     struct addrinfo *res;
 
     // set up the new socket (TCP/IP)
     sockFd = socket(AF_INET,SOCK_STREAM,0);
+
+    if(timeoutMs > 0) {
+        // on Linux the send timeout covers connect too
+        struct timeval timeout;
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_usec = (timeoutMs % 1000) * 1000;
+        setsockopt(sockFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sockFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
     
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_STREAM;
     int ret = getaddrinfo(inetAddr, NULL, &hints, &res);
     if(ret != 0) {
+        ::close(sockFd);
+        sockFd = -1;
         string str;
         str = string("Could not get host ") + string(inetAddr);
         throw SocketError(str.c_str());
@@ -41,16 +63,20 @@ void MySocket::call_connect(const char *inetAddr, int port) {
     // conenct to the server
     if( connect(sockFd, (struct sockaddr *) &server,
                 sizeof(server)) == -1 ) {
+        ::close(sockFd);
+        sockFd = -1;
         throw SocketError("Did not connect to the server");
     }
 }
 
 MySocket::MySocket(void) {
     sockFd = -1;
+    m_timedOut = false;
 }
 
 MySocket::MySocket(int socketFileDesc) {
     sockFd = socketFileDesc;
+    m_timedOut = false;
 }
 
 MySocket::~MySocket(void) {
@@ -73,6 +99,7 @@ void MySocket::write_bytes(const void *buffer, int len) {
     while(len > 0) {
         bytesWritten = ::write(sockFd, buf, len);
         if(bytesWritten <= 0) {
+	  checkTimeout();
 	  throw SocketWriteError();
         }
         buf += bytesWritten;
@@ -80,19 +107,137 @@ void MySocket::write_bytes(const void *buffer, int len) {
     }
 }
 
+void MySocket::sendFile(int fd, off_t offset, size_t count) {
+    if (sockFd<0) {
+      throw SocketNotConnected();
+    }
+
+    while(count > 0) {
+        ssize_t bytesWritten = ::sendfile(sockFd, fd, &offset, count);
+        if(bytesWritten <= 0) {
+	  throw SocketWriteError();
+        }
+        count -= bytesWritten;
+    }
+}
+
+void MySocket::writeVector(struct iovec *iov, int iovcnt) {
+    if (sockFd<0) {
+      throw SocketNotConnected();
+    }
+
+    while(true) {
+        while(iovcnt > 0 && iov->iov_len == 0) {
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt == 0) {
+            return;
+        }
+
+        ssize_t bytesWritten = ::writev(sockFd, iov, iovcnt);
+        if(bytesWritten <= 0) {
+	  checkTimeout();
+	  throw SocketWriteError();
+        }
+
+        // skip the buffers that went out, the last one may be partly sent
+        while(bytesWritten > 0) {
+            if(bytesWritten >= (ssize_t) iov->iov_len) {
+                bytesWritten -= iov->iov_len;
+                iov++;
+                iovcnt--;
+            } else {
+                iov->iov_base = (char *) iov->iov_base + bytesWritten;
+                iov->iov_len -= bytesWritten;
+                bytesWritten = 0;
+            }
+        }
+    }
+}
+
 string MySocket::read() {
     char buffer[4096];
+    int ret = read(buffer, sizeof(buffer));
+    return string(buffer, ret);
+}
+
+int MySocket::read(void *buffer, int len) {
     if(sockFd<0) {
       throw SocketNotConnected();
     }
+
+    if(!unreadBytes.empty()) {
+        int copySize = min((size_t) len, unreadBytes.size());
+        memcpy(buffer, unreadBytes.data(), copySize);
+        unreadBytes.erase(0, copySize);
+        return copySize;
+    }
     
-    int ret = ::read(sockFd, buffer, sizeof(buffer));
+    int ret = ::read(sockFd, buffer, len);
     
     if(ret <= 0) {
+      checkTimeout();
       throw SocketReadError();
     }
   
-    return string(buffer, ret);
+    return ret;
+}
+
+void MySocket::unread(const void *buffer, int len) {
+    unreadBytes.insert(0, (const char *) buffer, len);
+}
+
+bool MySocket::waitReadable(int timeoutMs) {
+    if(sockFd<0) return false;
+    if(!unreadBytes.empty()) return true;
+
+    struct pollfd pfd;
+    pfd.fd = sockFd;
+    pfd.events = POLLIN;
+    if(poll(&pfd, 1, timeoutMs) <= 0) return false;
+
+    // readable also means the peer closed the connection, which isn't data
+    char byte;
+    return recv(sockFd, &byte, 1, MSG_PEEK) > 0;
+}
+
+bool MySocket::isClosed(void) {
+    if(sockFd<0) return true;
+
+    struct pollfd pfd;
+    pfd.fd = sockFd;
+    pfd.events = POLLIN;
+    if(poll(&pfd, 1, 0) <= 0) return false;
+    if(pfd.revents & (POLLERR | POLLHUP)) return true;
+
+    char byte;
+    int ret = recv(sockFd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+bool MySocket::timedOut(void) {
+    return m_timedOut;
+}
+
+// Called right after a read or write failed, while errno is still its.
+void MySocket::checkTimeout(void) {
+    if(errno == EAGAIN || errno == EWOULDBLOCK) {
+        m_timedOut = true;
+    }
+}
+
+void MySocket::lingeringClose(void) {
+    if(sockFd<0) return;
+
+    shutdown(sockFd, SHUT_WR);
+    char buffer[4096];
+    for(int drained = 0; drained < 64 * 1024; ) {
+        int ret = recv(sockFd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if(ret <= 0) break;
+        drained += ret;
+    }
+    close();
 }
 
 void MySocket::close(void) {
@@ -76,25 +76,28 @@ void MySslSocket::write(string buffer) {
 
 string MySslSocket::read() {
   char buffer[4096];
+  int ret = read(buffer, sizeof(buffer));
+  return string(buffer, ret);
+}
+
+int MySslSocket::read(void *buffer, int len) {
   if(sockFd<0 || ssl == NULL) {
     throw SocketNotConnected();
   }
     
-  int ret = SSL_read(ssl, buffer, sizeof(buffer));
+  int ret = SSL_read(ssl, buffer, len);
   
   if(ret <= 0) {
     throw SocketReadError();
   }
 
-  string result = string(buffer, ret);
-  
   if (debug_print_io) {
     cout << "MySslSocket::read" << endl;
     cout << "-----------------" << endl;
-    cout << result << endl << endl;
+    cout << string((char *) buffer, ret) << endl << endl;
   }
   
-  return result;
+  return ret;
 }
 
 void MySslSocket::close() {
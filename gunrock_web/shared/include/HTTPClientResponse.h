@@ -8,18 +8,36 @@
 
 class HTTPClientResponse {
  public:
-  HTTPClientResponse(MySocket *sock);    
+  // headRequest says the response is to a HEAD, which never has a body
+  HTTPClientResponse(MySocket *sock, bool headRequest = false);
   std::string readResponse();
   int status() { return m_status_code; }
   bool success() { return m_status_code >= 200 && m_status_code < 300; }
   std::string body() { return m_body; }
+  // The value of header name, matched without regard to case, or "" if
+  // the response didn't have it.
+  std::string header(std::string name);
+  // every header, with lower case names
+  std::map<std::string, std::string> headers() { return m_headers; }
+  // Whether the connection can carry another request, which it can if
+  // the server didn't close it and the body's end was marked.
+  bool keepAlive() { return m_keepAlive; }
+  // Whether any of the response arrived, even if not all of it did.
+  bool received() { return m_received; }
   
  protected:
+  static std::string lowercase(std::string str);
+  bool fill(std::string &data, size_t size);
+  bool readChunkedBody(std::string &data, size_t offset);
+
   MySocket *m_sock;
   std::string m_body;
   std::map<std::string, std::string> m_headers;
   int m_status_code;
   std::string m_status_message;
+  bool m_headRequest;
+  bool m_keepAlive;
+  bool m_received;
 };
 
 #endif
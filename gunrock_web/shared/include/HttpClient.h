@@ -1,10 +1,12 @@
 #ifndef __HTTP_CLIENT_H__
 #define __HTTP_CLIENT_H__
 
+#include <deque>
 #include <string>
 #include <map>
 
 #include "HTTPClientResponse.h"
+#include "HttpConnectionPool.h"
 #include "MySocket.h"
 
 class HttpClient {
@@ -17,12 +19,36 @@ class HttpClient {
    * connects.  Will throw an HostNotFound exception if the attepted
    * connection fails.
    *
+   * The connection comes from HttpConnectionPool::shared() if it has
+   * an idle one to this address, and goes back to it when the client
+   * is deleted if the server kept it open, so making a client for each
+   * request is cheap.
+   *
    * Note: this call will block while establishing a connection.
    *
    * @param inetAddr either ip address, or the domain name
    * @param port the port to connect to
    */
   HttpClient(const char *inet_addr, int port, bool use_tls=false);
+
+  /**
+   * Like the constructor above, but borrows its connection from pool
+   * instead of the shared one, so it gets pool's timeout.
+   */
+  HttpClient(HttpConnectionPool *pool, const char *inet_addr, int port);
+
+  /**
+   * Constructor for a connection that's already open.
+   *
+   * Requests ask the server to keep the connection open and responses
+   * are read only up to their end, so the connection can carry more
+   * requests after this client is gone. The caller keeps ownership of
+   * it and should stop using it if a response isn't keepAlive().
+   *
+   * @param connection an open connection to host
+   * @param host the "host:port" the connection goes to
+   */
+  HttpClient(MySocket *connection, std::string host);
   ~HttpClient();
 
 
@@ -48,6 +74,17 @@ class HttpClient {
    */
   HTTPClientResponse *get(std::string path);
 
+  /**
+   * HTTP HEAD request
+   *
+   * Makes a network call using the HTTP HEAD method.
+   *
+   * @param path the API endpoint that you want to connect to
+   * @return HTTPClientResponse a pointer to a client response
+   *         object with an empty body, hydrated from the API server.
+   */
+  HTTPClientResponse *head(std::string path);
+
   /**
    * HTTP POST request
    *
@@ -58,7 +95,7 @@ class HttpClient {
    * @return HTTPClientResponse a pointer to a client response
    *         object, hydrated from the API server.
    */
-  HTTPClientResponse *post(std::string path, std::string body);
+  HTTPClientResponse *post(std::string path, const std::string &body);
 
   /**
    * HTTP PUT request
@@ -70,7 +107,7 @@ class HttpClient {
    * @return HTTPClientResponse a pointer to a client response
    *         object, hydrated from the API server.
    */
-  HTTPClientResponse *put(std::string path, std::string body);
+  HTTPClientResponse *put(std::string path, const std::string &body);
 
   /**
    * HTTP DELETE request
@@ -94,12 +131,39 @@ class HttpClient {
    */
   void set_header(std::string key, std::string value);
   
-  void write_request(std::string path, std::string method, std::string body);
+  /**
+   * Sends a request without waiting for its response.
+   *
+   * Several requests can be written back to back before reading any of
+   * their responses (pipelining), which read_response returns in the
+   * order the requests were written. Only pipeline requests that are
+   * safe to send again, since a server that closes the connection part
+   * way through leaves the rest unanswered.
+   */
+  void write_request(const std::string &path, const std::string &method, const std::string &body);
+  // Reads the response to the oldest request not yet answered.
   HTTPClientResponse *read_response();
+
+  // Whether sending a request with method twice does the same as once.
+  static bool idempotent(const std::string &method);
   
  private:
+  HTTPClientResponse *request(const std::string &method, const std::string &path, const std::string &body);
+
   MySocket *connection;
+  // where an address's connection goes back to, NULL for a borrowed one
+  HttpConnectionPool *pool;
+  std::string host;
+  int port;
+  // whether the connection has carried a request before, and whether
+  // it can carry another one
+  bool reused;
+  bool reusable;
+  // methods of the requests written and not yet answered, oldest first
+  std::deque<std::string> pendingMethods;
   std::map<std::string, std::string> headers;
+  // holds each request's head, keeping its capacity from one to the next
+  std::string requestBuffer;
 };
   
 
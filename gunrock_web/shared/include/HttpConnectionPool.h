@@ -0,0 +1,54 @@
+#ifndef HTTP_CONNECTION_POOL_H_
+#define HTTP_CONNECTION_POOL_H_
+
+#include <pthread.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "MySocket.h"
+
+/**
+ * Idle keep-alive connections by "host:port". Whoever sends a request
+ * borrows one, or opens a new one if there isn't any, and gives it back
+ * once the response has been read if the server left it open, so most
+ * requests skip the TCP handshake.
+ *
+ * HttpClients made from an address share the pool from shared().
+ */
+class HttpConnectionPool {
+ public:
+  // maxIdle is the most idle connections we keep to one host, and the
+  // connections we open give up on the host after timeoutMs if it's set
+  HttpConnectionPool(size_t maxIdle = 8, int timeoutMs = 0);
+  ~HttpConnectionPool();
+
+  static HttpConnectionPool *shared();
+
+  /**
+   * An open connection to host:port. reused says whether it was idle,
+   * in which case the server may have closed it just as we took it, so
+   * a request that got nothing back on it may be worth sending again.
+   * Throws if a new connection can't be made.
+   */
+  MySocket *acquire(const std::string &host, int port, bool *reused);
+  // A new connection to host:port with this pool's timeout, for a
+  // request that failed on an idle one. Throws if it can't be made.
+  MySocket *connect(const std::string &host, int port);
+  // Keeps connection for the next request to host:port, or closes it
+  // if we already have enough.
+  void release(const std::string &host, int port, MySocket *connection);
+  // Closes every idle connection to host:port.
+  void clear(const std::string &host, int port);
+
+ private:
+  static std::string key(const std::string &host, int port);
+
+  size_t m_maxIdle;
+  int m_timeoutMs;
+  pthread_mutex_t m_lock;
+  std::map<std::string, std::vector<MySocket *> > m_idle;
+};
+
+#endif
@@ -4,6 +4,9 @@
 #include <stdexcept>
 #include <string>
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
 class SocketNotConnected : public std::runtime_error {
  public:
   SocketNotConnected() : std::runtime_error("socket not connected") {}
@@ -37,6 +40,12 @@ class MySocket {
    */
   MySocket(const char *inetAddr, int port);
 
+  /*
+   * like the constructor above, but connecting and every read and write
+   * after give up after timeoutMs milliseconds, and timedOut() says so.
+   */
+  MySocket(const char *inetAddr, int port, int timeoutMs);
+
   /*
    * this constructor will generally not be used except for by ServerSockets
    */
@@ -50,13 +59,71 @@ class MySocket {
 
 
   virtual std::string read();
+  /*
+   * reads up to len bytes into buffer and returns how many it got, so
+   * callers with a buffer of their own don't need a string per read.
+   */
+  virtual int read(void *buffer, int len);
   virtual void write(std::string data);
   virtual void close(void);
+
+  /*
+   * puts bytes we read but don't need yet back in front of the socket, so
+   * the next read returns them first. A server reading one request uses
+   * this to keep whatever it read of the next one on the connection.
+   */
+  void unread(const void *buffer, int len);
+
+  /*
+   * waits up to timeoutMs milliseconds for data to read and returns
+   * whether there is some. Returns false if the peer closed its end.
+   */
+  bool waitReadable(int timeoutMs);
+
+  /*
+   * whether the peer has closed the connection or it failed, without
+   * waiting. Data the peer sent doesn't count as closed.
+   */
+  bool isClosed(void);
+
+  /*
+   * closes a connection whose request we didn't read all of. It stops
+   * sending and throws away what the peer has already sent first, so
+   * the response we wrote isn't lost to a connection reset. Never
+   * blocks waiting for more data.
+   */
+  void lingeringClose(void);
+
+  /*
+   * whether a read or write failed because the timeout the socket was
+   * made with ran out.
+   */
+  bool timedOut(void);
+
+  /*
+   * sends count bytes of the open file fd starting at offset straight
+   * from the kernel with sendfile, without copying them into user space.
+   * Sockets that transform the data they send (like TLS) have to
+   * override this.
+   */
+  virtual void sendFile(int fd, off_t offset, size_t count);
+
+  /*
+   * writes iovcnt buffers back to back with as few writev calls as
+   * possible, so callers never have to concatenate them. iov is updated
+   * as buffers are sent. Like sendFile, sockets that transform the data
+   * they send have to override this.
+   */
+  virtual void writeVector(struct iovec *iov, int iovcnt);
   
  protected:
-  void call_connect(const char *inetAddr, int port);
+  void call_connect(const char *inetAddr, int port, int timeoutMs = 0);
+  void checkTimeout(void);
   void write_bytes(const void *buffer, int len);
   int sockFd;
+  // bytes given back with unread, which reads return before the socket's
+  std::string unreadBytes;
+  bool m_timedOut;
 };
 
 #endif
@@ -20,6 +20,7 @@ class MySslSocket: public MySocket {
   MySslSocket(const char *inetAddr, int port, bool debug_print_io=false);
 
   std::string read();
+  int read(void *buffer, int len);
   void write(std::string data);
   void close(void);
   
@@ -0,0 +1,18 @@
+#!/bin/bash
+# Files are streamed with a Content-Length, and chunked when compressing
+# them means we don't know the size up front.
+source tests/server.sh
+start_server 9390
+
+seq 1 20000 > tests-out/39.data
+curl -s -o /dev/null -w "put %{http_code}\n" -T tests-out/39.data localhost:9390/ds3/numbers
+
+curl -s -D tests-out/39.headers -o tests-out/39.body localhost:9390/ds3/numbers
+echo "length $(header Content-Length < tests-out/39.headers)"
+echo "chunked [$(header Transfer-Encoding < tests-out/39.headers)]"
+cmp tests-out/39.data tests-out/39.body && echo "same body"
+
+curl -s -D tests-out/39.headers -H "Accept-Encoding: gzip" localhost:9390/ds3/numbers | gunzip > tests-out/39.body
+echo "gzip length [$(header Content-Length < tests-out/39.headers)]"
+echo "gzip chunked [$(header Transfer-Encoding < tests-out/39.headers)]"
+cmp tests-out/39.data tests-out/39.body && echo "same body"
@@ -0,0 +1,38 @@
+#!/bin/bash
+# PUT bodies can be chunked, a slow one is written as it arrives without
+# holding anyone up, and one too big for a file or cut off is turned away
+# without touching what was there.
+source tests/server.sh
+start_server 9400 -t 4
+
+seq 1 20000 > tests-out/40.data
+curl -s -o /dev/null -w "chunked put %{http_code}\n" -H "Transfer-Encoding: chunked" -T tests-out/40.data localhost:9400/ds3/dir/numbers
+curl -s localhost:9400/ds3/dir/numbers | cmp - tests-out/40.data && echo "same body"
+
+head -c 122881 /dev/zero > tests-out/40.big
+curl -s -o /dev/null -w "chunked too big %{http_code}\n" -H "Transfer-Encoding: chunked" -T tests-out/40.big localhost:9400/ds3/dir/numbers
+curl -s -o /dev/null -w "too big %{http_code}\n" -T tests-out/40.big localhost:9400/ds3/dir/numbers
+curl -s -o /dev/null -w "new directory %{http_code}\n" -H "Transfer-Encoding: chunked" -T tests-out/40.big localhost:9400/ds3/other/numbers
+curl -s localhost:9400/ds3/dir/numbers | cmp - tests-out/40.data && echo "same body"
+curl -s localhost:9400/ds3/
+
+# a slow upload is written as it arrives without holding up anyone else,
+# and the file only changes once all of it is in
+head -c 40000 /dev/urandom > tests-out/40.slow
+curl -s -o /dev/null --limit-rate 10k -H "Transfer-Encoding: chunked" -T tests-out/40.slow localhost:9400/ds3/dir/numbers &
+slow=$!
+sleep 1
+start=$(date +%s%N)
+curl -s -o /dev/null -w "put during the upload %{http_code}\n" -X PUT --data "quick" localhost:9400/ds3/quick
+curl -s localhost:9400/ds3/dir/numbers | cmp - tests-out/40.data && echo "old body during the upload"
+(( ($(date +%s%N) - start) / 1000000 < 1000 )) && echo "not held up"
+wait $slow
+curl -s localhost:9400/ds3/dir/numbers | cmp - tests-out/40.slow && echo "new body after the upload"
+
+# one that's cut off leaves the file alone
+curl -s -o /dev/null --limit-rate 10k -H "Transfer-Encoding: chunked" -T tests-out/40.data localhost:9400/ds3/dir/numbers &
+slow=$!
+sleep 1
+kill $slow
+wait $slow 2> /dev/null
+curl -s localhost:9400/ds3/dir/numbers | cmp - tests-out/40.slow && echo "same body after the cut off upload"
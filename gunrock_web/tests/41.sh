@@ -0,0 +1,28 @@
+#!/bin/bash
+# Single, suffix, open ended and multiple ranges, ranges that cross a
+# block boundary, and ranges we can't or won't satisfy.
+source tests/server.sh
+start_server 9410
+
+range () {
+    curl -s -D tests-out/41.headers -o tests-out/41.body -H "Range: $1" localhost:9410/ds3/file
+    echo "$1: $(head -1 tests-out/41.headers | cut -d' ' -f2) [$(header Content-Range < tests-out/41.headers)]"
+}
+
+seq -w 1 2000 | tr -d '\n' > tests-out/41.data
+curl -s -o /dev/null -w "put %{http_code}\n" -T tests-out/41.data localhost:9410/ds3/file
+
+range "bytes=0-7"
+cat tests-out/41.body; echo
+range "bytes=4090-4105"
+cat tests-out/41.body; echo
+range "bytes=-6"
+cat tests-out/41.body; echo
+range "bytes=7990-"
+cat tests-out/41.body; echo
+range "bytes=0-3,8-11"
+echo "$(header Content-Type < tests-out/41.headers)"
+tr -d '\r' < tests-out/41.body
+range "bytes=8000-8010"
+range "bytes=abc"
+cmp tests-out/41.body tests-out/41.data && echo "whole file"
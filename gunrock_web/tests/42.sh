@@ -0,0 +1,31 @@
+#!/bin/bash
+# ETags change with the file, and conditional GETs, PUTs and DELETEs
+# follow them.
+source tests/server.sh
+start_server 9420
+
+etag () {
+    curl -s -D - -o /dev/null localhost:9420/ds3/$1 | header ETag
+}
+
+status () {
+    curl -s -o /dev/null -w "%{http_code}" "$@"
+}
+
+echo "put $(status -X PUT --data one localhost:9420/ds3/file)"
+first=$(etag file)
+[[ $first == $(etag file) ]] && echo "etag stable"
+echo "get if-none-match current $(status -H "If-None-Match: $first" localhost:9420/ds3/file)"
+echo "get if-none-match weak $(status -H "If-None-Match: W/$first" localhost:9420/ds3/file)"
+echo "put if-match current $(status -X PUT --data two -H "If-Match: $first" localhost:9420/ds3/file)"
+second=$(etag file)
+[[ $first != $second ]] && echo "etag changed"
+echo "get if-none-match old $(status -H "If-None-Match: $first" localhost:9420/ds3/file)"
+echo "put if-match old $(status -X PUT --data three -H "If-Match: $first" localhost:9420/ds3/file)"
+echo "put if-none-match * existing $(status -X PUT --data three -H "If-None-Match: *" localhost:9420/ds3/file)"
+echo "put if-none-match * new $(status -X PUT --data new -H "If-None-Match: *" localhost:9420/ds3/other)"
+echo "put if-match * missing $(status -X PUT --data new -H "If-Match: *" localhost:9420/ds3/missing)"
+echo "delete if-match old $(status -X DELETE -H "If-Match: $first" localhost:9420/ds3/file)"
+echo "contents $(curl -s localhost:9420/ds3/file)"
+echo "delete if-match current $(status -X DELETE -H "If-Match: $second" localhost:9420/ds3/file)"
+echo "get deleted $(status localhost:9420/ds3/file)"
@@ -0,0 +1,32 @@
+#!/bin/bash
+# HEAD answers with a file's size and type from its inode, without
+# reading the file.
+source tests/server.sh
+start_server 9430
+
+blocks_read () {
+    curl -s localhost:9430/metrics | grep "^gunrock_disk_blocks_read_total" | cut -d' ' -f2
+}
+
+# the disk blocks one HEAD of path reads
+head_blocks () {
+    local before=$(blocks_read)
+    curl -s -I -o /dev/null localhost:9430/ds3/$1
+    echo $(( $(blocks_read) - before ))
+}
+
+head_request () {
+    curl -s -I -o tests-out/43.headers -w "%{http_code}" "$@"
+    echo " [$(header Content-Length < tests-out/43.headers)] [$(header X-Ds3-Type < tests-out/43.headers)] [$(header Accept-Ranges < tests-out/43.headers)]"
+}
+
+seq 1 2000 > tests-out/43.data
+curl -s -o /dev/null -w "put %{http_code}\n" -T tests-out/43.data localhost:9430/ds3/dir/file
+seq 1 20000 > tests-out/43.data
+curl -s -o /dev/null -w "put %{http_code}\n" -T tests-out/43.data localhost:9430/ds3/dir/large
+echo "file $(head_request localhost:9430/ds3/dir/file)"
+echo "directory $(head_request localhost:9430/ds3/dir)"
+echo "missing $(head_request localhost:9430/ds3/missing)"
+etag=$(curl -s -I localhost:9430/ds3/dir/file | header ETag)
+echo "if-none-match $(head_request -H "If-None-Match: $etag" localhost:9430/ds3/dir/file)"
+[[ $(head_blocks dir/file) == $(head_blocks dir/large) ]] && echo "same blocks read for a small and a large file"
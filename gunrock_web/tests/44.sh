@@ -0,0 +1,25 @@
+#!/bin/bash
+# Static files too big to keep in memory are sent from disk, whole and
+# with the right length even when the file changes between requests.
+source tests/server.sh
+mkdir -p tests-out/44.static
+seq 1 300000 > tests-out/44.static/large.txt
+echo "small file" > tests-out/44.static/small.txt
+start_server 9440 -d tests-out/44.static
+
+get () {
+    curl -s -D tests-out/44.headers -o tests-out/44.body -w "%{http_code}" localhost:9440/$1
+    echo " [$(header Content-Length < tests-out/44.headers)]"
+}
+
+echo "large $(get large.txt)"
+cmp tests-out/44.body tests-out/44.static/large.txt && echo "same body"
+curl -s -o tests-out/44.first -o tests-out/44.second localhost:9440/large.txt localhost:9440/large.txt
+cmp tests-out/44.first tests-out/44.static/large.txt && cmp tests-out/44.second tests-out/44.static/large.txt && echo "same body twice on one connection"
+seq 1 250000 > tests-out/44.static/large.txt
+echo "changed $(get large.txt)"
+cmp tests-out/44.body tests-out/44.static/large.txt && echo "same body"
+echo "small $(get small.txt)"
+cat tests-out/44.body
+echo "missing $(get missing.txt)"
+echo "outside $(curl -s -o /dev/null -w "%{http_code}" --path-as-is localhost:9440/../44.sh)"
@@ -0,0 +1,17 @@
+#!/bin/bash
+# Headers and bodies written together have to come out framed right when
+# the client sends several requests on one connection without waiting.
+source tests/server.sh
+start_server 9450
+
+curl -s -o /dev/null -w "put %{http_code}\n" -X PUT --data hello localhost:9450/ds3/file
+exec 3<> /dev/tcp/localhost/9450
+printf 'GET /ds3/file HTTP/1.1\r\nHost: x\r\n\r\n' >&3
+printf 'HEAD /ds3/file HTTP/1.1\r\nHost: x\r\n\r\n' >&3
+printf 'GET /ds3/file HTTP/1.1\r\nHost: x\r\nIf-None-Match: *\r\n\r\n' >&3
+printf 'GET /ds3/missing HTTP/1.1\r\nHost: x\r\n\r\n' >&3
+printf 'GET /ds3/file HTTP/1.1\r\nHost: x\r\nRange: bytes=1-3\r\nConnection: close\r\n\r\n' >&3
+# the ETags start with when the server started
+tr -d '\r' <&3 | sed 's/^ETag: .*/ETag: (etag)/'
+echo
+exec 3<&-
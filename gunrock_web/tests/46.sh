@@ -0,0 +1,41 @@
+#!/bin/bash
+# Static files are read once and served from memory until they change.
+source tests/server.sh
+mkdir -p tests-out/46.static
+echo "body { color: red; }" > tests-out/46.static/style.css
+start_server 9460 -d tests-out/46.static
+
+cache () {
+    curl -s localhost:9460/metrics | grep "^gunrock_static_cache_$1_total" | cut -d' ' -f2
+}
+
+get () {
+    rm -f tests-out/46.body
+    curl -s -D tests-out/46.headers -o tests-out/46.body -w "%{http_code}" "$@" localhost:9460/style.css
+    echo " [$(header Content-Type < tests-out/46.headers)] $(cat tests-out/46.body 2> /dev/null)"
+}
+
+echo "first $(get)"
+echo "second $(get)"
+echo "hits $(cache hits) misses $(cache misses)"
+etag=$(header ETag < tests-out/46.headers)
+echo "if-none-match $(get -H "If-None-Match: $etag")"
+echo "body { color: blue; }" > tests-out/46.static/style.css
+echo "changed $(get)"
+echo "if-none-match old $(get -H "If-None-Match: $etag")"
+echo "hits $(cache hits) misses $(cache misses)"
+
+# a full cache drops the files used longest ago, not the ones in use
+for idx in $(seq 140); do
+    echo "file $idx" > tests-out/46.static/file$idx.txt
+done
+hits=$(cache hits)
+misses=$(cache misses)
+for idx in $(seq 140); do
+    curl -s -o /dev/null localhost:9460/file$idx.txt
+    (( idx % 20 == 0 )) && curl -s -o /dev/null localhost:9460/style.css
+done
+echo "140 new files and 7 gets of a cached one: $(( $(cache hits) - hits )) hits $(( $(cache misses) - misses )) misses"
+curl -s -o /dev/null localhost:9460/file140.txt
+curl -s -o /dev/null localhost:9460/file1.txt
+echo "newest and oldest again: $(( $(cache hits) - hits )) hits $(( $(cache misses) - misses )) misses"
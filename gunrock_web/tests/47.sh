@@ -0,0 +1,35 @@
+#!/bin/bash
+# Bodies are compressed with the coding the client likes best, never
+# with one it refuses with q=0, and decompress to what was stored.
+source tests/server.sh
+mkdir -p tests-out/47.static
+seq 1 1000 > tests-out/47.static/numbers.js
+start_server 9470 -d tests-out/47.static
+
+seq 1 1000 > tests-out/47.data
+curl -s -o /dev/null -w "put %{http_code}\n" -T tests-out/47.data localhost:9470/ds3/numbers
+
+while read accept; do
+    encoding=$(curl -s -D - -o /dev/null -H "Accept-Encoding: $accept" localhost:9470/ds3/numbers | header Content-Encoding)
+    echo "$accept => [$encoding]"
+done <<'ACCEPT'
+gzip
+deflate
+x-gzip
+*
+deflate, gzip
+gzip;q=0.5, deflate
+gzip;q=0
+*;q=0
+deflate;q=0, gzip;q=0
+gzip;q=0, *
+identity
+ACCEPT
+
+for path in ds3/numbers numbers.js; do
+    for encoding in gzip deflate; do
+        curl -s --compressed -D tests-out/47.headers -H "Accept-Encoding: $encoding" localhost:9470/$path | cmp - tests-out/47.data && \
+            echo "$path $encoding [$(header Content-Encoding < tests-out/47.headers)] [$(header Vary < tests-out/47.headers)] decompresses"
+    done
+done
+curl -s -D - -o /dev/null -H "Accept-Encoding: gzip" localhost:9470/ds3/numbers | header ETag | grep -q '^W/' && echo "compressed etag is weak"
@@ -0,0 +1,28 @@
+#!/bin/bash
+# Exact routes win over services, longer prefixes win over shorter ones,
+# and workers dispatching at once each get their own route.
+source tests/server.sh
+start_server 9480 -t 8
+
+curl -s -o /dev/null -X PUT --data "a file" localhost:9480/ds3/file
+for method in GET POST PUT DELETE; do
+    for path in /metrics /metrics/x /ds3 /ds3/ /ds3/missing /hello_world.html /nothing/here; do
+        echo "$method $path $(curl -s -o /dev/null -w "%{http_code}" -X $method localhost:9480$path)"
+    done
+done
+
+# each request checks it got the body of the route it asked for
+check () {
+    case $1 in
+        /ds3/file) [[ $(curl -s localhost:9480$1) == "a file" ]] ;;
+        /metrics) curl -s localhost:9480$1 | grep -q "^# TYPE gunrock_requests_total" ;;
+        /hello_world.html) curl -s localhost:9480$1 | grep -q "<html" ;;
+    esac || echo "wrong body for $1"
+}
+export -f check
+for idx in $(seq 100); do
+    echo /ds3/file
+    echo /metrics
+    echo /hello_world.html
+done | xargs -P 16 -I {} bash -c "check {}"
+echo "concurrent requests done"
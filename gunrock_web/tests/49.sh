@@ -0,0 +1,30 @@
+#!/bin/bash
+# Header names match whatever their case, among many other headers, and
+# a request with no headers at all is still answered.
+source tests/server.sh
+start_server 9490
+
+curl -s -o /dev/null -w "put %{http_code}\n" -X PUT --data 0123456789 localhost:9490/ds3/file
+
+raw () {
+    exec 3<> /dev/tcp/localhost/9490
+    printf "$1" >&3
+    tr -d '\r' <&3 | grep -v "^ETag:"
+    echo
+    exec 3<&-
+}
+
+echo "lower case range"
+raw 'GET /ds3/file HTTP/1.1\r\nhost: x\r\nrange: bytes=2-4\r\nconnection: close\r\n\r\n'
+echo "upper case range"
+raw 'GET /ds3/file HTTP/1.1\r\nHOST: x\r\nRANGE: bytes=5-\r\nCONNECTION: CLOSE\r\n\r\n'
+
+headers=""
+for idx in $(seq 40); do
+    headers="${headers}X-Filler-$idx: $idx\r\n"
+done
+echo "range after 40 other headers"
+raw "GET /ds3/file HTTP/1.1\r\nHost: x\r\n${headers}Range: bytes=0-1\r\nConnection: close\r\n\r\n"
+
+echo "no headers"
+raw 'GET /ds3/file HTTP/1.0\r\n\r\n'
@@ -0,0 +1,26 @@
+#!/bin/bash
+# Requests and responses take nothing from the heap once their memory
+# comes from the arena, and the arena is reset between the requests on a
+# connection without mixing them up.
+make -s alloc_bench > /dev/null
+./alloc_bench 100 | grep arena
+
+source tests/server.sh
+start_server 9500
+
+for idx in $(seq 20); do
+    curl -s -o /dev/null -X PUT --data "file $idx" localhost:9500/ds3/dir/file$idx
+done
+exec 3<> /dev/tcp/localhost/9500
+for idx in $(seq 99); do
+    # headers of every size, so some requests outgrow the first block of the arena;
+    # a connection takes at most 100 requests
+    filler=$(printf "%$(( idx * 210 ))s" | tr ' ' x)
+    printf "GET /ds3/dir/file$(( idx % 20 + 1 )) HTTP/1.1\r\nHost: x\r\nX-Filler: $filler\r\n\r\n" >&3
+done
+printf "GET /ds3/dir/file1 HTTP/1.1\r\nHost: x\r\nConnection: close\r\n\r\n" >&3
+tr -d '\r' <&3 | grep -o "file [0-9]*" > tests-out/50.bodies
+exec 3<&-
+for idx in $(seq 99); do
+    echo "file $(( idx % 20 + 1 ))"
+done | cat - <(echo "file 1") | cmp - tests-out/50.bodies && echo "100 responses in order"
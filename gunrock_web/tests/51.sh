@@ -0,0 +1,17 @@
+#!/bin/bash
+# With more threads logging than there are rings, every line still makes
+# it to the log file and the file reads in the order lines were logged.
+source tests/server.sh
+start_server 9510 -t 300 -l tests-out/51.log
+
+seq 600 | xargs -P 50 -I {} curl -s -o /dev/null localhost:9510/ds3/
+# give the writer time to drain the rings
+sleep 1
+stop_servers
+
+echo "workers started $(grep -c "^my_start_routine_enter" tests-out/51.log)"
+# one more for start_server's check that the server is up
+echo "responses $(grep -c "^write_response" tests-out/51.log)"
+# thread ids are handed out in the order threads first log
+awk '{print $3}' tests-out/51.log | awk '!seen[$1]++' | sort -n -c && echo "thread ids in order"
+echo "thread ids $(awk '{print $3}' tests-out/51.log | sort -n -u | wc -l)"
@@ -0,0 +1,21 @@
+#!/bin/bash
+# Requests are counted by method and status, and their latencies add up
+# to histograms whose buckets only grow.
+source tests/server.sh
+start_server 9520 -t 4
+
+for idx in 1 2 3; do
+    curl -s -o /dev/null -X PUT --data "file $idx" localhost:9520/ds3/file$idx
+done
+for idx in 1 2 3 4 5; do
+    curl -s -o /dev/null localhost:9520/ds3/missing
+done
+curl -s -o /dev/null -X DELETE localhost:9520/ds3/missing
+curl -s -o /dev/null -X DELETE localhost:9520/ds3/file1
+
+curl -s localhost:9520/metrics > tests-out/52.metrics
+grep -E '^gunrock_requests_total\{method="(PUT|DELETE)"|^gunrock_requests_total\{method="GET",status="404"' tests-out/52.metrics
+grep -E '^gunrock_request_duration_seconds_(bucket|count)\{method="PUT"' tests-out/52.metrics | grep -E 'Inf|count'
+grep '^gunrock_request_duration_seconds_bucket{method="PUT"' tests-out/52.metrics | cut -d' ' -f2 | sort -n -c && echo "buckets only grow"
+echo "PUT quantiles $(grep -c '^gunrock_request_duration_quantile_seconds{method="PUT"' tests-out/52.metrics)"
+grep -E '^gunrock_(workers|lfs_creates_total|lfs_unlinks_total) ' tests-out/52.metrics
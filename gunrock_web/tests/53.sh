@@ -0,0 +1,42 @@
+#!/bin/bash
+# Connections past the queue and bodies past the in-flight limit get a
+# 503, and a client that's slow to send its body only holds up itself.
+source tests/server.sh
+start_server 9530 -t 1 -b 1 -o shed
+
+status () {
+    curl -s -D tests-out/53.headers -o /dev/null -w "%{http_code}" "$@"
+}
+
+# a client that sends half its body and stalls, keeping its worker busy
+start_slow_put () {
+    exec 3<> /dev/tcp/localhost/$1
+    printf "PUT /ds3/slow HTTP/1.1\r\nHost: x\r\nContent-Length: $2\r\nConnection: close\r\n\r\nhalf" >&3
+    sleep 0.5
+}
+
+finish_slow_put () {
+    printf "%$(( $1 - 4 ))s" | tr ' ' x >&3
+    echo "slow put $(tr -d '\r' <&3 | head -1)"
+    exec 3<&-
+}
+
+start_slow_put 9530 8
+status localhost:9530/ds3/ > tests-out/53.queued &
+queued=$!
+sleep 0.5
+echo "past the queue $(status localhost:9530/ds3/) [$(header Retry-After < tests-out/53.headers)]"
+finish_slow_put 8
+wait $queued
+echo "queued $(cat tests-out/53.queued)"
+stop_servers
+
+start_server 9531 -t 4 -m 100
+start_slow_put 9531 80
+echo "over the limit $(status -X PUT --data-binary @<(printf "%50s") localhost:9531/ds3/big)"
+echo "under the limit $(status -X PUT --data "small" localhost:9531/ds3/small)"
+# a chunked body counts as the biggest file, however small it turns out
+echo "chunked $(status -X PUT -H "Transfer-Encoding: chunked" --data "tiny" localhost:9531/ds3/tiny)"
+echo "get $(status localhost:9531/ds3/small)"
+finish_slow_put 80
+echo "shed $(curl -s localhost:9531/metrics | grep "^gunrock_shed_total" | cut -d' ' -f2)"
@@ -0,0 +1,45 @@
+#!/bin/bash
+# Writes to a primary in synchronous mode are on its backup by the time
+# the client hears back, and the backup turns away writes of its own.
+source tests/server.sh
+start_server 9541 -R
+backup=$!
+start_server 9540 -B localhost:9541 -A sync
+
+status () {
+    curl -s -o /dev/null -w "%{http_code}" "$@"
+}
+
+# the primary first brings the backup's blank disk up to date with its
+# own, and writes it makes meanwhile would go over with the blocks
+for try in $(seq 50); do
+    [[ $(curl -s localhost:9541/replication | cut -d' ' -f1) != "" ]] && break
+    sleep 0.1
+done
+
+echo "put $(status -X PUT --data "first" localhost:9540/ds3/dir/file)"
+echo "backup has $(curl -s localhost:9541/ds3/dir/file)"
+echo "overwrite $(status -X PUT --data "second" localhost:9540/ds3/dir/file)"
+echo "backup has $(curl -s localhost:9541/ds3/dir/file)"
+echo "put other $(status -X PUT --data "other" localhost:9540/ds3/other)"
+echo "delete $(status -X DELETE localhost:9540/ds3/dir/file)"
+echo "backup get deleted $(status localhost:9541/ds3/dir/file)"
+echo "backup listing $(curl -s localhost:9541/ds3/ | tr '\n' ' ')"
+echo "put to backup $(status -X PUT --data "nope" localhost:9541/ds3/nope)"
+echo "delete on backup $(status -X DELETE localhost:9541/ds3/other)"
+echo "backup position $(curl -s localhost:9541/replication | cut -d' ' -f2)"
+echo "records sent $(curl -s localhost:9540/metrics | grep "^gunrock_replication_records_sent_total" | cut -d' ' -f2)"
+
+# a backup that stops answering holds up a write only until it times out,
+# and catches up once it answers again
+kill -STOP $backup
+read code seconds <<< "$(curl -s -o /dev/null -w "%{http_code} %{time_total}" -X PUT --data "hung" localhost:9540/ds3/hung)"
+echo "put with a hung backup $code"
+(( ${seconds%.*} < 15 )) && echo "gave up on the backup"
+echo "put after that $(status -X PUT --data "after" localhost:9540/ds3/after)"
+kill -CONT $backup
+for try in $(seq 100); do
+    [[ $(curl -s localhost:9541/ds3/after) == "after" ]] && break
+    sleep 0.1
+done
+echo "backup caught up $(curl -s localhost:9541/ds3/hung) $(curl -s localhost:9541/ds3/after)"
@@ -0,0 +1,38 @@
+#!/bin/bash
+# A gateway puts every top-level name on exactly one storage node, with
+# everything beneath it, and lists the root by asking every node.
+source tests/server.sh
+start_server 9551
+start_server 9552
+start_server 9553
+start_server 9550 -S localhost:9551,localhost:9552,localhost:9553
+
+status () {
+    curl -s -o /dev/null -w "%{http_code}" "$@"
+}
+
+for idx in $(seq 12); do
+    status -X PUT --data "object $idx" localhost:9550/ds3/object$idx > /dev/null
+done
+status -X PUT --data "a" localhost:9550/ds3/dir/a > /dev/null
+status -X PUT --data "b" localhost:9550/ds3/dir/b/c > /dev/null
+
+echo "root listing"
+curl -s localhost:9550/ds3/ | sort -V
+for idx in 1 7 12; do
+    echo "object$idx $(curl -s localhost:9550/ds3/object$idx)"
+done
+echo "dir/b/c $(curl -s localhost:9550/ds3/dir/b/c)"
+
+# every name is stored on one node
+for port in 9551 9552 9553; do
+    curl -s localhost:$port/ds3/
+done | sort | uniq -c | awk '$1 != 1 {print "on " $1 " nodes: " $2}'
+for port in 9551 9552 9553; do
+    [[ $(curl -s localhost:$port/ds3/dir/ | tr '\n' ' ') == "a b/ " ]] && echo "dir is whole on one node"
+done
+
+head -c 122881 /dev/zero > tests-out/55.big
+echo "too big $(status -H "Transfer-Encoding: chunked" -T tests-out/55.big localhost:9550/ds3/big)"
+echo "delete $(status -X DELETE localhost:9550/ds3/object7)"
+echo "get deleted $(status localhost:9550/ds3/object7)"
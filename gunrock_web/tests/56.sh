@@ -0,0 +1,58 @@
+#!/bin/bash
+# A gateway reuses its connections to storage nodes, gives up on a node
+# that stops answering after its timeout without holding up the other
+# node, and fails fast on a node that is gone.
+source tests/server.sh
+start_server 9561
+node=$!
+start_server 9562
+start_server 9560 -t 4 -C 0 -S localhost:9561,localhost:9562
+
+metric () {
+    curl -s localhost:9560/metrics | grep "^gunrock_$1 " | cut -d' ' -f2
+}
+
+get () {
+    curl -s -o /dev/null -w "%{http_code} %{time_total}" localhost:9560/ds3/$1
+}
+
+for idx in $(seq 8); do
+    curl -s -o /dev/null -X PUT --data "object $idx" localhost:9560/ds3/object$idx
+done
+before=$(metric backend_connections_opened_total)
+for idx in $(seq 50); do
+    curl -s -o /dev/null localhost:9560/ds3/object$(( idx % 8 + 1 ))
+done
+echo "50 gets opened $(( $(metric backend_connections_opened_total) - before )) connections"
+echo "healthy $(metric backends_healthy)"
+
+on_node=$(curl -s localhost:9561/ds3/ | sort | head -1)
+on_other=$(curl -s localhost:9562/ds3/ | sort | head -1)
+
+# a stopped node still accepts connections but never answers them
+kill -STOP $node
+get $on_node > tests-out/56.hung &
+hung=$!
+sleep 0.5
+read code seconds <<< "$(get $on_other)"
+echo "other node while one hangs $code"
+(( ${seconds%.*} < 1 )) && echo "other node answered right away"
+wait $hung
+read code seconds < tests-out/56.hung
+echo "hung node $code"
+(( ${seconds%.*} >= 4 && ${seconds%.*} < 8 )) && echo "gave up after the timeout"
+kill -CONT $node
+
+for try in $(seq 50); do
+    [[ $(metric backends_healthy) == 2 ]] && break
+    sleep 0.1
+done
+echo "healthy again $(metric backends_healthy)"
+echo "$on_node after it came back $(curl -s localhost:9560/ds3/$on_node)"
+
+kill $node
+wait $node 2> /dev/null
+read code seconds <<< "$(get $on_node)"
+echo "dead node $code"
+(( ${seconds%.*} < 1 )) && echo "failed right away"
+echo "other node $(get $on_other | cut -d' ' -f1)"
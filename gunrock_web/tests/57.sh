@@ -0,0 +1,43 @@
+#!/bin/bash
+# A gateway serves objects it fetched recently from its cache, forgets
+# them when they're written through it, checks them with their node once
+# they go stale, and keeps out objects too big for the cache.
+source tests/server.sh
+start_server 9571
+start_server 9570 -C 400000 -S localhost:9571
+
+metric () {
+    curl -s localhost:9570/metrics | grep "^gunrock_gateway_cache_$1 " | cut -d' ' -f2
+}
+
+counts () {
+    echo "$1: hits $(metric hits_total) misses $(metric misses_total) revalidations $(metric revalidations_total)"
+}
+
+curl -s -X PUT --data "first" localhost:9570/ds3/object > /dev/null
+for idx in $(seq 5); do
+    curl -s localhost:9570/ds3/object > /dev/null
+done
+counts "five gets"
+echo "node $(curl -s localhost:9571/metrics | grep '^gunrock_requests_total{method="GET"')"
+
+curl -s -X PUT --data "second" localhost:9570/ds3/object > /dev/null
+echo "after a put through the gateway $(curl -s localhost:9570/ds3/object)"
+
+# a write the gateway doesn't see is noticed once the object goes stale
+curl -s -X PUT --data "third" localhost:9571/ds3/object > /dev/null
+sleep 1.2
+echo "once it went stale $(curl -s localhost:9570/ds3/object)"
+echo "revalidations $(metric revalidations_total)"
+
+curl -s -X PUT --data "gone soon" localhost:9570/ds3/dir/a > /dev/null
+curl -s localhost:9570/ds3/dir/a > /dev/null
+curl -s -X DELETE localhost:9570/ds3/dir/a > /dev/null
+echo "deleted $(curl -s -o /dev/null -w "%{http_code}" localhost:9570/ds3/dir/a)"
+
+head -c 60000 /dev/zero > tests-out/57.big
+curl -s -T tests-out/57.big localhost:9570/ds3/big > /dev/null
+curl -s localhost:9570/ds3/big > /dev/null
+curl -s localhost:9570/ds3/big > /dev/null
+echo "misses after two gets of a big object $(metric misses_total)"
+(( $(metric bytes) < 60000 )) && echo "big object not cached"
@@ -0,0 +1,53 @@
+#!/bin/bash
+# A gateway keeping every object on all three nodes reads and writes
+# with any two of them, brings a node that lost its objects back up to
+# date as it reads, and fails once two nodes are gone.
+source tests/server.sh
+start_server 9581
+first=$!
+start_server 9582
+second=$!
+start_server 9583
+start_server 9580 -C 0 -Q 3,2,2 -S localhost:9581,localhost:9582,localhost:9583
+
+status () {
+    curl -s -o /dev/null -w "%{http_code}" "$@"
+}
+
+metric () {
+    curl -s localhost:9580/metrics | grep "^gunrock_quorum_$1 " | cut -d' ' -f2
+}
+
+for idx in $(seq 4); do
+    status -X PUT --data "object $idx" localhost:9580/ds3/object$idx > /dev/null
+done
+for port in 9581 9582 9583; do
+    echo "on $port: $(curl -s localhost:$port/ds3/ | sort | tr '\n' ' ')"
+done
+curl -s -D tests-out/58.headers -o /dev/null localhost:9580/ds3/object1
+[[ -n $(header X-Ds3-Version < tests-out/58.headers) ]] && echo "reads carry a version"
+
+kill $first
+wait $first 2> /dev/null
+echo "write with a node down $(status -X PUT --data "object 1 again" localhost:9580/ds3/object1)"
+echo "read with a node down $(curl -s localhost:9580/ds3/object1)"
+
+# it comes back empty and catches up on what's read
+start_server 9581
+first=$!
+for idx in $(seq 4); do
+    echo "object$idx $(curl -s localhost:9580/ds3/object$idx)"
+done
+for try in $(seq 50); do
+    [[ $(curl -s localhost:9581/ds3/ | wc -l) == 4 ]] && break
+    sleep 0.1
+done
+echo "back on 9581: $(curl -s localhost:9581/ds3/ | sort | tr '\n' ' ')"
+echo "object1 on 9581 $(curl -s localhost:9581/ds3/object1)"
+(( $(metric read_repairs_total) >= 4 )) && echo "repaired"
+
+kill $first $second
+wait $first $second 2> /dev/null
+echo "write with two nodes down $(status -X PUT --data "lost" localhost:9580/ds3/object2)"
+echo "read with two nodes down $(status localhost:9580/ds3/object2)"
+echo "failures $(metric failures_total)"
@@ -0,0 +1,74 @@
+#!/bin/bash
+# A backup that was down catches up on the writes it missed from its
+# primary's log when it comes back with its disk, and is sent the blocks
+# that differ when it comes back without it.
+source tests/server.sh
+start_server 9591 -R
+backup=$!
+start_server 9590 -B localhost:9591 -A sync
+
+status () {
+    curl -s -o /dev/null -w "%{http_code}" "$@"
+}
+
+position () {
+    curl -s localhost:9591/replication | cut -d' ' -f2
+}
+
+# waits for the backup to have applied write $1
+caught_up () {
+    for try in $(seq 100); do
+        [[ $(position) == $1 ]] && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+contents () {
+    echo "$1: $(curl -s localhost:$1/ds3/ | tr '\n' ' ')/ a=$(curl -s localhost:$1/ds3/a) b=$(curl -s localhost:$1/ds3/b) c=$(curl -s localhost:$1/ds3/c)"
+}
+
+metric () {
+    curl -s localhost:9590/metrics | grep "^gunrock_replication_$1 " | cut -d' ' -f2
+}
+
+status -X PUT --data "a1" localhost:9590/ds3/a > /dev/null
+status -X PUT --data "b1" localhost:9590/ds3/b > /dev/null
+echo "backup position $(position)"
+
+copied=$(metric resync_blocks_total)
+kill $backup
+wait $backup 2> /dev/null
+echo "put while the backup is down $(status -X PUT --data "b2" localhost:9590/ds3/b)"
+echo "put while the backup is down $(status -X PUT --data "c1" localhost:9590/ds3/c)"
+echo "delete while the backup is down $(status -X DELETE localhost:9590/ds3/a)"
+
+# same disk, so it picks up after write 2
+./gunrock_web -p 9591 -i tests-out/9591.img -R >> tests-out/9591.log 2>&1 &
+backup=$!
+SERVERS="$SERVERS $backup"
+caught_up 5 && echo "caught up from the log"
+contents 9590
+contents 9591
+echo "blocks copied $(( $(metric resync_blocks_total) - copied ))"
+
+kill $backup
+wait $backup 2> /dev/null
+status -X PUT --data "c2" localhost:9590/ds3/c > /dev/null
+
+# a blank disk has to be copied
+start_server 9591 -R
+caught_up 6 && echo "caught up by copying blocks"
+contents 9591
+(( $(metric resync_blocks_total) > copied )) && echo "blocks copied"
+echo "put after resync $(status -X PUT --data "a2" localhost:9590/ds3/a)"
+echo "backup has $(curl -s localhost:9591/ds3/a)"
+
+# a backup won't apply records past a gap, or from a primary run that
+# hasn't resynced it
+epoch=$(curl -s localhost:9591/replication | cut -d' ' -f1)
+before=$(position)
+echo "records past a gap $(printf "$(( before + 5 )) P 3 3\ngapxyz" | status -X POST -H "X-Ds3-Epoch: $epoch" --data-binary @- localhost:9591/replication)"
+echo "records from another primary $(printf "1 P 3 3\ngapxyz" | status -X POST -H "X-Ds3-Epoch: other" --data-binary @- localhost:9591/replication)"
+echo "backup position unchanged $(( $(position) == before ))"
+echo "gap on the backup $(status localhost:9591/ds3/gap)"
@@ -0,0 +1,54 @@
+#!/bin/bash
+# Adding a node to a gateway moves the entries it now owns to it in the
+# background while every object stays readable, and removing it moves
+# them back.
+source tests/server.sh
+start_server 9601
+start_server 9602
+start_server 9603
+start_server 9600 -C 0 -S localhost:9601,localhost:9602
+
+status () {
+    curl -s -o /dev/null -w "%{http_code}" "$@"
+}
+
+# waits for the move to finish
+finished () {
+    for try in $(seq 100); do
+        curl -s localhost:9600/rebalance | grep -q "^running 0" && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+check () {
+    local bad=0
+    for idx in $(seq 20); do
+        [[ $(curl -s localhost:9600/ds3/object$idx) == "object $idx" ]] || bad=$(( bad + 1 ))
+    done
+    [[ $(curl -s localhost:9600/ds3/dir/b/c) == "c" ]] || bad=$(( bad + 1 ))
+    echo "$1: $bad unreadable, $(curl -s localhost:9600/ds3/ | wc -l) listed"
+}
+
+for idx in $(seq 20); do
+    status -X PUT --data "object $idx" localhost:9600/ds3/object$idx > /dev/null
+done
+status -X PUT --data "c" localhost:9600/ds3/dir/b/c > /dev/null
+
+echo "add $(status -X POST "localhost:9600/rebalance?add=localhost:9603")"
+check "while moving"
+finished && echo "finished"
+curl -s localhost:9600/rebalance | grep -v "^bytes_copied"
+check "after adding"
+for port in 9601 9602 9603; do
+    curl -s localhost:$port/ds3/
+done | sort | uniq -c | awk '$1 != 1 {print "on " $1 " nodes: " $2}'
+(( $(curl -s localhost:9603/ds3/ | wc -l) > 0 )) && echo "the new node has entries"
+(( $(curl -s localhost:9600/metrics | grep "^gunrock_rebalance_objects_moved_total " | cut -d' ' -f2) > 0 )) && echo "moves counted"
+
+echo "add it again $(status -X POST "localhost:9600/rebalance?add=localhost:9603")"
+echo "add a bad name $(status -X POST "localhost:9600/rebalance?add=nowhere")"
+echo "remove $(status -X POST "localhost:9600/rebalance?remove=localhost:9603")"
+finished && echo "finished"
+check "after removing"
+echo "left on the removed node $(curl -s localhost:9603/ds3/ | wc -l)"
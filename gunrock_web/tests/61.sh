@@ -0,0 +1,19 @@
+#!/bin/bash
+# A primary makes a new HttpClient for every batch it sends its backup,
+# and those clients share kept-alive connections instead of each opening
+# their own.
+source tests/server.sh
+start_server 9611 -R -l tests-out/61.log
+start_server 9610 -B localhost:9611 -A sync
+
+for idx in $(seq 30); do
+    curl -s -o /dev/null -X PUT --data "object $idx" localhost:9610/ds3/object$idx
+done
+echo "backup position $(curl -s localhost:9611/replication | cut -d' ' -f2)"
+echo "object30 on the backup $(curl -s localhost:9611/ds3/object30)"
+stop_servers
+
+# the backup has one worker, so a connection's requests are all together
+most=$(grep "^read_request_return" tests-out/61.log | awk '{print $5}' | uniq -c | sort -n | tail -1 | awk '{print $1}')
+(( most >= 20 )) && echo "batches share one connection" || echo "at most $most requests on a connection"
+(( $(grep -c "^client_accepted" tests-out/61.log) < 10 )) && echo "few connections"
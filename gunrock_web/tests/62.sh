@@ -0,0 +1,30 @@
+#!/bin/bash
+# ds3bulk uploads a directory tree over a few kept-alive connections and
+# downloads it back the same, and reports what it couldn't transfer.
+source tests/server.sh
+start_server 9620 -t 8 -l tests-out/62.log
+
+rm -rf tests-out/62.src tests-out/62.dst tests-out/62.none
+mkdir -p tests-out/62.src/a/b tests-out/62.src/c
+for idx in $(seq 20); do
+    echo "file $idx" > tests-out/62.src/a/file$idx
+done
+echo "deep" > tests-out/62.src/a/b/deep
+: > tests-out/62.src/c/nothing
+head -c 50000 /dev/urandom > tests-out/62.src/c/big
+
+summary () {
+    sed -e 's/ in [0-9.]* s ([0-9.]* MB\/s)//'
+}
+
+./ds3bulk -q -c 4 localhost:9620 upload tests-out/62.src /ds3/tree > tests-out/62.upload
+echo "upload exit $?: $(summary < tests-out/62.upload)"
+echo "remote: $(curl -s localhost:9620/ds3/tree/ | sort | tr '\n' ' ')"
+./ds3bulk -q -c 4 localhost:9620 download /ds3/tree tests-out/62.dst > tests-out/62.download
+echo "download exit $?: $(summary < tests-out/62.download)"
+diff -r tests-out/62.src tests-out/62.dst && echo "same tree"
+# nearly 50 requests, which would each open a connection without reuse
+(( $(grep -c "^client_accepted" tests-out/62.log) < 20 )) && echo "connections reused"
+
+./ds3bulk -q -r 0 localhost:9620 download /ds3/missing tests-out/62.none > tests-out/62.missing 2>&1
+echo "missing remote exit $?: $(summary < tests-out/62.missing | tr '\n' ' ')"
@@ -0,0 +1,46 @@
+#!/bin/bash
+# A batch posted to /ds3/ runs its operations in order and answers with
+# a result for each, and a batch whose writes can't all be done does
+# none of them.
+source tests/server.sh
+start_server 9630
+
+# op path [data]: one operation of a batch
+op () {
+    printf "%s %d %d\n%s%s" $1 ${#2} ${#3} "$2" "$3"
+}
+
+# prints the results of a batch, with the ETags of writes left out
+results () {
+    local status plen dlen path data
+    while read -r status plen dlen; do
+        path=$(dd bs=1 count=$plen status=none)
+        data=$(dd bs=1 count=$dlen status=none)
+        [[ $data == \"* ]] && data="etag"
+        echo "  $status $path $(echo "$data" | tr '\n' ' ')"
+    done
+}
+
+batch () {
+    curl -s -D tests-out/63.headers -o tests-out/63.results -w "%{http_code}" --data-binary @- localhost:9630/ds3/
+}
+
+echo "writes and reads $( (op P a one; op P dir/b two; op G a; op G dir; op G missing; op D a) | batch)"
+results < tests-out/63.results
+echo "a after the batch $(curl -s -o /dev/null -w "%{http_code}" localhost:9630/ds3/a)"
+echo "dir/b after the batch $(curl -s localhost:9630/ds3/dir/b)"
+
+echo "reads $( (op G dir/b; op G dir/; op G nothing) | batch)"
+results < tests-out/63.results
+
+echo "failing write $( (op P c three; op D nosuch; op P dir/b changed) | batch)"
+echo "failed at $(header X-Ds3-Batch-Failed < tests-out/63.headers)"
+echo "c after the failed batch $(curl -s -o /dev/null -w "%{http_code}" localhost:9630/ds3/c)"
+echo "dir/b after the failed batch $(curl -s localhost:9630/ds3/dir/b)"
+
+echo "malformed $(printf "X 1 1\nab" | batch)"
+echo "short $( (op P a one; printf "P 5 100\nshort") | batch)"
+echo "not at the root $(op G a | curl -s -o /dev/null -w "%{http_code}" --data-binary @- localhost:9630/ds3/dir)"
+head -c $(( 16 * 1024 * 1024 + 1 )) /dev/zero > tests-out/63.big
+echo "too big $(curl -s -o /dev/null -w "%{http_code}" -H "Transfer-Encoding: chunked" --data-binary @tests-out/63.big localhost:9630/ds3/)"
+echo "operations $(curl -s localhost:9630/metrics | grep "^gunrock_batch_operations_total " | cut -d' ' -f2)"
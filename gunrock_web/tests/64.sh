@@ -0,0 +1,45 @@
+#!/bin/bash
+# The rebalance endpoints are routed per method, with the shard in the
+# path handed to the route that matched it, and a path with no route
+# for its method is refused.
+source tests/server.sh
+start_server 9641
+start_server 9642
+start_server 9640 -C 0 -S localhost:9641
+
+status () {
+    curl -s -o /dev/null -w "%{http_code}" "$@"
+}
+
+finished () {
+    for try in $(seq 100); do
+        curl -s localhost:9640/rebalance | grep -q "^running 0" && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+for method in GET POST PUT DELETE; do
+    for path in /rebalance /rebalance/shards /rebalance/shards/localhost:9642 /rebalance/shards/a/b; do
+        # only the methods that don't change anything
+        [[ $method == PUT || $method == DELETE ]] && [[ $path == /rebalance/shards/localhost:9642 ]] && continue
+        echo "$method $path $(status -X $method localhost:9640$path)"
+    done
+done
+
+for idx in $(seq 10); do
+    status -X PUT --data "object $idx" localhost:9640/ds3/object$idx > /dev/null
+done
+echo "add $(status -X PUT localhost:9640/rebalance/shards/localhost:9642)"
+finished && echo "finished"
+(( $(curl -s localhost:9642/ds3/ | wc -l) > 0 )) && echo "the added node has entries"
+echo "add it again $(status -X PUT localhost:9640/rebalance/shards/localhost:9642)"
+echo "remove one that isn't there $(status -X DELETE localhost:9640/rebalance/shards/localhost:9643)"
+echo "remove $(status -X DELETE localhost:9640/rebalance/shards/localhost:9642)"
+finished && echo "finished"
+echo "left on the removed node $(curl -s localhost:9642/ds3/ | wc -l)"
+bad=0
+for idx in $(seq 10); do
+    [[ $(curl -s localhost:9640/ds3/object$idx) == "object $idx" ]] || bad=$(( bad + 1 ))
+done
+echo "$bad unreadable"
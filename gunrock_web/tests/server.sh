@@ -0,0 +1,40 @@
+# Starts and stops gunrock_web for the tests that talk HTTP to it. Tests
+# source this from tests/N.sh, which the test runner runs in gunrock_web.
+
+SERVERS=""
+
+# start_server port [gunrock_web args...]
+# Starts a server on a fresh disk image in tests-out and waits until it
+# answers. Storage nodes and gateways alike answer on /metrics.
+start_server () {
+    local port=$1
+    shift
+    local image=tests-out/$port.img
+    rm -f $image $image.*
+    ./mkfs -f $image -d 256 -i 64 > /dev/null
+    ./gunrock_web -p $port -i $image "$@" > tests-out/$port.log 2>&1 &
+    SERVERS="$SERVERS $!"
+    for try in $(seq 50); do
+        if curl -s -o /dev/null localhost:$port/metrics; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    echo "gunrock_web on port $port did not start" >&2
+    return 1
+}
+
+stop_servers () {
+    if [[ -n $SERVERS ]]; then
+        kill $SERVERS 2> /dev/null
+        wait $SERVERS 2> /dev/null
+    fi
+    SERVERS=""
+}
+
+trap stop_servers EXIT
+
+# header name: the value of header name in a response dumped by curl -D
+header () {
+    grep -i "^$1:" | cut -d' ' -f2- | tr -d '\r'
+}